@@ -0,0 +1,119 @@
+/*
+ * File:        emitor.h
+ * Author:      Aleksandra Matysik
+ * Date:        2024-10-01
+ * Description: The library interface of the emitor converter. The parser is fed the
+ *              XML document in blocks of any size and hands every extracted row to a
+ *              callback as (emitor, path, value) slices, without formatting it.
+ *
+ * Usage:       Compile emitor_expat.c without the command line program, exporting only
+ *              the functions below, and link it with the Expat library and the POSIX
+ *              threads library:
+ *              gcc -shared -fPIC -fvisibility=hidden -DEMITOR_NO_MAIN -o libemitor.so \
+ *                  emitor_expat.c -lexpat -lz -pthread
+ */
+
+#ifndef EMITOR_H
+#define EMITOR_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define EMITOR_API __attribute__((visibility("default")))
+#else
+#define EMITOR_API
+#endif
+
+/*
+ * Structure to store one extracted row, passed to the row sink. All the pointers point into
+ * the buffers of the parser and are valid only during the call of the sink:
+ * - the dotted "emitor.tag.tag" path (not terminated) and its length,
+ * - the length of the emitor name, which starts the path,
+ * - the value of the row (terminated) and its length.
+ */
+typedef struct
+{
+    const char *path;
+    size_t pathLen;
+    size_t emitorLen;
+    const char *value;
+    size_t valueLen;
+} EmitorRecord;
+
+/*
+ * The row sink: called for every row with the user data given to emitorCreate().
+ * A non-zero result stops the parser, emitorFeed() and emitorFinish() then return -1.
+ */
+typedef int (*EmitorRowSink)(void *userData, const EmitorRecord *record);
+
+typedef struct EmitorParser EmitorParser;
+
+/**
+ * @brief   Compiles the extraction rules shared by all the parsers.
+ *
+ * Must be called before the first parser is created if the default rules are not used.
+ *
+ * @param filename  The name of the rule file (see --rules), or NULL for the default rules.
+ * @return  Returns 0 on success, or -1 if the rules could not be read or compiled.
+ */
+EMITOR_API int emitorLoadRules(const char *filename);
+
+/**
+ * @brief   Creates a parser which hands the rows to the given sink.
+ *
+ * @param sink      The row sink.
+ * @param userData  The pointer passed to every call of the sink.
+ * @return  A pointer to the parser, or NULL if it could not be created.
+ */
+EMITOR_API EmitorParser *emitorCreate(EmitorRowSink sink, void *userData);
+
+/**
+ * @brief   Parses the next part of the document (the parts may split the document anywhere).
+ *
+ * @param parser  A pointer to the parser.
+ * @param bytes   A pointer to the part of the document.
+ * @param len     The number of bytes.
+ * @return  Returns 0 on success, or -1 on a parse error or if the sink stopped the parser.
+ */
+EMITOR_API int emitorFeed(EmitorParser *parser, const char *bytes, size_t len);
+
+/**
+ * @brief   Finishes the document, reporting an error if it is incomplete.
+ *
+ * @param parser  A pointer to the parser.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+EMITOR_API int emitorFinish(EmitorParser *parser);
+
+/**
+ * @brief   Prepares the parser for the next document, keeping its buffers.
+ *
+ * @param parser  A pointer to the parser.
+ */
+EMITOR_API void emitorReset(EmitorParser *parser);
+
+/**
+ * @brief   Returns the description of the error which made the last call fail.
+ *
+ * @param parser  A pointer to the parser.
+ * @param line    A pointer to the variable where the line of the error will be stored (may be NULL).
+ * @return  The description of the error (owned by the library).
+ */
+EMITOR_API const char *emitorError(const EmitorParser *parser, long *line);
+
+/**
+ * @brief   Frees the parser.
+ *
+ * @param parser  A pointer to the parser (may be NULL).
+ */
+EMITOR_API void emitorDestroy(EmitorParser *parser);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EMITOR_H
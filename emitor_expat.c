@@ -5,18 +5,54 @@
  * Description: A program that parses an XML file and converts the relevant data
  *              into CSV format. It uses the Expat library for XML parsing.
  *
- * Usage:       Compile the program using gcc and link it with the Expat library:
- *              gcc -o emitor_expat emitor_expat.c -lexpat
+ * Usage:       Compile the program using gcc and link it with the Expat library
+ *              and the POSIX threads library:
+ *              gcc -o emitor_expat emitor_expat.c -lexpat -lz -pthread
+ *              (add -DEMITOR_WITH_ZSTD -lzstd for zstd support, -DEMITOR_STATS
+ *              for the per-stage timers reported by --stats and -DEMITOR_WITH_NUMA -lnuma
+ *              for the NUMA topology and memory policy of libnuma with --numa)
  *
  *              The program reads an input XML file "example.xml" and outputs
  *              the results in a CSV file "wyniki.csv" in the specified format.
+ *              With -DEMITOR_NO_MAIN the file is built as the library declared
+ *              in emitor.h, without the command line program.
  */
 
+#define _GNU_SOURCE // memmem()
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <expat.h>
+#include <zlib.h>
+#ifdef EMITOR_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef EMITOR_WITH_NUMA
+#include <numa.h>
+#endif
+#if defined(EMITOR_STATS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
 #include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include "emitor.h"
 
 #define MIN_ARGC 2
 #define I_INPUT_FILE 1
@@ -25,446 +61,10716 @@
 #define FALSE_ARG 0
 #define HELP_FLAG "-h"
 #define COMMUNICATS_FLAG "-v"
+#define BLOCK_SIZE_FLAG "--block-size="
+#define INPUT_MODE_FLAG "--input="
+#define TIMESTAMP_FLAG "--timestamp="
+#define BENCH_FORMAT_FLAG "--bench-format"
+#define OUT_BUFFER_FLAG "--out-buffer="
+#define WRITER_FLAG "--writer="
+#define BATCH_FLAG "--batch="
+#define THREADS_FLAG "--threads="
+#define SPLIT_FLAG "--split"
+#define STREAM_FLAG "--stream"
+#define COMPRESS_FLAG "--compress="
+#define READ_AHEAD_FLAG "--read-ahead="
+#define FORMAT_FLAG "--format="
+#define INTERN_FLAG "--intern"
+#define PATH_IDS_FLAG "--path-ids="
+#define DELTA_FLAG "--delta="
+#define RULES_FLAG "--rules="
+#define MAX_FIELD_FLAG "--max-field="
+#define STATS_FLAG "--stats"
+#define ENGINE_FLAG "--engine="
+#define WATCH_FLAG "--watch="
+#define AGGREGATE_FLAG "--aggregate"
+#define SORT_FLAG "--sort"
+#define PARTITION_FLAG "--partition-by="
+#define MEMORY_FLAG "--memory="
+#define OPEN_FILES_FLAG "--open-files="
+#define TMP_DIR_FLAG "--tmp-dir="
+#define BUILD_INDEX_FLAG "--build-index"
+#define INDEX_FLAG "--index="
+#define ONLY_FLAG "--only="
+#define NUMA_FLAG "--numa"
+#define RECOVER_FLAG "--recover"
+#define TEE_FLAG "--tee="
+#define TEE_ARROW_PREFIX "arrow:"
+#define TEE_TCP_PREFIX "tcp:"
+#define TEE_UNIX_PREFIX "unix:"
+#define BENCH_SCALING_FLAG "--bench-scaling"
+#define BENCH_STREAM_FLAG "--bench-stream"
+#define STDIO_NAME "-"
+#define GENERATE_FLAG "--generate="
+#define BENCH_FLAG "--bench"
+#define GEN_EMITORS_FLAG "--emitors="
+#define GEN_PARAMS_FLAG "--params="
+#define GEN_DEPTH_FLAG "--depth="
+#define GEN_SIZE_FLAG "--size="
+
+#define CSV_HEADER "\"YYYY-MM-DD\",\"Hour\",\"Emitor.Tags\",\"Pkt_Value\"\n"
+#define CSV_PATH_ID_HEADER "\"YYYY-MM-DD\",\"Hour\",\"Path_Id\",\"Pkt_Value\"\n"
+#define CSV_AGGREGATE_HEADER "\"YYYY-MM-DD\",\"Hour\",\"Emitor.Tags\",\"Count\",\"Min\",\"Max\",\"Mean\"\n"
+#define PATH_DICTIONARY_HEADER "\"Path_Id\",\"Emitor.Tags\"\n"
+#define MAX_THREADS 1024               // Maximum number of worker threads
+#define SPLIT_WINDOW 4                 // Number of emitor ranges per thread parsed ahead of the written one
+#define COPY_BUFFER_SIZE (1024 * 1024) // Size of the buffer used to append the batch results to the merged output
+#define WATCH_EVENT_BUFFER (64 * 1024) // Size of the buffer the inotify events are read into
+#define WATCH_INITIAL_FILES 1024       // Initial size of the array of the latencies of the watch mode
+#define DEFAULT_MEMORY_LIMIT (256 * 1024 * 1024) // Default memory of the rows held by --sort and --partition-by
+#define DEFAULT_OPEN_FILES 64          // Default number of partition files open at the same time
+#define MAX_OPEN_FILES 4096            // Maximum number of partition files open at the same time
+#define PARTITION_MIN_BUFFER (64 * 1024) // Minimum size of the buffer of one open partition file
+#define PARTITION_NONE 0               // All rows go to one output
+#define PARTITION_EMITOR 1             // One output file per emitor name
+#define SORT_INITIAL_ENTRIES 65536     // Initial size of the array of the rows of one sorted run
+#define SORT_MERGE_WAYS 64             // Maximum number of runs merged in one pass
+#define SORT_RUN_BUFFER (256 * 1024)   // Size of the stdio buffer of one spilled run
+#define INDEX_MAGIC "EMIX"             // First bytes of the index sidecar
+#define INDEX_VERSION 1                // Version of the layout of the index sidecar
+#define INDEX_EXTENSION ".idx"         // Extension of the default index sidecar, appended to the input name
+#define INDEX_INITIAL_ENTRIES 1024     // Initial size of the array of the emitors of the index
+
+#define DEFAULT_BLOCK_SIZE (4 * 1024 * 1024) // Default size of one block handed to the parser
+#define INPUT_MODE_AUTO 0                      // mmap for regular files, read() for pipes and terminals
+#define INPUT_MODE_MMAP 1                      // Always map the input file into memory
+#define INPUT_MODE_READ 2                      // Always read() straight into the Expat buffer
+#define DEFAULT_READ_AHEAD 2                   // Default number of blocks read ahead of the parsed one
+#define MAX_READ_AHEAD 16                      // Maximum number of blocks read ahead of the parsed one
+#define READ_AHEAD_SPINS 64                    // Number of busy checks of the ring before yielding the processor
+#define ENGINE_EXPAT 0                         // Every document is parsed by Expat
+#define ENGINE_FAST 1                          // Mapped documents are scanned directly, falling back to Expat
+#define FAST_FALLBACK 1                        // The fast scanner met a construct it does not support
+#define FAST_INITIAL_ATTRIBUTES 16             // Initial size of the attribute array of the fast scanner
+#define NAME_CHAR 1                            // The character may appear in a name (nameChars)
+#define NAME_START 2                           // The character may start a name (nameChars)
+
+#define DEFAULT_OUT_BUFFER (8 * 1024 * 1024) // Default amount of CSV data collected before one write()
+#define WRITER_SYNC 0                         // Rows are written by the parsing thread
+#define WRITER_ASYNC 1                        // Rows are written by a separate thread while the next buffer is filled
+#define MAX_TEES 8                            // Maximum number of --tee outputs
+#define MAX_SINKS (MAX_TEES + 2)              // Maximum number of outputs of the writer (file, console and --tee)
+#define SINK_QUEUE_DEPTH 4                    // Number of batches queued for one output before the parser waits
+#define STREAM_MAIN 0                         // The batches of the output format
+#define STREAM_ARROW 1                        // The batches of the Arrow copy of the CSV rows (--tee=arrow:)
+#define STREAM_COUNT 2
 
-#define STR_SIZE 15  // Maximum length of strings for emitter names, tags, and values
-#define ADD_TAG 5    // Number of additional tags to allocate when more space is needed
-#define ADD_BUFFOR 5 // Number of additional buffers to allocate when more space is needed
+#define FORMAT_CSV 0                       // CSV rows
+#define FORMAT_ARROW 1                     // Arrow IPC file
+#define FORMAT_PARQUET 2                   // Parquet file
+#define COLUMNAR_COLUMNS 4                 // Date, Hour, Emitor.Tags, Pkt_Value
+#define COLUMNAR_BATCH_ROWS (256 * 1024)   // Number of rows of one Arrow record batch or Parquet row group
+#define DICTIONARY_INITIAL_SLOTS 1024      // Initial size of the hash table of the path dictionary, doubled when half full
+#define INTERN_MAX_PATHS 65536             // Maximum number of interned paths of the CSV rows (unlimited with --path-ids)
 
-const char *tagFirstNames[] = {"status", "parametr", "stezenie"};
-const char *tagNames[] = {"auto", "reka", "wartosc", "status", "niepewnosc", "standard"};
+#define CODEC_NONE 0                       // Plain XML or CSV
+#define CODEC_GZIP 1                       // gzip (zlib)
+#define CODEC_ZSTD 2                       // zstd (libzstd, only with EMITOR_WITH_ZSTD)
+#define CODEC_MAGIC_SIZE 4                 // Number of bytes read to detect the codec of the input
+#define CODEC_BUFFER_SIZE (256 * 1024)     // Size of the buffers of the codec threads
+#define GZIP_DEFAULT_LEVEL 6               // Default gzip compression level
+#define ZSTD_DEFAULT_LEVEL 3               // Default zstd compression level
+
+#define TIMESTAMP_NOW 0        // Current time, rendered again when the hour changes
+#define TIMESTAMP_FILE_MTIME 1 // Modification time of the input file
+#define TIMESTAMP_FIXED 2      // Time given on the command line
+#define TIMESTAMP_SIZE 64      // Size of the rendered "YYYY-MM-DD","HH", prefix
+
+#define MAX_TAG_DEPTH 64 // Maximum number of tags on the stack, deeper documents are rejected with an error
+#define ARENA_INITIAL_SIZE (64 * 1024) // Initial size of the output arena, doubled when more space is needed
+#define POOL_CHUNK_SIZE (64 * 1024)    // Size of one chunk of the memory pool of the Expat parser
+#define POOL_CLASSES 48                // Number of size classes of the pool blocks (powers of two from 16 B)
+#define POOL_ALIGNMENT 16              // Alignment of the blocks of the pool
+#define PATH_INITIAL_SIZE 256          // Initial size of the dotted path buffer, doubled when more space is needed
+#define DEFAULT_MAX_FIELD (1024 * 1024) // Default maximum length of the path and of the value of a row
+
+#define STATS_NONE 0 // No --stats report
+#define STATS_TEXT 1 // Report in the format of the verbose statistics
+#define STATS_JSON 2 // Report as a JSON object
 
 /*
- * Structure to store parsed data from the XML file.
+ * Stages measured by the timers compiled in with -DEMITOR_STATS.
+ */
+#define STAGE_START_ELEMENT 0 // startElement() callback (including the rows it saves)
+#define STAGE_END_ELEMENT 1   // endElement() callback (including the text rows it saves)
+#define STAGE_SAVE_DATA 2     // Formatting of one row
+#define STAGE_WRITE 3         // write() of one output buffer
+#define STAGE_COUNT 4
+#define BENCH_DEFAULT_ROWS 10000000    // Number of rows formatted by the --bench-format microbenchmark
+#define BENCH_SAVE_DATA_ROWS 2000000   // Number of rows formatted by saveData() in isolation in the --bench suite
+#define GEN_DEFAULT_EMITORS 1000       // Default number of emitors in a generated document
+#define GEN_DEFAULT_PARAMS 9           // Default number of parametr elements per emitor
+#define BENCH_STREAM_DEFAULT_SIZE (50ULL * 1024 * 1024 * 1024) // Default size of the stream generated by --bench-stream
+#define BENCH_STREAM_SAMPLES 10        // Number of resident memory samples reported by --bench-stream
+#define BENCH_SCALING_JOBS 64          // Number of copies of the generated document in every batch run of --bench-scaling
+#define BENCH_SCALING_MAX_THREADS 64   // Largest number of threads measured by --bench-scaling (doubled from 1)
+#define RECOVER_MAX_RANGES 64          // Largest number of ranges of one emitor block with nested <emitor> elements (--recover)
+
+/*
+ * Identifiers of the interned element names. Anything outside of this vocabulary
+ * (including attribute values pushed as tags) is ELEMENT_OTHER.
+ */
+#define ELEMENT_OTHER 0
+#define ELEMENT_EMITOR 1
+#define ELEMENT_STATUS 2
+#define ELEMENT_PARAMETR 3
+#define ELEMENT_STEZENIE 4
+#define ELEMENT_AUTO 5
+#define ELEMENT_REKA 6
+#define ELEMENT_WARTOSC 7
+#define ELEMENT_NIEPEWNOSC 8
+#define ELEMENT_STANDARD 9
+#define ELEMENT_COUNT 10
+
+/*
+ * Identifiers of the interned attribute names.
+ */
+#define ATTR_OTHER 0
+#define ATTR_NAZWA 1
+#define ATTR_TYP 2
+#define ATTR_PKT 3
+#define ATTR_COUNT 4
+
+/*
+ * Limits of the extraction rules and of the automaton they are compiled into.
+ */
+#define MAX_RULE_STEPS 32         // Maximum number of steps of one rule
+#define MAX_STEP_PREDICATES 4     // Maximum number of [@attr] predicates of one step
+#define MAX_STATE_PUSH 8          // Maximum number of attribute values added to the path by one element
+#define MAX_STATE_VALUES 8        // Maximum number of rules completed by one element (one row each)
+#define RULE_NAME_SIZE 256        // Maximum length of an element or attribute name in a rule (with the terminator)
+#define MATCH_MAX_BITS 8          // Maximum number of attributes tested by [@attr] predicates
+#define MATCH_MAX_POSITIONS 4096  // Maximum number of rule positions in one state of the automaton
+#define MATCH_MAX_STATES 16384    // Maximum number of states of the automaton
+#define MATCH_START_STATE 0       // The state before the root element
+#define MATCH_INITIAL_DEPTH 64    // Initial size of the stack of the automaton states, doubled when needed
+#define VALUE_TEXT -2             // The value of the row is the text of the element (rules ending with text())
+#define TEXT_STEP "text()"        // The last step of the rules taking the value from the text of the element
+
+/*
+ * Errors reported by the callbacks, which stop the parser.
+ */
+#define CONTEXT_OK 0
+#define CONTEXT_TAG_DEPTH 1 // More than MAX_TAG_DEPTH nested tags
+#define CONTEXT_SINK 2      // The row sink of the library asked to stop
+#define CONTEXT_OUTPUT 3    // The sorted or partitioned rows could not be written
+
+/*
+ * States of the ranges parsed in split mode.
+ */
+#define SPLIT_PENDING 0
+#define SPLIT_RUNNING 1
+#define SPLIT_DONE 2
+
+/*
+ * Identifiers of the Arrow IPC format (Schema.fbs and Message.fbs).
+ */
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_DATE 8
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_DICTIONARY_BATCH 2
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_METADATA_V5 4
+
+/*
+ * Types of the Thrift compact protocol and identifiers of the Parquet format (parquet.thrift).
+ */
+#define THRIFT_I32 5
+#define THRIFT_I64 6
+#define THRIFT_BINARY 8
+#define THRIFT_LIST 9
+#define THRIFT_STRUCT 12
+#define PARQUET_INT32 1
+#define PARQUET_INT64 2
+#define PARQUET_BYTE_ARRAY 6
+#define PARQUET_REQUIRED 0
+#define PARQUET_OPTIONAL 1
+#define PARQUET_UTF8 0
+#define PARQUET_DATE 6
+#define PARQUET_UINT_8 11
+#define PARQUET_PLAIN 0
+#define PARQUET_PLAIN_DICTIONARY 2
+#define PARQUET_RLE 3
+#define PARQUET_DATA_PAGE 0
+#define PARQUET_DICTIONARY_PAGE 2
+
+// The ASCII characters of element and attribute names accepted by the fast scanner (other bytes need Expat)
+const unsigned char nameChars[256] = {['A' ... 'Z'] = NAME_START | NAME_CHAR, ['a' ... 'z'] = NAME_START | NAME_CHAR,
+                                      ['_'] = NAME_START | NAME_CHAR, [':'] = NAME_START | NAME_CHAR,
+                                      ['0' ... '9'] = NAME_CHAR, ['-'] = NAME_CHAR, ['.'] = NAME_CHAR};
+const char *outputExtensions[] = {".csv", ".arrow", ".parquet"};
+const char *stageNames[STAGE_COUNT] = {"start_element", "end_element", "save_data", "write"};
+const char *elementNames[ELEMENT_COUNT] = {"", "emitor", "status", "parametr", "stezenie", "auto", "reka", "wartosc", "niepewnosc", "standard"};
+
+/*
+ * The default extraction rules, equivalent to the built-in conversion: the values of status, auto,
+ * reka, wartosc, niepewnosc and standard elements at any depth below a status, parametr or stezenie
+ * element (followed by its typ, if it has one, in the path).
+ */
+const char *defaultRules[] = {
+    "//status[@typ?]//status/@pkt",
+    "//status[@typ?]//auto/@pkt",
+    "//status[@typ?]//reka/@pkt",
+    "//status[@typ?]//wartosc/@pkt",
+    "//status[@typ?]//niepewnosc/@pkt",
+    "//status[@typ?]//standard/@pkt",
+    "//parametr[@typ?]//status/@pkt",
+    "//parametr[@typ?]//auto/@pkt",
+    "//parametr[@typ?]//reka/@pkt",
+    "//parametr[@typ?]//wartosc/@pkt",
+    "//parametr[@typ?]//niepewnosc/@pkt",
+    "//parametr[@typ?]//standard/@pkt",
+    "//stezenie[@typ?]//status/@pkt",
+    "//stezenie[@typ?]//auto/@pkt",
+    "//stezenie[@typ?]//reka/@pkt",
+    "//stezenie[@typ?]//wartosc/@pkt",
+    "//stezenie[@typ?]//niepewnosc/@pkt",
+    "//stezenie[@typ?]//standard/@pkt",
+};
+
+/*
+ * Structure to store the output arena - one contiguous buffer the CSV rows are appended to.
  * It includes:
- * - emitter name,
- * - dynamically allocated array of tags,
- * - value associated with the current element.
+ * - the buffer, the number of used bytes and its allocated size,
+ * - the largest number of bytes used between two resets (peak memory use),
+ * - the number of rows currently stored and the total number of rows written.
  */
 typedef struct
 {
-    char emitor[STR_SIZE];
-    char **tags;
-    int nTags;
-    int allocatedTags;
-    char value[STR_SIZE];
-} Data;
+    char *buffer;
+    size_t len;
+    size_t allocated;
+    size_t peak;
+    size_t nRows;
+    size_t totalRows;
+} OutputArena;
 
 /*
- * Structure to store the parser context, including:
- * - pointer to a Data structure for current XML element data,
- * - dynamically allocated buffer to store multiple entries,
- * - buffer management details like the number of buffers and their allocated size.
+ * Structure to store the dictionary of the distinct paths (the interned paths of the CSV rows
+ * and the path dictionary of the columnar output), including:
+ * - the bytes of the paths and the offsets of the entries (nEntries + 1, as in an Arrow Utf8 column),
+ * - the open addressing hash table of the entries (0 marks an empty slot, otherwise index + 1),
+ * - the pre-rendered cells of the CSV rows and their offsets (only for the interned paths).
  */
 typedef struct
 {
-    Data *data;
-    char **dataBuffers;
-    int nBuff;
-    int allocatedBuffers;
-} ParserContext;
+    OutputArena strings;
+    uint32_t *offsets;
+    int nEntries;
+    int allocatedEntries;
+    uint32_t *slots;
+    size_t nSlots;
+    OutputArena rendered;
+    uint32_t *renderedOffsets;
+    int allocatedRendered;
+} PathDictionary;
 
-/**
- * @brief Displays the program help.
+/*
+ * Structure to store one tag on the tag stack: its identifier (ELEMENT_*) and the position
+ * and length of its text in the dotted path.
  */
-void print_help( void ) {
-    printf("Użycie: expat_example <plik_wejsciowy.xml> <plik_wyjsciowy.csv> [-v]\n");
-    printf("  -v            Włącza tryb szczegółowy (wyświetla przetworzone dane w konsoli)\n");
-    printf("\n");
-    printf("Program parsuje plik XML i konwertuje dane dotyczące emitorów do formatu CSV.\n");
-    printf("Plik wejściowy XML powinien zawierać dane o emitorach, a wynikowy plik CSV\n");
-    printf("zostanie wygenerowany z przetworzonymi wartościami, w tym z datą i godziną.\n");
-    printf("\n");
-    printf("Przykłady użycia:\n");
-    printf("  ./expat_example plik_wejsciowy.xml plik_wyjsciowy.csv\n");
-    printf("  ./expat_example plik_wejsciowy.xml plik_wyjsciowy.csv -v\n");
-}
+typedef struct
+{
+    int id;
+    unsigned int offset;
+    unsigned int length;
+} TagSlice;
 
-/**
- * @brief   Checks if a given string is present in an array.
- *
- * @param val       Pointer to the string to be checked.
- * @param array     A pointer to the array to be searched.
- * @param arraySize The size of the array.
- * @return  Returns 1 if the value is found in the array, otherwise 0.
+/*
+ * Structure to store parsed data from the XML file.
+ * It includes:
+ * - the length of the emitter name, which starts the dotted path,
+ * - fixed-capacity stack of tags, pointing into the dotted path,
+ * - the dotted "emitor.tag.tag" path maintained incrementally as tags are added and removed,
+ * - value associated with the current element and its length (pointing into the attributes
+ *   of the element being parsed or into the collected text, never copied),
+ * - the dictionary the paths are interned in (NULL if they are not) and whether the rows
+ *   carry numeric path identifiers instead of the paths.
  */
-int valueInArray(const char *val, const char **array, int arraySize)
+typedef struct
 {
-    for (int i = 0; i < arraySize; i++)
-    {
-        if (!strcmp(array[i], val))
-        {
-            return 1;
-        }
-    }
-    return 0;
-}
+    size_t emitorLen;
+    TagSlice tags[MAX_TAG_DEPTH];
+    int nTags;
+    char *path;
+    size_t pathLen;
+    size_t allocatedPath;
+    const char *value;
+    size_t valueLen;
+    PathDictionary *paths;
+    int pathIds;
+} Data;
 
-/**
- * @brief   Reallocates memory for a dynamic array when needed.
- *
- * This function checks if more memory is required and reallocates memory in chunks,
- * based on the provided increment size.
- *
- * @param array          A pointer to the array that needs to be resized.
- * @param currentSize    The current number of elements in the array.
- * @param allocatedSize  A pointer to the current allocated size (it will be updated).
- * @param increment      The number of elements to add during reallocation.
- * @param elementSize    The size of each element in the array.
- * @return  A pointer to the newly reallocated array.
+/*
+ * Structure to store the timestamp written at the beginning of every CSV row, including:
+ * - timestamp source (current time, input file modification time, fixed value),
+ * - the moment when the current time has to be rendered again (start of the next hour),
+ * - the rendered "YYYY-MM-DD","HH", prefix and its length,
+ * - the same date as days since 1970-01-01 and the hour (used by the columnar formats).
  */
-void *relocateMemmory(void *array, int currentSize, int *allocatedSize, int increment, size_t elementSize)
+typedef struct
 {
-    if (currentSize >= *allocatedSize)
-    {
-        *allocatedSize += increment;
-        array = realloc(array, *allocatedSize * elementSize);
-        if (!array)
-        {
-            perror("Błąd relokacji pamięci!");
-            exit(EXIT_FAILURE);
-        }
-    }
-    return array;
-}
+    int mode;
+    time_t nextUpdate;
+    char prefix[TIMESTAMP_SIZE];
+    int prefixLen;
+    int32_t days;
+    int hour;
+} Timestamp;
 
-/**
- * @brief   Allocates new memory for a dynamic array when needed.
- *
- * @param array          A pointer to the array that needs to be sized.
- * @param sizeToAllocate The number of elements to add during allocation.
- * @param elementSize    The size of each element in the array.
- * @return  A pointer to the allocated array.
+/*
+ * Structure to store the time spent on the input, including:
+ * - the time the parser waited for data (blocked on read() or on the read-ahead ring),
+ * - the time spent in the parser (including the callbacks) and in read() by the reading thread,
+ * - the number of blocks and bytes handed to the parser.
  */
-void *alocateNewMemmory(void *array, int sizeToAllocate, size_t elementSize)
+typedef struct
 {
-    array = malloc(sizeToAllocate * elementSize);
-    if (!array)
-    {
-        perror("Błąd alokacji pamięci!");
-        exit(EXIT_FAILURE);
-    }
-    return array;
-}
+    double waitSeconds;
+    double parseSeconds;
+    double readSeconds;
+    size_t blocks;
+    size_t bytes;
+} InputStats;
 
-/**
- * @brief   Frees the dynamically allocated memory for an array of strings.
- *
- * @param array   A pointer to the array of strings to be freed.
- * @param size    The number of elements (strings) in the array.
+/*
+ * Structure to store the number of calls of every stage (STAGE_*) and the ticks spent in it,
+ * counted only when the timers are compiled in with -DEMITOR_STATS.
  */
-void freeMemmory(char **array, int size)
+typedef struct
 {
-    for (int i = 0; i < size; i++)
-    {
-        free(array);
-    }
-    free(array);
-}
+    uint64_t calls[STAGE_COUNT];
+    uint64_t ticks[STAGE_COUNT];
+} StageStats;
 
-/**
- * @brief   Initializes the Data structure, allocating memory for the tags.
- *
- * The function sets the initial number of tags to zero and allocates memory for
- * the array of tags based on a pre-defined number of tags (ADD_TAG).
- *
- * @param data  A pointer to the Data structure to be initialized.
+/*
+ * Structure to store the location of one encapsulated Arrow message (Block of the file footer).
  */
-void initData(Data *data)
+typedef struct
 {
-    data->nTags = 0;
-    data->allocatedTags = ADD_TAG;
-    data->tags = alocateNewMemmory(data->tags, data->allocatedTags, sizeof(char *));
-}
+    int64_t offset;
+    int32_t metaDataLength;
+    int32_t padding;
+    int64_t bodyLength;
+} ArrowBlock;
 
-/**
- * @brief   Initializes the ParserContext structure, linking it to the Data structure.
- *
- * The function sets initial values for buffer management, including setting the
- * initial number of buffers to zero.
- *
- * @param context  A pointer to the ParserContext structure to be initialized.
- * @param data     A pointer to the Data structure for the current XML data.
+/*
+ * Structure to store the row groups written to a Parquet file: the number of rows and,
+ * for every column chunk, the offsets of its dictionary page (-1 if none) and first data page
+ * and the size of the chunk.
  */
-void initParserContext(ParserContext *context, Data *data)
+typedef struct
 {
-    context->data = data;
-    context->dataBuffers = NULL;
-    context->nBuff = 0;
-    context->allocatedBuffers = 0;
-}
+    int64_t rows;
+    int64_t dictionaryOffset[COLUMNAR_COLUMNS];
+    int64_t dataOffset[COLUMNAR_COLUMNS];
+    int64_t size[COLUMNAR_COLUMNS];
+} ParquetRowGroup;
 
-/**
- * @brief   Adds a new tag to the Data structure.
- *
- * The function dynamically allocates memory for a new tag and copies the given tag string
- * into the Data structure's tag array. It reallocates memory if needed.
- *
- * @param data  A pointer to the Data structure where the tag will be added.
- * @param tag   A string representing the tag to be added.
+/*
+ * Structure to store the columnar writer (--format=arrow|parquet), including:
+ * - the format and the number of bytes of the file produced so far,
+ * - the columns of the current batch: date, hour, path index, pkt value and its validity bitmap,
+ * - the path dictionary shared by all batches,
+ * - the buffers the metadata and the body of a message are built in,
+ * - the record batches and the dictionary of an Arrow file, or the row groups of a Parquet file.
  */
-void addTag(Data *data, const char *tag)
+typedef struct
 {
-    relocateMemmory(data->tags, data->nTags, &data->allocatedTags, ADD_TAG, sizeof(char *));
-    data->tags[data->nTags] = alocateNewMemmory(data->tags[data->nTags], (strlen(tag) + 1), sizeof(char));
-    strcpy(data->tags[data->nTags], tag);
-    data->nTags++;
-}
+    int format;
+    size_t offset;
+    int32_t *dates;
+    uint8_t *hours;
+    int32_t *paths;
+    int64_t *values;
+    uint8_t *valid;
+    size_t nRows;
+    size_t nNulls;
+    PathDictionary dictionary;
+    OutputArena meta;
+    OutputArena body;
+    ArrowBlock *batches;
+    int nBatches;
+    int allocatedBatches;
+    ArrowBlock dictionaryBlock;
+    ParquetRowGroup *rowGroups;
+    int nRowGroups;
+    int allocatedRowGroups;
+} ColumnarWriter;
 
-/**
- * @brief   Formats and saves the collected data into CSV format.
- *
- * The function concatenates the 'emitor' and its associated tags into a single string,
- * then formats the data into a CSV string with a timestamp (YYYY-MM-DD, Hour), emitter tags, and value.
- *
- * @param tm   A pointer to a struct containing the current time data (year, month, day, hour).
- * @param data A pointer to the Data struct containing emitter and tag information.
- * @param str  A pointer to a string buffer where the formatted CSV line will be stored.
+/*
+ * Structure to store one column of the Arrow schema: its name, nullability, type (ARROW_TYPE_*),
+ * the width and signedness of integers and whether the column is dictionary-encoded.
  */
-void saveData(struct tm *tm, Data *data, char *str)
+typedef struct
 {
-    char oneTag[300];
+    const char *name;
+    uint8_t nullable;
+    uint8_t type;
+    int32_t bitWidth;
+    uint8_t isSigned;
+    int dictionary;
+} ArrowColumn;
 
-    strcpy(oneTag, data->emitor);
-    for (int i = 0; i < data->nTags; i++)
-    {
-        strcat(oneTag, ".");
-        strcat(oneTag, data->tags[i]);
-    }
-    sprintf(str, "\"%d-%02d-%02d\",\"%d\",\"%s\",\"%s\"\n",
-            tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour,
-            oneTag, data->value);
-}
+const ArrowColumn arrowColumns[COLUMNAR_COLUMNS] = {
+    {"Date", 0, ARROW_TYPE_DATE, 0, 0, 0},
+    {"Hour", 0, ARROW_TYPE_INT, 8, 0, 0},
+    {"Emitor.Tags", 0, ARROW_TYPE_UTF8, 0, 0, 1},
+    {"Pkt_Value", 1, ARROW_TYPE_INT, 64, 1, 0},
+};
 
-/**
- * @brief   Adds a new element of data, appending a timestamp and calling saveData().
- *
- * The function retrieves the current system time, formats the data using saveData(),
- * and increments the buffer counter for storing the next entry.
- *
- * @param context  A pointer to the ParserContext struct containing buffers with content and parsed XML data to be saved.
+/*
+ * Structure to store one column of the Parquet schema: its name, physical type, repetition
+ * and converted type (-1 if none).
  */
-void saveOneElement(ParserContext *context)
+typedef struct
 {
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
+    const char *name;
+    int type;
+    int repetition;
+    int convertedType;
+} ParquetColumn;
 
-    context->dataBuffers = relocateMemmory(context->dataBuffers, context->nBuff, &(context->allocatedBuffers), ADD_BUFFOR, sizeof(char *));
+const ParquetColumn parquetColumns[COLUMNAR_COLUMNS] = {
+    {"Date", PARQUET_INT32, PARQUET_REQUIRED, PARQUET_DATE},
+    {"Hour", PARQUET_INT32, PARQUET_REQUIRED, PARQUET_UINT_8},
+    {"Emitor.Tags", PARQUET_BYTE_ARRAY, PARQUET_REQUIRED, PARQUET_UTF8},
+    {"Pkt_Value", PARQUET_INT64, PARQUET_OPTIONAL, -1},
+};
 
-    for (int i = context->nBuff; i < context->allocatedBuffers; i++)
-    {
-        context->dataBuffers[i] = alocateNewMemmory(context->dataBuffers[i], 1024, sizeof(char));
-    }
+/*
+ * Structure to store a FlatBuffers table being built: the positions of its vtable and of the
+ * table itself and the number of field slots. The metadata of the Arrow format is built front
+ * to back - the vtable just before the table and the objects the table refers to after it,
+ * with the offset fields patched once their position is known (the offsets point forward).
+ */
+typedef struct
+{
+    size_t vtable;
+    size_t table;
+    int nSlots;
+} FlatTable;
 
-    saveData(&tm, context->data, context->dataBuffers[context->nBuff]);
-    context->nBuff++;
-}
+/*
+ * Structure to store the state of the delta conversion (--delta), including:
+ * - the content hashes of the emitors read from the state file (by emitor name),
+ * - the content hashes of the emitors of the current document, written back to the state file,
+ * - the emitor being parsed: its depth (0 if none), whether it has a name, the hash of its
+ *   subtree so far and its rows, held back until the emitor ends,
+ * - the number of changed and unchanged emitors.
+ */
+typedef struct
+{
+    PathDictionary previous;
+    uint64_t *previousHashes;
+    int allocatedPrevious;
+    PathDictionary current;
+    uint64_t *currentHashes;
+    int allocatedCurrent;
+    int emitorDepth;
+    int named;
+    uint64_t hash;
+    OutputArena rows;
+    size_t changed;
+    size_t unchanged;
+} DeltaState;
 
-/**
- * @brief   Function called when the parser encounters the beginning of an XML element.
- *
- * This function handles the start of an XML element and extracts relevant data such as
- * emitter names, tags, and values from the element's attributes.
- * It assigns attribute values to the Data struct and prepares data for saving when needed.
- *
- * @param userData  A pointer to user data (the ParserContext struct in this case).
- * @param name      Name of the currently processed XML element.
- * @param attr      An array of attributes of the XML element (alternating name and attribute value).
+/*
+ * Structure to store the running statistics of the values of one path in one hour, and the length
+ * of the rendered timestamp prefix its key starts with.
  */
-void XMLCALL startElement(void *userData, const char *name, const char **attr)
+typedef struct
 {
-    ParserContext *context = (ParserContext *)userData;
-    Data *data = context->data;
+    uint64_t count;
+    double min;
+    double max;
+    double sum;
+    size_t prefixLen;
+} PathStatistics;
 
-    if (!strcmp(name, "emitor"))
-    {
-        for (int i = 0; attr[i]; i += 2)
-        {
-            if (strcmp(attr[i], "nazwa") == 0)
-            {
-                strcpy(data->emitor, attr[i + 1]);
-            }
-        }
-    }
-    else if (data->nTags == 0 && valueInArray(name, tagFirstNames, (sizeof(tagFirstNames) / sizeof(tagFirstNames[0]))))
-    {
-        addTag(data, name);
-        for (int i = 0; attr[i]; i += 2)
-        {
-            if (strcmp(attr[i], "typ") == 0)
-            {
-                addTag(data, attr[i + 1]);
-                break;
-            }
-        }
-    }
-    else if (data->nTags != 0)
-    {
-        addTag(data, name);
-        if(valueInArray(name, tagNames, (sizeof(tagNames) / sizeof(tagNames[0])))) {
-            for (int i = 0; attr[i]; i += 2)
-            {
-                if (strcmp(attr[i], "pkt") == 0)
-                {
-                    strcpy(data->value, attr[i + 1]);
-                    break;
-                }
-            }
-            saveOneElement(context);
-        }
-    }
-}
+/*
+ * Structure to store the aggregation of the --aggregate mode, including:
+ * - the dictionary of the keys (the rendered "YYYY-MM-DD","HH", prefix followed by the path),
+ * - the statistics of every key,
+ * - the buffer the key of the current row is built in,
+ * - the number of rows whose value is not a number (not aggregated).
+ */
+typedef struct
+{
+    PathDictionary keys;
+    PathStatistics *statistics;
+    int allocatedStatistics;
+    OutputArena key;
+    size_t nonNumeric;
+} Aggregation;
 
-/**
- * @brief   Function called when the parser encounters the end of an XML element.
- *
- * This function decreases the tag counter when an XML element ends.
- *
- * @param userData  A pointer to user data (the ParserContext struct in this case).
- * @param name      Name of the currently terminated XML element.
+/*
+ * Structure to store the header of one row of a sorted run: the length of the formatted row,
+ * the offset and the length of the sort key (the path, as quoted in the row) in the row, and the
+ * length of the quoted emitor name the path starts with. The spilled runs store every row as its header followed by the row.
  */
-void XMLCALL endElement(void *userData, const char *name)
+typedef struct
 {
-    ParserContext *context = (ParserContext *)userData;
-    Data *data = context->data;
+    uint32_t rowLen;
+    uint32_t keyOffset;
+    uint32_t keyLen;
+    uint32_t emitorLen;
+} SortHeader;
 
-    if (data->nTags > 0) {
-        data->nTags--;
-        if(data->nTags == 1 && valueInArray(name, tagFirstNames, (sizeof(tagFirstNames) / sizeof(tagFirstNames[0])))) {
-            data->nTags--;
-        }
-    }
-}
+/*
+ * Structure to store one row of the run kept in memory: its offset in the buffer of the run and its header.
+ */
+typedef struct
+{
+    size_t offset;
+    SortHeader header;
+} SortEntry;
 
-/**
- * @brief   Function called when the parser encounters text data in an XML element.
- *
- * This function is not currently implemented, but it could be used to handle text content
- * within XML elements.
- *
- * @param userData  A pointer to user data (the ParserContext struct in this case).
- * @param s         A pointer to the text data (string) contained in the XML element.
- * @param len       Length of the text data.
+/*
+ * Structure to store the sorter of the --sort mode, including:
+ * - the formatted rows of the current run and their entries,
+ * - the memory limit of the run and the directory of the spilled runs,
+ * - the spilled runs (unlinked temporary files, in the order they were written),
+ * - the number of rows spilled to the temporary files.
  */
-void XMLCALL characterData(void *userData, const XML_Char *s, int len)
+typedef struct
 {
-    // TODO: Implementation for handling character data in XML elements
-}
+    OutputArena rows;
+    SortEntry *entries;
+    int nEntries;
+    int allocatedEntries;
+    size_t memoryLimit;
+    const char *tmpDir;
+    FILE **runs;
+    int nRuns;
+    int allocatedRuns;
+    size_t spilledRows;
+} Sorter;
 
-int main(int argc, char *argv[])
+/*
+ * Structure to store the reading position of one run during the merge:
+ * the run, the header of its current row and the row itself.
+ */
+typedef struct
 {
-    int verboseFlag = FALSE_ARG;
+    FILE *file;
+    SortHeader header;
+    OutputArena row;
+} SortRunReader;
 
-    for (int i = 1; i < argc; i++)
-    {
-        if(strcmp(argv[i], HELP_FLAG) == 0)
+/*
+ * Structure to store one open partition file: the partition (index of its name), the descriptor,
+ * the moment of the last row (for the eviction of the least recently used file) and the buffered rows.
+ */
+typedef struct
+{
+    int partition;
+    int fd;
+    uint64_t lastUse;
+    OutputArena rows;
+} PartitionHandle;
+
+/*
+ * Structure to store the partitioned output of --partition-by=emitor, including:
+ * - the output directory, the dictionary of the emitor names (one partition per name) and the
+ *   dictionary of the file names of the partitions (with the same indices, every name is unique),
+ * - the open handle of every partition (-1 if its file is closed),
+ * - the pool of open files, its size limit and the size of the buffer of one file,
+ * - the clock of the least recently used eviction,
+ * - the emitor name of the previous row and its partition (consecutive rows share the emitor),
+ * - the buffer the file name of the current row is built in,
+ * - the buffer the quoted emitor name of a sorted row is restored in,
+ * - the number of times a closed file had to be opened again, and the number of partitions
+ *   whose file name got a suffix because another emitor already had it.
+ */
+typedef struct
+{
+    const char *directory;
+    PathDictionary emitors;
+    PathDictionary names;
+    int *handles;
+    int allocatedHandles;
+    PartitionHandle *open;
+    int nOpen;
+    int maxOpen;
+    size_t bufferSize;
+    uint64_t clock;
+    OutputArena lastEmitor;
+    int lastPartition;
+    OutputArena name;
+    OutputArena unquoted;
+    size_t reopened;
+    size_t renamed;
+} PartitionSet;
+
+/*
+ * Structure to store one step of an extraction rule: the element (-1 for any element),
+ * whether it may be any descendant of the previous step (or only its child), the attributes
+ * of its predicates, which of them are required, and the bits of the required attributes.
+ */
+typedef struct
+{
+    int element;
+    int descendant;
+    int nPredicates;
+    int predicates[MAX_STEP_PREDICATES];
+    int required[MAX_STEP_PREDICATES];
+    uint32_t requiredMask;
+} RuleStep;
+
+/*
+ * Structure to store one extraction rule: its steps, the first step whose element is part of
+ * the path (the one after the last emitor step; the emitor and its ancestors only give context)
+ * and the attribute holding the value of the row (VALUE_TEXT for the text of the element).
+ */
+typedef struct
+{
+    RuleStep steps[MAX_RULE_STEPS];
+    int nSteps;
+    int firstPathStep;
+    int valueAttribute;
+} Rule;
+
+/*
+ * Structure to store one state of the automaton - the rule positions it stands for and the actions
+ * of the element which leads to it: whether the element is part of the path, the attributes whose
+ * values follow its name in the path and the values of the rows of the rules it completes (attributes,
+ * or VALUE_TEXT for the text of the element), in the order of the rules.
+ */
+typedef struct
+{
+    int positionsStart;
+    int nPositions;
+    int onPath;
+    int nValues;
+    int32_t values[MAX_STATE_VALUES];
+    int nPush;
+    int32_t push[MAX_STATE_PUSH];
+} MatchState;
+
+/*
+ * Structure to store the extraction rules compiled into a deterministic automaton, including:
+ * - the rules and the names of their elements and attributes outside the built-in vocabulary,
+ * - the bits of the attributes tested by predicates (indexed by attribute identifier),
+ * - the number of element identifiers and of input symbols ((element << nBits) | attribute bits),
+ * - the states, their rule positions (and the dictionary used to merge identical states),
+ * - the transition table, one row of nSymbols targets per state.
+ */
+typedef struct
+{
+    Rule *rules;
+    int nRules;
+    int allocatedRules;
+    PathDictionary elementNames;
+    PathDictionary attributeNames;
+    uint32_t *attributeBits;
+    int nAttributes;
+    int nBits;
+    int nElements;
+    int nSymbols;
+    MatchState *states;
+    int nStates;
+    int allocatedStates;
+    int32_t *positions;
+    int nPositions;
+    int allocatedPositions;
+    PathDictionary stateKeys;
+    int32_t *next;
+} Matcher;
+
+Matcher extractionRules;
+
+/*
+ * Structure to store one chunk of the memory pool: the next chunk of the list, the size of
+ * the chunk and the number of bytes handed out (the blocks follow the header).
+ */
+typedef struct PoolChunk
+{
+    struct PoolChunk *next;
+    size_t size;
+    size_t used;
+} PoolChunk;
+
+/*
+ * Structure to store the memory pool of one Expat parser (passed to XML_ParserCreate_MM),
+ * including:
+ * - the list of the chunks (kept for the next document) and the chunk the blocks are cut from,
+ * - the lists of the freed blocks of every size class (reused before the chunk is cut),
+ * - the number of allocation calls served and of the requested bytes,
+ * - the number of chunks allocated from the system, their bytes, and the number of resets.
+ */
+typedef struct ParserPool
+{
+    PoolChunk *chunks;
+    PoolChunk *current;
+    void *freeBlocks[POOL_CLASSES];
+    size_t calls;
+    size_t bytes;
+    size_t chunkCalls;
+    size_t chunkBytes;
+    size_t resets;
+} ParserPool;
+
+/*
+ * Structure to store the header of a block of the pool: the pool which owns the block
+ * (NULL for a block of the system allocator) and the size class of the block.
+ */
+typedef struct
+{
+    ParserPool *pool;
+    size_t sizeClass;
+} PoolBlock;
+
+/*
+ * Structure to store the parser context, including:
+ * - pointer to a Data structure for current XML element data,
+ * - pointer to the timestamp shared by all rows,
+ * - the output arena the entries are appended to until the next flush,
+ * - the parser the callbacks are called by and the error which stopped it (CONTEXT_*),
+ * - the current element depth and the number of emitors without a name
+ *   (used to verify the ranges parsed independently in split mode),
+ * - the time spent waiting for the input and parsing it,
+ * - the columnar writer the rows are appended to instead of the arena (NULL for CSV),
+ * - the state of the delta conversion (NULL if every emitor is converted),
+ * - the compiled extraction rules, the automaton state of every open element and the number
+ *   of tags the element added to the path,
+ * - the text of the element whose text is the value of a row and its depth (0 if there is none),
+ * - the per-stage counters of --stats,
+ * - the row sink of the library and its user data (NULL if the rows are formatted),
+ * - the number of rows reached by the callbacks and of the first rows to be skipped
+ *   (the rows already saved by the fast scanner before it fell back to Expat),
+ * - the aggregation the rows are added to instead of being written (NULL without --aggregate),
+ * - the sorter and the partitioned output the rows go to (NULL without --sort and --partition-by),
+ * - the memory pool of the Expat parser (its counters are reported by --stats),
+ * - the columnar writer of the Arrow copy of the CSV rows and its arena (NULL without --tee=arrow:).
+ */
+typedef struct
+{
+    Data *data;
+    Timestamp *timestamp;
+    OutputArena output;
+    XML_Parser parser;
+    int error;
+    int depth;
+    int unnamedEmitors;
+    InputStats input;
+    ColumnarWriter *columnar;
+    DeltaState *delta;
+    const Matcher *matcher;
+    int32_t *matchStates;
+    uint8_t *pushedTags;
+    int allocatedDepth;
+    OutputArena text;
+    int textDepth;
+    StageStats *stages;
+    EmitorRowSink sink;
+    void *sinkData;
+    size_t rowsSeen;
+    size_t skipRows;
+    Aggregation *aggregation;
+    Sorter *sorter;
+    PartitionSet *partitions;
+    const ParserPool *pool;
+    ColumnarWriter *arrow;
+    OutputArena *arrowOutput;
+} ParserContext;
+
+/*
+ * Structure to store everything needed to convert one document, reused between documents:
+ * - the Expat parser and the pool all its memory comes from (both discarded and the parser
+ *   created again before the next document, keeping the chunks of the pool),
+ * - the parsed data, the timestamp and the parser context with its output arena,
+ * - the dictionary of the interned paths (kept between documents).
+ */
+typedef struct
+{
+    XML_Parser parser;
+    ParserPool pool;
+    Data data;
+    Timestamp timestamp;
+    ParserContext context;
+    PathDictionary paths;
+} Converter;
+
+/*
+ * Structure to store the state of one parser of the library (declared in emitor.h).
+ */
+struct EmitorParser
+{
+    Converter converter;
+};
+
+/*
+ * Structure to store one batch of formatted rows (a flushed arena buffer) shared by all the outputs
+ * of its stream: the buffer, the number of used and allocated bytes, the number of outputs which
+ * have not written it yet, and the next batch of the free list.
+ */
+typedef struct RowBatch
+{
+    char *buffer;
+    size_t len;
+    size_t allocated;
+    int refs;
+    struct RowBatch *next;
+} RowBatch;
+
+/*
+ * Structure to store one output of the writer (the output file, the console or a --tee destination):
+ * - the descriptor, the name used in messages and whether the writer closes the descriptor,
+ * - the stream of batches it writes (STREAM_*) and whether its errors are ignored (the console),
+ * - its writing thread, signaled when a batch is queued, and the queue of batches,
+ * - the first write error, the number of bytes and write() calls and the number of times
+ *   the parser waited because the queue was full.
+ */
+typedef struct
+{
+    int fd;
+    const char *name;
+    int owned;
+    int stream;
+    int optional;
+    pthread_t thread;
+    pthread_cond_t cond;
+    RowBatch *queue[SINK_QUEUE_DEPTH];
+    int head;
+    int count;
+    int error;
+    size_t bytesWritten;
+    size_t writes;
+    size_t stalls;
+} OutputSink;
+
+/*
+ * Structure to store the output writer, a registry of outputs fed from one parse, including:
+ * - the outputs, the first one being the output file,
+ * - the amount of data collected in the arena before it is written,
+ * - state of the asynchronous backend: the lock of the queues, the condition signaled when a batch
+ *   is released, the free list of the batches (their buffers are returned to the arenas),
+ *   the stop flag of the threads and the number of outputs which have their thread,
+ * - the bytes and the write() calls of the output file,
+ * - the arena of the Arrow copy of the rows (NULL without --tee=arrow:).
+ */
+typedef struct
+{
+    OutputSink sinks[MAX_SINKS];
+    int nSinks;
+    size_t flushSize;
+    int async;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    RowBatch *spare;
+    int stop;
+    int nStarted;
+    size_t bytesWritten;
+    size_t writes;
+    StageStats *stages;
+    OutputArena *arrow;
+} OutputWriter;
+
+/*
+ * Structure to store the parameters of the synthetic document generator, including:
+ * - the number of emitors and of parametr elements per emitor,
+ * - the number of additional nesting levels around the values of the parameters,
+ * - the minimal size of the document in bytes (0 if the number of emitors decides).
+ */
+typedef struct
+{
+    size_t emitors;
+    size_t params;
+    size_t depth;
+    size_t size;
+} GeneratorOptions;
+
+/*
+ * Structure to store the number of allocation calls and of the requested bytes,
+ * both by the program and by Expat (through the counting XML_Memory_Handling_Suite).
+ */
+typedef struct
+{
+    size_t calls;
+    size_t bytes;
+} AllocationStats;
+
+AllocationStats allocationStats;
+
+/*
+ * Structure to store the maximum length of the path and of the value of a row and the number
+ * of rows skipped because one of them was longer (updated atomically by all the threads).
+ */
+typedef struct
+{
+    size_t maxLength;
+    size_t skippedRows;
+} FieldLimits;
+
+FieldLimits fieldLimits = {DEFAULT_MAX_FIELD, 0};
+
+/*
+ * Structure to store one block of the read-ahead ring: its buffer and the number of bytes
+ * read into it (0 at the end of data, -1 on error).
+ */
+typedef struct
+{
+    char *buffer;
+    ssize_t len;
+    int error;
+} ReadBlock;
+
+/*
+ * Structure to store the read-ahead ring shared by the reading thread and the parser:
+ * - the input descriptor, the size of the blocks and the blocks of the ring,
+ * - the number of blocks filled by the reading thread and released by the parser
+ *   (each counter is written by one side only, so the ring needs no lock),
+ * - the stop flag, the time spent in read() and the reading thread.
+ */
+typedef struct
+{
+    int fd;
+    size_t blockSize;
+    ReadBlock *blocks;
+    size_t nBlocks;
+    size_t filled;
+    size_t released;
+    int stop;
+    double readSeconds;
+    pthread_t thread;
+} ReadAhead;
+
+/*
+ * Structure to store one codec stage of the pipeline, run by its own thread:
+ * - the codec (CODEC_GZIP, CODEC_ZSTD), the direction and the compression level,
+ * - the descriptors the stage reads from and writes to (one of them is a pipe),
+ * - the bytes consumed from the input while its codec was detected,
+ * - the thread and the result of the stage.
+ */
+typedef struct
+{
+    int codec;
+    int compress;
+    int level;
+    int inFd;
+    int outFd;
+    unsigned char prefix[CODEC_MAGIC_SIZE];
+    size_t prefixLen;
+    pthread_t thread;
+    int result;
+} CodecStage;
+
+/*
+ * Structure to store the state of the streaming benchmark, shared by its threads:
+ * - the write end of the pipe and the parameters of the generator,
+ * - the number of bytes and emitors generated so far,
+ * - the stop flag of the sampling thread and the peak resident memory in every tenth of the stream.
+ */
+typedef struct
+{
+    FILE *out;
+    GeneratorOptions generator;
+    size_t bytesWritten;
+    size_t emitors;
+    int stop;
+    long rss[BENCH_STREAM_SAMPLES];
+} StreamBench;
+
+/*
+ * Structure to store the command line options, including:
+ * - verbose mode flag,
+ * - input mode (mmap or read() into the Expat buffer),
+ * - size of one block handed to the parser,
+ * - timestamp source and the fixed time (used only with TIMESTAMP_FIXED),
+ * - size of the output buffer and the output writer backend,
+ * - the number of worker threads used in batch and split modes (0 means one per CPU),
+ * - split mode flag (parsing the emitor blocks of one file in parallel),
+ * - the parameters of the synthetic document generator (--generate and --bench),
+ * - streaming mode flag (rows are written as soon as every block has been parsed),
+ * - the codec and the compression level of the output (--compress),
+ * - the number of blocks read ahead of the parsed one (0 disables the reading thread),
+ * - the output format (CSV, Arrow IPC or Parquet),
+ * - path interning flag and the file of the numeric path identifiers (NULL if the rows carry the paths),
+ * - the state file of the delta conversion (NULL if every emitor is converted),
+ * - the file of the extraction rules (NULL for the default rules),
+ * - the form of the --stats report (STATS_*),
+ * - the parsing engine (ENGINE_*),
+ * - aggregation flag (one row of statistics per path and hour instead of the rows),
+ * - sort flag and the partitioning (PARTITION_*) with its output directory,
+ * - the memory limit of the sorted and partitioned rows, the number of open partition files
+ *   and the directory of the spilled runs,
+ * - the index sidecar of the input (NULL if the document is not indexed) and the comma-separated
+ *   names of the emitors parsed with its help (NULL to parse the whole document),
+ * - NUMA flag (the workers of the batch and split modes are pinned to the CPUs of the nodes in turn),
+ * - recovery flag (malformed emitor blocks are skipped instead of stopping the conversion),
+ * - the additional outputs of the rows (--tee) and their number.
+ */
+typedef struct
+{
+    int verbose;
+    int inputMode;
+    size_t blockSize;
+    int timestampMode;
+    struct tm fixedTime;
+    size_t outBufferSize;
+    int writerMode;
+    int threads;
+    int split;
+    GeneratorOptions generator;
+    int stream;
+    int compressCodec;
+    int compressLevel;
+    int readAhead;
+    int format;
+    int intern;
+    const char *pathIdsFile;
+    const char *deltaFile;
+    const char *rulesFile;
+    int stats;
+    int engine;
+    int aggregate;
+    int sort;
+    int partitionBy;
+    const char *partitionDir;
+    size_t memoryLimit;
+    int openFiles;
+    const char *tmpDir;
+    const char *indexFile;
+    const char *onlyNames;
+    int numa;
+    int recover;
+    const char *tees[MAX_TEES];
+    int nTees;
+} Options;
+
+/*
+ * Structure to store the placement of the worker threads (--numa): the CPUs the process may run on
+ * and the NUMA node of each of them, ordered so that consecutive workers go to different nodes
+ * (the first CPU of every node, then the second one, ...), and the number of nodes.
+ */
+typedef struct
+{
+    int *cpus;
+    int *nodes;
+    int nCpus;
+    int nNodes;
+} CpuPlacement;
+
+/*
+ * Structure to store the deque of the jobs of one batch worker: the indices of the jobs, the first
+ * job not taken yet (the owner takes its jobs from the front, in the order of the list), the end
+ * of the deque (other workers steal from the back) and the lock of the deque.
+ */
+typedef struct
+{
+    int *jobs;
+    int head;
+    int tail;
+    pthread_mutex_t lock;
+} JobDeque;
+
+/*
+ * Structure to store the byte range of one top-level <emitor> block of a mapped document.
+ * The range reaches up to the beginning of the next block (or the end of the document).
+ */
+typedef struct
+{
+    size_t start;
+    size_t end;
+} EmitorRange;
+
+/*
+ * Structure to store the header of the index sidecar (--build-index), written in the byte order
+ * of the machine: the magic bytes and the version, the size and the modification time
+ * (in nanoseconds) of the indexed document, the length of its prolog (everything before
+ * the first emitor), the number of emitors and the total length of their names.
+ */
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t fileSize;
+    int64_t mtime;
+    uint64_t prologLen;
+    uint32_t nEntries;
+    uint32_t namesLen;
+} IndexHeader;
+
+/*
+ * Structure to store one outermost <emitor> element of the index: the byte offset of its start tag,
+ * the length of the element up to the end of its end tag and the length of its nazwa attribute.
+ * The names follow the entries in the sidecar, in the same order and without terminators.
+ */
+typedef struct
+{
+    uint64_t start;
+    uint32_t length;
+    uint32_t nameLen;
+} IndexEntry;
+
+/*
+ * Structure to store the index of a document, including:
+ * - the header, the entries and the names of the emitors,
+ * - while the index is built: the Expat parser, the element depth, the depth of the open
+ *   outermost emitor (0 if there is none), the length of its start tag and the error
+ *   which stopped the parser (an element longer than the entries can describe).
+ */
+typedef struct
+{
+    IndexHeader header;
+    IndexEntry *entries;
+    int allocatedEntries;
+    OutputArena names;
+    XML_Parser parser;
+    int depth;
+    int emitorDepth;
+    uint32_t startLen;
+    int error;
+} EmitorIndex;
+
+/*
+ * Structure to store the result of one range parsed in split mode, including:
+ * - the state of the range (SPLIT_PENDING, SPLIT_RUNNING, SPLIT_DONE) and its result,
+ * - the arena buffer with the formatted rows, its length and allocated size, the number of rows,
+ * - the name of the last emitor of the range (needed when the next range falls back to serial parsing).
+ */
+typedef struct
+{
+    int state;
+    int result;
+    char *buffer;
+    size_t len;
+    size_t allocated;
+    size_t rows;
+    char *lastEmitor;
+} SplitFragment;
+
+/*
+ * Structure to store the document parsed in split mode, shared by the worker threads:
+ * - the mapped document, the length of its prolog (everything before the first emitor) and the ranges,
+ * - the results of the ranges, the index of the next range to be taken and of the next one to be written,
+ * - the number of ranges which may be parsed ahead of the written one, the cancellation flag,
+ * - the command line options, the lock and the condition signalled when the state changes,
+ * - the placement of the workers (NULL without --numa) and the number of workers started so far.
+ */
+typedef struct
+{
+    const char *map;
+    size_t size;
+    size_t prologLen;
+    EmitorRange *ranges;
+    int nRanges;
+    SplitFragment *fragments;
+    int nextFragment;
+    int written;
+    int window;
+    int cancel;
+    const Options *options;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    const CpuPlacement *placement;
+    int nextWorker;
+} SplitDocument;
+
+/*
+ * Structure to store one file of the batch, including:
+ * - the input file name and the output file name (NULL if the rows go to the merged output),
+ * - the temporary file holding the rows for the merged output,
+ * - the state of the job: finished flag, result and the number of rows written.
+ */
+typedef struct
+{
+    char *input;
+    char *output;
+    FILE *temporary;
+    int done;
+    int result;
+    size_t rows;
+} BatchJob;
+
+/*
+ * Structure to store the batch shared by the worker threads, including:
+ * - the list of jobs and the deques of the workers the jobs are dealt to,
+ * - the number of workers started so far and the number of jobs stolen from other workers,
+ * - the placement of the workers (NULL without --numa),
+ * - the command line options,
+ * - the lock and the condition signalled whenever a job is finished,
+ * - the aggregation the partial aggregations of the workers are merged into (--aggregate).
+ */
+typedef struct
+{
+    BatchJob *jobs;
+    int nJobs;
+    JobDeque *deques;
+    int nDeques;
+    int nextWorker;
+    int stolen;
+    const CpuPlacement *placement;
+    const Options *options;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    Aggregation aggregation;
+} Batch;
+
+/**
+ * @brief Displays the program help.
+ */
+void print_help( void ) {
+    printf("Użycie: expat_example <plik_wejsciowy.xml> <plik_wyjsciowy.csv> [-v]\n");
+    printf("                (\"-\" zamiast nazwy pliku oznacza standardowe wejście lub wyjście)\n");
+    printf("  -v            Włącza tryb szczegółowy (wyświetla przetworzone dane w konsoli)\n");
+    printf("  --block-size=N  Rozmiar bloku przekazywanego do parsera (np. 64K, 4M; domyślnie 4M)\n");
+    printf("  --input=TRYB    Sposób odczytu wejścia: auto, mmap lub read (domyślnie auto)\n");
+    printf("  --read-ahead=N  Liczba bloków odczytywanych przez osobny wątek z wyprzedzeniem (0-16,\n");
+    printf("                  domyślnie 2; 0 wyłącza wątek odczytu)\n");
+    printf("  --timestamp=ŹRÓDŁO  Data i godzina w wierszach: now, file-mtime lub fixed:RRRR-MM-DDTGG\n");
+    printf("                      (domyślnie now)\n");
+    printf("  --out-buffer=N  Ilość danych CSV zbieranych przed jednym zapisem (domyślnie 8M)\n");
+    printf("  --writer=TRYB   Sposób zapisu wyników: sync lub async (zapis w osobnym wątku)\n");
+    printf("  --batch=LISTA   Konwertuje wszystkie pliki z listy (jeden plik w wierszu, opcjonalnie\n");
+    printf("                  po tabulatorze własny plik wynikowy); pozostałe trafiają do wspólnego pliku\n");
+    printf("  --threads=N     Liczba wątków w trybie wsadowym i podziału (domyślnie liczba procesorów)\n");
+    printf("  --split         Dzieli plik na bloki <emitor> i parsuje je równolegle\n");
+    printf("  --bench-format[=N]  Porównuje szybkość formatowania N wierszy z implementacją sprintf()\n");
+    printf("  --generate=PLIK Zapisuje syntetyczny dokument energetyka do pliku (\"-\" na standardowe wyjście)\n");
+    printf("  --bench[=PLIK]  Mierzy przetwarzanie syntetycznego dokumentu, wyniki w formacie JSON\n");
+    printf("  --stream        Tryb strumieniowy: wiersze są zapisywane po każdym bloku, stałe zużycie pamięci\n");
+    printf("                  (włączany automatycznie, gdy plikiem wejściowym lub wynikowym jest \"-\")\n");
+    printf("  --compress=KODEK[:POZIOM]  Kompresuje plik wynikowy: gzip[:1-9] lub zstd[:1-22] (domyślnie\n");
+    printf("                  gzip:6 i zstd:3); skompresowane wejście jest rozpoznawane automatycznie\n");
+    printf("  --intern        Zapamiętuje różne ścieżki emitorów i kopiuje gotowe pola CSV (do %d ścieżek)\n", INTERN_MAX_PATHS);
+    printf("  --path-ids=PLIK Zapisuje w wierszach numer ścieżki zamiast ścieżki, a słownik numerów\n");
+    printf("                  do pliku PLIK (CSV \"Path_Id\",\"Emitor.Tags\")\n");
+    printf("  --delta=PLIK    Zapisuje tylko wiersze emitorów zmienionych od poprzedniego uruchomienia;\n");
+    printf("                  skróty zawartości emitorów są przechowywane w pliku stanu PLIK\n");
+    printf("  --rules=PLIK    Reguły wyboru wartości (jedna w wierszu, np. emitor[@nazwa]/parametr[@typ]/wartosc/@pkt);\n");
+    printf("                  ostatni krok text() pobiera wartość z tekstu elementu; domyślnie wartości pkt\n");
+    printf("                  elementów status, parametr i stezenie\n");
+    printf("  --aggregate     Zamiast wierszy zapisuje liczbę, minimum, maksimum i średnią wartości każdej\n");
+    printf("                  ścieżki w każdej godzinie; w trybie --batch dla wszystkich plików listy\n");
+    printf("  --sort          Zapisuje wiersze uporządkowane według ścieżki (Emitor.Tags); przebiegi większe\n");
+    printf("                  niż limit pamięci są sortowane w plikach tymczasowych i scalane\n");
+    printf("  --partition-by=emitor  Zapisuje wiersze każdego emitora do osobnego pliku w katalogu\n");
+    printf("                  podanym zamiast pliku wynikowego\n");
+    printf("  --memory=N[K|M|G] Limit pamięci wierszy --sort i --partition-by (domyślnie 256M)\n");
+    printf("  --open-files=N  Liczba jednocześnie otwartych plików --partition-by (domyślnie %d)\n", DEFAULT_OPEN_FILES);
+    printf("  --tmp-dir=KATALOG Katalog plików tymczasowych --sort (domyślnie $TMPDIR lub /tmp)\n");
+    printf("  --build-index   Zapisuje indeks emitorów pliku wejściowego (położenie, długość i nazwa każdego\n");
+    printf("                  elementu <emitor>) do pliku PLIK.xml.idx lub podanego w --index\n");
+    printf("  --index=PLIK    Plik indeksu; z --split zastępuje wstępne skanowanie dokumentu\n");
+    printf("  --only=K3,K7    Przetwarza tylko emitory o podanych nazwach, odczytując z indeksu ich położenie\n");
+    printf("  --tee=WYJŚCIE   Dodatkowe wyjście wierszy z tego samego parsowania: plik, -, tcp:HOST:PORT lub\n");
+    printf("                  unix:ŚCIEŻKA; z prefiksem arrow: kopia w formacie Arrow IPC (do %d wyjść)\n", MAX_TEES);
+    printf("  --recover       Pomija uszkodzone bloki <emitor> (zapisując ich zakres bajtów na stderr) i kontynuuje\n");
+    printf("                  od następnego emitora zamiast przerywać konwersję\n");
+    printf("  --numa          Przypina wątki --batch i --split do procesorów, rozkładając je na węzły NUMA;\n");
+    printf("                  bufory wątku są przydzielane w pamięci jego węzła\n");
+    printf("  --bench-scaling[=PLIK]  Mierzy skalowanie --batch i --split dla 1, 2, 4 ... 64 wątków,\n");
+    printf("                  wyniki (wiersze na sekundę) w formacie JSON\n");
+    printf("  --watch=KATALOG [KATALOG_WYNIKÓW]  Tryb ciągły: konwertuje każdy plik XML zapisany w katalogu\n");
+    printf("                  (inotify), wyniki publikuje przez rename(); kończy się po SIGINT/SIGTERM\n");
+    printf("  --engine=SILNIK expat (domyślnie) lub fast - bezpośrednie skanowanie zmapowanych plików\n");
+    printf("                  w podzbiorze XML eksportera, z powrotem do Expat dla innych dokumentów\n");
+    printf("  --stats[=json]  Po konwersji wypisuje statystyki etapów (wczytane i zapisane bajty, elementy,\n");
+    printf("                  wiersze, alokacje, czasy); czasy wywołań po kompilacji z -DEMITOR_STATS\n");
+    printf("  --max-field=N   Maksymalna długość ścieżki i wartości wiersza (domyślnie 1M), dłuższe wiersze\n");
+    printf("                  są pomijane i zliczane\n");
+    printf("  --format=FORMAT Format pliku wynikowego: csv, arrow (plik Arrow IPC, *.arrow) lub parquet\n");
+    printf("                  (*.parquet); ścieżki emitorów są zapisywane jako słownik, Pkt_Value jako int64\n");
+    printf("  --bench-stream[=PLIK]  Mierzy tryb strumieniowy na dokumencie generowanym do potoku\n");
+    printf("                  (domyślnie 50 GB), wyniki w formacie JSON\n");
+    printf("  --emitors=N --params=N --depth=N --size=N\n");
+    printf("                  Liczba emitorów, parametrów w emitorze, dodatkowych poziomów zagnieżdżenia\n");
+    printf("                  i minimalny rozmiar dokumentu generowanego przez --generate i --bench\n");
+    printf("\n");
+    printf("Program parsuje plik XML i konwertuje dane dotyczące emitorów do formatu CSV.\n");
+    printf("Plik wejściowy XML powinien zawierać dane o emitorach, a wynikowy plik CSV\n");
+    printf("zostanie wygenerowany z przetworzonymi wartościami, w tym z datą i godziną.\n");
+    printf("\n");
+    printf("Przykłady użycia:\n");
+    printf("  ./expat_example plik_wejsciowy.xml plik_wyjsciowy.csv\n");
+    printf("  ./expat_example plik_wejsciowy.xml plik_wyjsciowy.csv -v\n");
+    printf("  ./expat_example plik_wejsciowy.xml plik_wyjsciowy.csv --block-size=16M\n");
+    printf("  ./expat_example plik_wejsciowy.xml plik_wyjsciowy.csv --timestamp=fixed:2024-10-01T13\n");
+    printf("  ./expat_example --batch=lista.txt wspolny.csv --threads=8\n");
+}
+
+/**
+ * @brief   Sets the default values of the command line options.
+ *
+ * @param options  A pointer to the Options structure to be initialized.
+ */
+void initOptions(Options *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->verbose = FALSE_ARG;
+    options->inputMode = INPUT_MODE_AUTO;
+    options->blockSize = DEFAULT_BLOCK_SIZE;
+    options->timestampMode = TIMESTAMP_NOW;
+    options->outBufferSize = DEFAULT_OUT_BUFFER;
+    options->writerMode = WRITER_SYNC;
+    options->threads = 0;
+    options->generator.emitors = GEN_DEFAULT_EMITORS;
+    options->generator.params = GEN_DEFAULT_PARAMS;
+    options->compressCodec = CODEC_NONE;
+    options->readAhead = DEFAULT_READ_AHEAD;
+    options->format = FORMAT_CSV;
+    options->intern = FALSE_ARG;
+    options->pathIdsFile = NULL;
+    options->deltaFile = NULL;
+    options->rulesFile = NULL;
+    options->stats = STATS_NONE;
+    options->engine = ENGINE_EXPAT;
+    options->aggregate = FALSE_ARG;
+    options->sort = FALSE_ARG;
+    options->partitionBy = PARTITION_NONE;
+    options->partitionDir = NULL;
+    options->memoryLimit = DEFAULT_MEMORY_LIMIT;
+    options->openFiles = DEFAULT_OPEN_FILES;
+    options->tmpDir = NULL;
+    options->indexFile = NULL;
+    options->onlyNames = NULL;
+    options->numa = FALSE_ARG;
+    options->recover = FALSE_ARG;
+    options->nTees = 0;
+}
+
+/**
+ * @brief   Parses a size given on the command line, with an optional K, M or G suffix.
+ *
+ * @param str   The string to be parsed (e.g. "4M").
+ * @param size  A pointer to the variable where the parsed size will be stored.
+ * @return  Returns 1 if the size is valid and greater than zero, otherwise 0.
+ */
+int parseSize(const char *str, size_t *size)
+{
+    char *end;
+    unsigned long long value = strtoull(str, &end, 10);
+
+    if (end == str)
+    {
+        return 0;
+    }
+    switch (*end)
+    {
+    case 'G': case 'g': value *= 1024;
+    /* fall through */
+    case 'M': case 'm': value *= 1024;
+    /* fall through */
+    case 'K': case 'k': value *= 1024;
+        end++;
+        break;
+    }
+    if (*end != '\0' || value == 0 || value > INT_MAX)
+    {
+        return 0;
+    }
+    *size = (size_t)value;
+    return 1;
+}
+
+/**
+ * @brief   Parses one of the options of the synthetic document generator.
+ *
+ * @param arg        The command line argument (--emitors=N, --params=N, --depth=N or --size=N).
+ * @param generator  A pointer to the generator parameters to be updated.
+ * @return  Returns 1 if the value is valid, otherwise 0.
+ */
+int parseGeneratorOption(const char *arg, GeneratorOptions *generator)
+{
+    const char *value = strchr(arg, '=') + 1;
+    char *end;
+
+    if (strncmp(arg, GEN_SIZE_FLAG, strlen(GEN_SIZE_FLAG)) == 0)
+    {
+        // The document size may exceed the limits of parseSize()
+        unsigned long long size = strtoull(value, &end, 10);
+        switch (*end)
+        {
+        case 'G': case 'g': size *= 1024;
+        /* fall through */
+        case 'M': case 'm': size *= 1024;
+        /* fall through */
+        case 'K': case 'k': size *= 1024;
+            end++;
+            break;
+        }
+        generator->size = size;
+        return end != value && *end == '\0' && size > 0;
+    }
+
+    unsigned long long number = strtoull(value, &end, 10);
+    if (end == value || *end != '\0')
+    {
+        return 0;
+    }
+    if (strncmp(arg, GEN_EMITORS_FLAG, strlen(GEN_EMITORS_FLAG)) == 0)
+    {
+        generator->emitors = number;
+        return number > 0;
+    }
+    if (strncmp(arg, GEN_PARAMS_FLAG, strlen(GEN_PARAMS_FLAG)) == 0)
+    {
+        generator->params = number;
+        return 1;
+    }
+    generator->depth = number;
+    return number < MAX_TAG_DEPTH - 4;
+}
+
+/**
+ * @brief   Parses the value of the --compress option (gzip[:LEVEL] or zstd[:LEVEL]).
+ *
+ * @param str      The value of the option.
+ * @param options  A pointer to the command line options to be updated.
+ * @return  Returns 1 if the value is valid, otherwise 0.
+ */
+int parseCompression(const char *str, Options *options)
+{
+    int minLevel, maxLevel;
+    size_t nameLen = strcspn(str, ":");
+
+    if (nameLen == 4 && strncmp(str, "gzip", 4) == 0)
+    {
+        options->compressCodec = CODEC_GZIP;
+        options->compressLevel = GZIP_DEFAULT_LEVEL;
+        minLevel = 1;
+        maxLevel = 9;
+    }
+    else if (nameLen == 4 && strncmp(str, "zstd", 4) == 0)
+    {
+        options->compressCodec = CODEC_ZSTD;
+        options->compressLevel = ZSTD_DEFAULT_LEVEL;
+        minLevel = 1;
+        maxLevel = 22;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (str[nameLen] == ':')
+    {
+        char *end;
+        long level = strtol(str + nameLen + 1, &end, 10);
+        if (end == str + nameLen + 1 || *end != '\0' || level < minLevel || level > maxLevel)
+        {
+            return 0;
+        }
+        options->compressLevel = (int)level;
+    }
+    return 1;
+}
+
+/**
+ * @brief   Returns the number of days in a month of the Gregorian calendar.
+ *
+ * @param year   The full year (e.g. 2024).
+ * @param month  The month, from 1 to 12.
+ * @return  The number of days in the month, taking leap years into account.
+ */
+int daysInMonth(int year, int month)
+{
+    static const int days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return month == 2 && leap ? 29 : days[month - 1];
+}
+
+/**
+ * @brief   Parses the value of the --timestamp option.
+ *
+ * Accepted values are "now", "file-mtime" and "fixed:YYYY-MM-DDTHH" (a space may be used
+ * instead of 'T'); the day of a fixed timestamp must exist in its month.
+ *
+ * @param str      The string to be parsed.
+ * @param options  A pointer to the options where the timestamp source will be stored.
+ * @return  Returns 1 if the value is valid, otherwise 0.
+ */
+int parseTimestamp(const char *str, Options *options)
+{
+    if (strcmp(str, "now") == 0)
+    {
+        options->timestampMode = TIMESTAMP_NOW;
+        return 1;
+    }
+    if (strcmp(str, "file-mtime") == 0)
+    {
+        options->timestampMode = TIMESTAMP_FILE_MTIME;
+        return 1;
+    }
+    if (strncmp(str, "fixed:", 6) == 0)
+    {
+        struct tm *tm = &options->fixedTime;
+        char separator, rest;
+
+        memset(tm, 0, sizeof(*tm));
+        if (sscanf(str + 6, "%4d-%2d-%2d%c%2d%c", &tm->tm_year, &tm->tm_mon, &tm->tm_mday, &separator, &tm->tm_hour, &rest) != 5 ||
+            (separator != 'T' && separator != ' ') || tm->tm_mon < 1 || tm->tm_mon > 12 ||
+            tm->tm_mday < 1 || tm->tm_mday > daysInMonth(tm->tm_year, tm->tm_mon) || tm->tm_hour < 0 || tm->tm_hour > 23)
+        {
+            return 0;
+        }
+        tm->tm_year -= 1900;
+        tm->tm_mon -= 1;
+        options->timestampMode = TIMESTAMP_FIXED;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief   Interns an element name, dispatching on its length and first characters.
+ *
+ * The switch selects at most one candidate from the vocabulary (names starting with 's' are
+ * told apart by their length before any further character is read), which is then confirmed
+ * with a full comparison, so the cost does not depend on the size of the vocabulary.
+ *
+ * @param name  The element name.
+ * @return  The identifier of the element (ELEMENT_*), or ELEMENT_OTHER if it is unknown.
+ */
+int lookupElement(const char *name)
+{
+    int id = ELEMENT_OTHER;
+
+    switch (name[0])
+    {
+    case 'a': id = ELEMENT_AUTO; break;
+    case 'e': id = ELEMENT_EMITOR; break;
+    case 'n': id = ELEMENT_NIEPEWNOSC; break;
+    case 'p': id = ELEMENT_PARAMETR; break;
+    case 'r': id = ELEMENT_REKA; break;
+    case 'w': id = ELEMENT_WARTOSC; break;
+    case 's':
+    {
+        // status (6 characters), stezenie and standard (8 characters)
+        size_t length = strlen(name);
+        if (length == 6)
+        {
+            id = ELEMENT_STATUS;
+        }
+        else if (length == 8)
+        {
+            id = name[2] == 'e' ? ELEMENT_STEZENIE : ELEMENT_STANDARD;
+        }
+        break;
+    }
+    }
+    return id != ELEMENT_OTHER && strcmp(name, elementNames[id]) == 0 ? id : ELEMENT_OTHER;
+}
+
+/**
+ * @brief   Interns an attribute name.
+ *
+ * @param name  The attribute name.
+ * @return  The identifier of the attribute (ATTR_*), or ATTR_OTHER if it is unknown.
+ */
+int lookupAttribute(const char *name)
+{
+    switch (name[0])
+    {
+    case 'n': return strcmp(name, "nazwa") == 0 ? ATTR_NAZWA : ATTR_OTHER;
+    case 't': return strcmp(name, "typ") == 0 ? ATTR_TYP : ATTR_OTHER;
+    case 'p': return strcmp(name, "pkt") == 0 ? ATTR_PKT : ATTR_OTHER;
+    }
+    return ATTR_OTHER;
+}
+
+/**
+ * @brief   Allocates memory, counting the call and the requested size.
+ *
+ * @param size  The number of bytes to be allocated.
+ * @return  A pointer to the allocated memory, or NULL.
+ */
+void *countedMalloc(size_t size)
+{
+    __atomic_add_fetch(&allocationStats.calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocationStats.bytes, size, __ATOMIC_RELAXED);
+    return malloc(size);
+}
+
+/**
+ * @brief   Reallocates memory, counting the call and the requested size.
+ *
+ * @param ptr   A pointer to the memory to be reallocated (may be NULL).
+ * @param size  The new size in bytes.
+ * @return  A pointer to the reallocated memory, or NULL.
+ */
+void *countedRealloc(void *ptr, size_t size)
+{
+    __atomic_add_fetch(&allocationStats.calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocationStats.bytes, size, __ATOMIC_RELAXED);
+    return realloc(ptr, size);
+}
+
+/**
+ * @brief   Frees memory allocated with countedMalloc() or countedRealloc().
+ *
+ * @param ptr  A pointer to the memory to be freed.
+ */
+void countedFree(void *ptr)
+{
+    free(ptr);
+}
+
+const XML_Memory_Handling_Suite countingMemorySuite = {countedMalloc, countedRealloc, countedFree};
+
+// The pool the Expat parser run by this thread allocates from (the memory suite has no user data)
+__thread ParserPool *activePool = NULL;
+
+/**
+ * @brief   Returns the size class of a block: the smallest power of two of POOL_ALIGNMENT
+ *          multiples holding the header and the requested bytes.
+ *
+ * @param size  The number of requested bytes.
+ * @return  The size class (the capacity of the block is POOL_ALIGNMENT << class).
+ */
+size_t poolSizeClass(size_t size)
+{
+    size_t sizeClass = 0;
+    while (((size_t)POOL_ALIGNMENT << sizeClass) < size + sizeof(PoolBlock))
+    {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+/**
+ * @brief   Allocates a block from the memory pool of the active parser.
+ *
+ * A freed block of the same size class is reused first, otherwise the block is cut from
+ * the current chunk. When it does not fit, the next kept chunk is used if it is big enough,
+ * or a new chunk (at least POOL_CHUNK_SIZE) is allocated from the system and inserted after
+ * the current one. Without an active pool the block comes from the system allocator.
+ *
+ * @param size  The number of bytes to be allocated.
+ * @return  A pointer to the allocated memory, or NULL.
+ */
+void *poolMalloc(size_t size)
+{
+    ParserPool *pool = activePool;
+    size_t sizeClass = poolSizeClass(size);
+    if (sizeClass >= POOL_CLASSES)
+    {
+        return NULL;
+    }
+    size_t capacity = (size_t)POOL_ALIGNMENT << sizeClass;
+    PoolBlock *block;
+
+    if (!pool)
+    {
+        block = countedMalloc(capacity);
+        if (!block)
+        {
+            return NULL;
+        }
+        block->pool = NULL;
+        block->sizeClass = sizeClass;
+        return block + 1;
+    }
+
+    pool->calls++;
+    pool->bytes += size;
+    if (pool->freeBlocks[sizeClass])
+    {
+        block = pool->freeBlocks[sizeClass];
+        pool->freeBlocks[sizeClass] = *(void **)block;
+        block->pool = pool;
+        return block + 1;
+    }
+
+    PoolChunk *chunk = pool->current;
+    if (!chunk || chunk->size - chunk->used < capacity)
+    {
+        size_t header = (sizeof(PoolChunk) + POOL_ALIGNMENT - 1) & ~(size_t)(POOL_ALIGNMENT - 1);
+        if (chunk && chunk->next && chunk->next->size - header >= capacity)
+        {
+            chunk = chunk->next;
+        }
+        else
+        {
+            size_t chunkSize = header + capacity > POOL_CHUNK_SIZE ? header + capacity : POOL_CHUNK_SIZE;
+            PoolChunk *added = countedMalloc(chunkSize);
+            if (!added)
+            {
+                return NULL;
+            }
+            pool->chunkCalls++;
+            pool->chunkBytes += chunkSize;
+            added->size = chunkSize;
+            if (chunk)
+            {
+                added->next = chunk->next;
+                chunk->next = added;
+            }
+            else
+            {
+                added->next = NULL;
+                pool->chunks = added;
+            }
+            chunk = added;
+        }
+        chunk->used = header;
+        pool->current = chunk;
+    }
+
+    block = (PoolBlock *)((char *)chunk + chunk->used);
+    chunk->used += capacity;
+    block->pool = pool;
+    block->sizeClass = sizeClass;
+    return block + 1;
+}
+
+/**
+ * @brief   Frees a block of the pool, putting it on the list of its size class.
+ *
+ * @param ptr  A pointer to the memory to be freed (may be NULL).
+ */
+void poolFree(void *ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+    PoolBlock *block = (PoolBlock *)ptr - 1;
+    ParserPool *pool = block->pool;
+    if (!pool)
+    {
+        free(block);
+        return;
+    }
+    *(void **)block = pool->freeBlocks[block->sizeClass];
+    pool->freeBlocks[block->sizeClass] = block;
+}
+
+/**
+ * @brief   Reallocates a block of the pool, in place if its size class still holds the new size.
+ *
+ * The new block comes from the pool which owns the old one.
+ *
+ * @param ptr   A pointer to the memory to be reallocated (may be NULL).
+ * @param size  The new size in bytes.
+ * @return  A pointer to the reallocated memory, or NULL.
+ */
+void *poolRealloc(void *ptr, size_t size)
+{
+    if (!ptr)
+    {
+        return poolMalloc(size);
+    }
+    PoolBlock *block = (PoolBlock *)ptr - 1;
+    size_t capacity = ((size_t)POOL_ALIGNMENT << block->sizeClass) - sizeof(PoolBlock);
+    if (size <= capacity)
+    {
+        if (block->pool)
+        {
+            block->pool->calls++;
+            block->pool->bytes += size;
+        }
+        return ptr;
+    }
+
+    ParserPool *active = activePool;
+    activePool = block->pool;
+    void *moved = poolMalloc(size);
+    activePool = active;
+    if (moved)
+    {
+        memcpy(moved, ptr, capacity);
+        poolFree(ptr);
+    }
+    return moved;
+}
+
+const XML_Memory_Handling_Suite poolMemorySuite = {poolMalloc, poolRealloc, poolFree};
+
+/**
+ * @brief   Initializes an empty memory pool and makes it the pool of the calling thread.
+ *
+ * @param pool  A pointer to the ParserPool structure.
+ */
+void initPool(ParserPool *pool)
+{
+    memset(pool, 0, sizeof(*pool));
+    activePool = pool;
+}
+
+/**
+ * @brief   Releases all the blocks of the pool at once and makes it the pool of the calling thread.
+ *
+ * Only the first chunk and the lists of the freed blocks are reset, so the time does not depend
+ * on the number of blocks. The chunks are kept and reused in order for the next document, every
+ * one is cleared when the pool reaches it.
+ *
+ * @param pool  A pointer to the ParserPool structure.
+ */
+void resetPool(ParserPool *pool)
+{
+    memset(pool->freeBlocks, 0, sizeof(pool->freeBlocks));
+    pool->current = pool->chunks;
+    if (pool->current)
+    {
+        pool->current->used = (sizeof(PoolChunk) + POOL_ALIGNMENT - 1) & ~(size_t)(POOL_ALIGNMENT - 1);
+    }
+    pool->resets++;
+    activePool = pool;
+}
+
+/**
+ * @brief   Frees all the chunks of the pool.
+ *
+ * @param pool  A pointer to the ParserPool structure.
+ */
+void freePool(ParserPool *pool)
+{
+    PoolChunk *chunk = pool->chunks;
+    while (chunk)
+    {
+        PoolChunk *next = chunk->next;
+        countedFree(chunk);
+        chunk = next;
+    }
+    pool->chunks = NULL;
+    pool->current = NULL;
+    if (activePool == pool)
+    {
+        activePool = NULL;
+    }
+}
+
+#ifdef EMITOR_STATS
+/**
+ * @brief   Reads the tick counter of the stage timers.
+ *
+ * On x86 this is the time stamp counter (a few cycles per read), elsewhere nanoseconds of
+ * CLOCK_MONOTONIC. The ticks are converted to seconds only when the report is printed.
+ *
+ * @return  The current number of ticks.
+ */
+static inline uint64_t readTicks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+#define STAGE_BEGIN(name) uint64_t name##Ticks = readTicks()
+#define STAGE_END(stats, stage, name)                                 \
+    if (stats)                                                        \
+    {                                                                 \
+        (stats)->calls[stage]++;                                      \
+        (stats)->ticks[stage] += readTicks() - name##Ticks;           \
+    }
+#else
+#define STAGE_BEGIN(name)
+#define STAGE_END(stats, stage, name)
+#endif
+
+/**
+ * @brief   Reallocates memory for a dynamic array when needed.
+ *
+ * This function checks if more memory is required and reallocates memory in chunks,
+ * based on the provided increment size.
+ *
+ * @param array          A pointer to the array that needs to be resized.
+ * @param currentSize    The current number of elements in the array.
+ * @param allocatedSize  A pointer to the current allocated size (it will be updated).
+ * @param increment      The number of elements to add during reallocation.
+ * @param elementSize    The size of each element in the array.
+ * @return  A pointer to the newly reallocated array.
+ */
+void *relocateMemmory(void *array, int currentSize, int *allocatedSize, int increment, size_t elementSize)
+{
+    if (currentSize >= *allocatedSize)
+    {
+        *allocatedSize += increment;
+        array = countedRealloc(array, *allocatedSize * elementSize);
+        if (!array)
+        {
+            perror("Błąd relokacji pamięci!");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return array;
+}
+
+/**
+ * @brief   Allocates new memory for a dynamic array when needed.
+ *
+ * @param array          A pointer to the array that needs to be sized.
+ * @param sizeToAllocate The number of elements to add during allocation.
+ * @param elementSize    The size of each element in the array.
+ * @return  A pointer to the allocated array.
+ */
+void *alocateNewMemmory(void *array, int sizeToAllocate, size_t elementSize)
+{
+    array = countedMalloc(sizeToAllocate * elementSize);
+    if (!array)
+    {
+        perror("Błąd alokacji pamięci!");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+/**
+ * @brief   Makes sure that the output arena can hold the given number of additional bytes.
+ *
+ * The arena grows geometrically, so the number of reallocations is logarithmic in the
+ * peak number of bytes stored between two flushes.
+ *
+ * @param arena   A pointer to the OutputArena structure.
+ * @param needed  The number of bytes that will be appended.
+ * @return  A pointer to the first free byte of the arena.
+ */
+char *reserveArena(OutputArena *arena, size_t needed)
+{
+    if (arena->len + needed > arena->allocated)
+    {
+        size_t newSize = arena->allocated ? arena->allocated : ARENA_INITIAL_SIZE;
+        while (arena->len + needed > newSize)
+        {
+            newSize *= 2;
+        }
+        arena->buffer = countedRealloc(arena->buffer, newSize);
+        if (!arena->buffer)
+        {
+            perror("Błąd relokacji pamięci!");
+            exit(EXIT_FAILURE);
+        }
+        arena->allocated = newSize;
+    }
+    return arena->buffer + arena->len;
+}
+
+/**
+ * @brief   Marks the output arena as empty, keeping its memory for the next block.
+ *
+ * @param arena  A pointer to the OutputArena structure.
+ */
+void resetArena(OutputArena *arena)
+{
+    if (arena->len > arena->peak)
+    {
+        arena->peak = arena->len;
+    }
+    arena->len = 0;
+    arena->nRows = 0;
+}
+
+/**
+ * @brief   Initializes the Data structure, allocating memory for the dotted path.
+ *
+ * The function sets the initial number of tags to zero. The tag stack has a fixed
+ * capacity (MAX_TAG_DEPTH), only the path buffer is allocated dynamically.
+ *
+ * @param data  A pointer to the Data structure to be initialized.
+ */
+void initData(Data *data)
+{
+    data->emitorLen = 0;
+    data->nTags = 0;
+    data->pathLen = 0;
+    data->allocatedPath = PATH_INITIAL_SIZE;
+    data->path = alocateNewMemmory(data->path, data->allocatedPath, sizeof(char));
+    data->value = "";
+    data->valueLen = 0;
+    data->paths = NULL;
+    data->pathIds = 0;
+}
+
+/**
+ * @brief   Renders the "YYYY-MM-DD","HH", prefix of the CSV rows for the given time.
+ *
+ * @param timestamp  A pointer to the Timestamp structure to be updated.
+ * @param tm         A pointer to a struct containing the time data (year, month, day, hour).
+ */
+void renderTimestamp(Timestamp *timestamp, const struct tm *tm)
+{
+    timestamp->prefixLen = snprintf(timestamp->prefix, sizeof(timestamp->prefix), "\"%d-%02d-%02d\",\"%d\",",
+                                    tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour);
+
+    // Days since 1970-01-01 of the proleptic Gregorian calendar (the year starts in March)
+    int year = tm->tm_year + 1900 - (tm->tm_mon < 2);
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (tm->tm_mon + (tm->tm_mon < 2 ? 10 : -2)) + 2) / 5 + tm->tm_mday - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    timestamp->days = era * 146097 + dayOfEra - 719468;
+    timestamp->hour = tm->tm_hour;
+}
+
+/**
+ * @brief   Renders the prefix again if the current hour has changed since the last call.
+ *
+ * Only the TIMESTAMP_NOW source changes during a run, the others are rendered once.
+ * localtime_r() is called once per hour instead of once per row.
+ *
+ * @param timestamp  A pointer to the Timestamp structure to be refreshed.
+ */
+void refreshTimestamp(Timestamp *timestamp)
+{
+    if (timestamp->mode != TIMESTAMP_NOW)
+    {
+        return;
+    }
+
+    time_t t = time(NULL);
+    if (t >= timestamp->nextUpdate)
+    {
+        struct tm tm;
+        localtime_r(&t, &tm);
+        renderTimestamp(timestamp, &tm);
+        timestamp->nextUpdate = t - (tm.tm_min * 60 + tm.tm_sec) + 3600;
+    }
+}
+
+/**
+ * @brief   Initializes the Timestamp structure according to the selected source.
+ *
+ * @param timestamp  A pointer to the Timestamp structure to be initialized.
+ * @param options    A pointer to the command line options.
+ * @param inputFd    The descriptor of the input file (used by TIMESTAMP_FILE_MTIME).
+ */
+void initTimestamp(Timestamp *timestamp, const Options *options, int inputFd)
+{
+    struct stat st;
+    struct tm tm;
+
+    timestamp->mode = options->timestampMode;
+    timestamp->nextUpdate = 0;
+
+    switch (options->timestampMode)
+    {
+    case TIMESTAMP_FILE_MTIME:
+        if (fstat(inputFd, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            localtime_r(&st.st_mtime, &tm);
+            renderTimestamp(timestamp, &tm);
+            break;
+        }
+        // The modification time is unknown (or the input is a pipe), fall back to the current time
+        timestamp->mode = TIMESTAMP_NOW;
+        refreshTimestamp(timestamp);
+        break;
+    case TIMESTAMP_FIXED:
+        renderTimestamp(timestamp, &options->fixedTime);
+        break;
+    default:
+        refreshTimestamp(timestamp);
+        break;
+    }
+}
+
+/**
+ * @brief   Initializes the ParserContext structure, linking it to the Data and Timestamp structures.
+ *
+ * The function sets initial values for buffer management, the output arena is empty
+ * and gets its memory with the first row.
+ *
+ * @param context    A pointer to the ParserContext structure to be initialized.
+ * @param data       A pointer to the Data structure for the current XML data.
+ * @param timestamp  A pointer to the Timestamp structure shared by all rows.
+ */
+void initParserContext(ParserContext *context, Data *data, Timestamp *timestamp)
+{
+    context->data = data;
+    context->timestamp = timestamp;
+    context->parser = NULL;
+    context->error = CONTEXT_OK;
+    context->depth = 0;
+    context->unnamedEmitors = 0;
+    memset(&context->output, 0, sizeof(context->output));
+    memset(&context->input, 0, sizeof(context->input));
+    context->columnar = NULL;
+    context->delta = NULL;
+    context->matcher = &extractionRules;
+    context->matchStates = NULL;
+    context->pushedTags = NULL;
+    context->allocatedDepth = 0;
+    memset(&context->text, 0, sizeof(context->text));
+    context->textDepth = 0;
+    context->stages = NULL;
+    context->sink = NULL;
+    context->sinkData = NULL;
+    context->rowsSeen = 0;
+    context->skipRows = 0;
+    context->aggregation = NULL;
+    context->sorter = NULL;
+    context->partitions = NULL;
+    context->pool = NULL;
+    context->arrow = NULL;
+    context->arrowOutput = NULL;
+}
+
+/**
+ * @brief   Makes sure that the dotted path buffer can hold the given number of bytes.
+ *
+ * @param data    A pointer to the Data structure holding the path.
+ * @param needed  The total number of bytes the path buffer must hold.
+ */
+void reservePath(Data *data, size_t needed)
+{
+    if (needed > data->allocatedPath)
+    {
+        while (needed > data->allocatedPath)
+        {
+            data->allocatedPath *= 2;
+        }
+        data->path = countedRealloc(data->path, data->allocatedPath);
+        if (!data->path)
+        {
+            perror("Błąd relokacji pamięci!");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * @brief   Appends a string to the dotted path, optionally preceded by a '.' separator.
+ *
+ * @param data       A pointer to the Data structure holding the path.
+ * @param str        The string to be appended.
+ * @param len        The length of the string.
+ * @param separator  Non-zero if a '.' should be written before the string.
+ */
+void appendPath(Data *data, const char *str, size_t len, int separator)
+{
+    reservePath(data, data->pathLen + len + 1);
+    if (separator)
+    {
+        data->path[data->pathLen++] = '.';
+    }
+    memcpy(data->path + data->pathLen, str, len);
+    data->pathLen += len;
+}
+
+/**
+ * @brief   Sets the emitter name, which starts the dotted path.
+ *
+ * The tags that are already on the stack are moved after the new name,
+ * so the path always equals "emitor.tag.tag...".
+ *
+ * @param data   A pointer to the Data structure.
+ * @param name   The emitor name (not necessarily terminated).
+ * @param len    The length of the name.
+ */
+void setEmitor(Data *data, const char *name, size_t len)
+{
+    size_t oldLen = data->emitorLen;
+    size_t suffixLen = data->pathLen - oldLen;
+
+    data->emitorLen = len;
+    reservePath(data, len + suffixLen);
+    memmove(data->path + len, data->path + oldLen, suffixLen);
+    memcpy(data->path, name, len);
+    data->pathLen = len + suffixLen;
+    for (int i = 0; i < data->nTags; i++)
+    {
+        data->tags[i].offset = data->tags[i].offset - oldLen + len;
+    }
+}
+
+/**
+ * @brief   Adds a new tag to the Data structure.
+ *
+ * The function pushes the interned identifier of the tag on the fixed-capacity tag stack.
+ * The text of the tag is appended only to the dotted path, the slice recorded on the stack
+ * lets removeTag() restore the previous path without rescanning it. Nothing is allocated
+ * once the path buffer has grown to the longest path in the document.
+ *
+ * @param data  A pointer to the Data structure where the tag will be added.
+ * @param id    The identifier of the tag (ELEMENT_*).
+ * @param tag   A string representing the tag to be added.
+ * @return  Returns 0 on success, or -1 if the stack already holds MAX_TAG_DEPTH tags.
+ */
+int addTag(Data *data, int id, const char *tag)
+{
+    if (data->nTags >= MAX_TAG_DEPTH)
+    {
+        return -1;
+    }
+
+    size_t len = strlen(tag);
+    TagSlice *slice = &data->tags[data->nTags++];
+
+    appendPath(data, tag, len, 1);
+    slice->id = id;
+    slice->offset = data->pathLen - len;
+    slice->length = len;
+    return 0;
+}
+
+/**
+ * @brief   Removes the last tag from the Data structure and from the dotted path.
+ *
+ * @param data  A pointer to the Data structure.
+ */
+void removeTag(Data *data)
+{
+    data->nTags--;
+    data->pathLen = data->tags[data->nTags].offset - 1;
+}
+
+/**
+ * @brief   Appends bytes (or zeros, if src is NULL) to a buffer built in an OutputArena.
+ *
+ * @param buffer  A pointer to the OutputArena used as the buffer.
+ * @param src     A pointer to the bytes to be appended, or NULL.
+ * @param len     The number of bytes to be appended.
+ * @return  The position of the appended bytes in the buffer.
+ */
+size_t appendBytes(OutputArena *buffer, const void *src, size_t len)
+{
+    char *p = reserveArena(buffer, len);
+    if (src)
+    {
+        memcpy(p, src, len);
+    }
+    else
+    {
+        memset(p, 0, len);
+    }
+    buffer->len += len;
+    return buffer->len - len;
+}
+
+/**
+ * @brief   Pads the buffer with zeros to a multiple of the given alignment.
+ *
+ * @param buffer  A pointer to the OutputArena used as the buffer.
+ * @param align   The alignment in bytes.
+ */
+void alignBytes(OutputArena *buffer, size_t align)
+{
+    appendBytes(buffer, NULL, (align - buffer->len % align) % align);
+}
+
+/**
+ * @brief   Initializes the PathDictionary structure.
+ *
+ * @param dictionary  A pointer to the PathDictionary structure to be initialized.
+ */
+void initPathDictionary(PathDictionary *dictionary)
+{
+    memset(dictionary, 0, sizeof(*dictionary));
+    dictionary->allocatedEntries = DICTIONARY_INITIAL_SLOTS;
+    dictionary->offsets = alocateNewMemmory(NULL, dictionary->allocatedEntries, sizeof(uint32_t));
+    dictionary->offsets[0] = 0;
+    dictionary->nSlots = DICTIONARY_INITIAL_SLOTS;
+    dictionary->slots = calloc(dictionary->nSlots, sizeof(uint32_t));
+    if (!dictionary->slots)
+    {
+        perror("Błąd alokacji pamięci!");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief   Computes the hash of a path, eight bytes at a time.
+ *
+ * @param path  A pointer to the path.
+ * @param len   The length of the path.
+ * @return  The hash of the path.
+ */
+uint32_t hashPath(const char *path, size_t len)
+{
+    uint64_t hash = len * 0x9E3779B97F4A7C15ULL;
+    uint64_t word;
+
+    for (; len >= 8; len -= 8, path += 8)
+    {
+        memcpy(&word, path, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+    }
+    if (len > 0)
+    {
+        word = 0;
+        memcpy(&word, path, len);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+    }
+    return (uint32_t)(hash >> 32);
+}
+
+/**
+ * @brief   Finds the slot of the hash table holding the given path, or the empty slot where it belongs.
+ *
+ * @param dictionary  A pointer to the PathDictionary structure.
+ * @param path        A pointer to the path.
+ * @param len         The length of the path.
+ * @return  The index of the slot.
+ */
+size_t findPathSlot(const PathDictionary *dictionary, const char *path, size_t len)
+{
+    size_t mask = dictionary->nSlots - 1;
+    size_t i = hashPath(path, len) & mask;
+
+    for (;; i = (i + 1) & mask)
+    {
+        uint32_t slot = dictionary->slots[i];
+        if (slot == 0)
+        {
+            return i;
+        }
+        uint32_t start = dictionary->offsets[slot - 1];
+        if (dictionary->offsets[slot] - start == len && memcmp(dictionary->strings.buffer + start, path, len) == 0)
+        {
+            return i;
+        }
+    }
+}
+
+/**
+ * @brief   Returns the index of the path in the dictionary, adding the path if it is new.
+ *
+ * @param dictionary  A pointer to the PathDictionary structure.
+ * @param path        A pointer to the path.
+ * @param len         The length of the path.
+ * @return  The index of the path.
+ */
+int32_t lookupPath(PathDictionary *dictionary, const char *path, size_t len)
+{
+    size_t i = findPathSlot(dictionary, path, len);
+    if (dictionary->slots[i] != 0)
+    {
+        return (int32_t)dictionary->slots[i] - 1;
+    }
+
+    int index = dictionary->nEntries++;
+    dictionary->offsets = relocateMemmory(dictionary->offsets, dictionary->nEntries, &dictionary->allocatedEntries,
+                                          dictionary->allocatedEntries, sizeof(uint32_t));
+    appendBytes(&dictionary->strings, path, len);
+    dictionary->offsets[index + 1] = (uint32_t)dictionary->strings.len;
+    dictionary->slots[i] = (uint32_t)index + 1;
+
+    // Keep the table at most half full
+    if (2 * (size_t)dictionary->nEntries > dictionary->nSlots)
+    {
+        free(dictionary->slots);
+        dictionary->nSlots *= 2;
+        dictionary->slots = calloc(dictionary->nSlots, sizeof(uint32_t));
+        if (!dictionary->slots)
+        {
+            perror("Błąd alokacji pamięci!");
+            exit(EXIT_FAILURE);
+        }
+        for (int entry = 0; entry < dictionary->nEntries; entry++)
+        {
+            uint32_t start = dictionary->offsets[entry];
+            size_t slot = findPathSlot(dictionary, dictionary->strings.buffer + start, dictionary->offsets[entry + 1] - start);
+            dictionary->slots[slot] = (uint32_t)entry + 1;
+        }
+    }
+    return index;
+}
+
+/**
+ * @brief   Frees the memory of the PathDictionary structure.
+ *
+ * @param dictionary  A pointer to the PathDictionary structure.
+ */
+void freePathDictionary(PathDictionary *dictionary)
+{
+    free(dictionary->strings.buffer);
+    free(dictionary->offsets);
+    free(dictionary->slots);
+    free(dictionary->rendered.buffer);
+    free(dictionary->renderedOffsets);
+}
+
+/**
+ * @brief   Returns the length of a value in a quoted CSV cell, with its embedded quotes doubled.
+ *
+ * @param src  A pointer to the value.
+ * @param len  The length of the value.
+ * @return  The length of the value after copyQuotedValue() (without the surrounding quotes).
+ */
+size_t quotedLength(const char *src, size_t len)
+{
+    const char *end = src + len;
+    const char *quote = src;
+
+    while ((quote = memchr(quote, '"', end - quote)) != NULL)
+    {
+        quote++;
+        len++;
+    }
+    return len;
+}
+
+/**
+ * @brief   Copies a value into a quoted CSV cell, doubling the embedded quotes (RFC 4180).
+ *
+ * Line breaks are copied as they are, which is valid inside a quoted cell.
+ *
+ * @param dst  A pointer to the destination (room for quotedLength() bytes).
+ * @param src  A pointer to the value.
+ * @param len  The length of the value.
+ * @return  A pointer to the byte after the copied value.
+ */
+char *copyQuotedValue(char *dst, const char *src, size_t len)
+{
+    const char *end = src + len;
+    const char *quote;
+
+    while ((quote = memchr(src, '"', end - src)) != NULL)
+    {
+        memcpy(dst, src, quote + 1 - src);
+        dst += quote + 1 - src;
+        *dst++ = '"';
+        src = quote + 1;
+    }
+    memcpy(dst, src, end - src);
+    return dst + (end - src);
+}
+
+/**
+ * @brief   Restores a value copied by copyQuotedValue(), turning its doubled quotes back into one.
+ *
+ * @param dst  A pointer to the destination (room for len bytes).
+ * @param src  A pointer to the quoted value (without the surrounding quotes).
+ * @param len  The length of the quoted value.
+ * @return  The length of the restored value.
+ */
+size_t unquoteValue(char *dst, const char *src, size_t len)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        dst[n++] = src[i];
+        i += src[i] == '"' && i + 1 < len && src[i + 1] == '"';
+    }
+    return n;
+}
+
+/**
+ * @brief   Returns the index of the interned path of the current row, interning it if it is new.
+ *
+ * The cell of a new path is rendered once - "path"," for CSV rows (with its quotes doubled),
+ * or ID," with numeric path identifiers - and copied as a whole into every later row with the same path.
+ * Without numeric identifiers at most INTERN_MAX_PATHS paths are interned, so documents
+ * with unbounded numbers of distinct paths keep bounded memory in streaming mode.
+ *
+ * @param data  A pointer to the Data structure holding the path and the dictionary.
+ * @return  The index of the path, or -1 if the dictionary is full.
+ */
+int32_t internPath(Data *data)
+{
+    PathDictionary *dictionary = data->paths;
+    size_t slot = findPathSlot(dictionary, data->path, data->pathLen);
+    if (dictionary->slots[slot] != 0)
+    {
+        return (int32_t)dictionary->slots[slot] - 1;
+    }
+    if (!data->pathIds && dictionary->nEntries >= INTERN_MAX_PATHS)
+    {
+        return -1;
+    }
+
+    int32_t index = lookupPath(dictionary, data->path, data->pathLen);
+    if (!dictionary->renderedOffsets)
+    {
+        dictionary->allocatedRendered = DICTIONARY_INITIAL_SLOTS;
+        dictionary->renderedOffsets = alocateNewMemmory(NULL, dictionary->allocatedRendered, sizeof(uint32_t));
+        dictionary->renderedOffsets[0] = 0;
+    }
+    dictionary->renderedOffsets = relocateMemmory(dictionary->renderedOffsets, dictionary->nEntries, &dictionary->allocatedRendered,
+                                                  dictionary->allocatedRendered, sizeof(uint32_t));
+
+    OutputArena *rendered = &dictionary->rendered;
+    if (data->pathIds)
+    {
+        char *p = reserveArena(rendered, 16);
+        rendered->len += sprintf(p, "%d,\"", index);
+    }
+    else
+    {
+        size_t cellLen = quotedLength(data->path, data->pathLen) + 4;
+        char *p = reserveArena(rendered, cellLen);
+        *p++ = '"';
+        p = copyQuotedValue(p, data->path, data->pathLen);
+        memcpy(p, "\",\"", 3);
+        rendered->len += cellLen;
+    }
+    dictionary->renderedOffsets[dictionary->nEntries] = (uint32_t)rendered->len;
+    return index;
+}
+
+/**
+ * @brief   Formats and saves the collected data into CSV format.
+ *
+ * The function writes the cached timestamp prefix, the incrementally maintained
+ * "emitor.tag.tag" path and the value into a CSV row with a single pass of memcpy calls.
+ * If the paths are interned, the pre-rendered path cell (or the numeric path identifier)
+ * of the dictionary entry is copied instead of quoting the path again.
+ * Quotes inside the path (emitor names and predicate values) and the value (the text of an
+ * element or an attribute value) are doubled.
+ * The row is written directly at the end of the output arena.
+ *
+ * @param timestamp  A pointer to the Timestamp struct containing the rendered date and hour.
+ * @param data       A pointer to the Data struct containing emitter and tag information.
+ * @param arena      A pointer to the OutputArena the formatted CSV line will be appended to.
+ */
+void saveData(const Timestamp *timestamp, Data *data, OutputArena *arena)
+{
+    int32_t id = data->paths ? internPath(data) : -1;
+    size_t quotedPathLen = id >= 0 ? 0 : quotedLength(data->path, data->pathLen);
+    size_t cellLen = id >= 0 ? data->paths->renderedOffsets[id + 1] - data->paths->renderedOffsets[id] : quotedPathLen + 4;
+    size_t valueLen = data->valueLen;
+    size_t quotedValueLen = quotedLength(data->value, valueLen);
+    char *str = reserveArena(arena, timestamp->prefixLen + cellLen + quotedValueLen + sizeof("\"\n"));
+    char *p = str;
+
+    memcpy(p, timestamp->prefix, timestamp->prefixLen);
+    p += timestamp->prefixLen;
+    if (id >= 0)
+    {
+        memcpy(p, data->paths->rendered.buffer + data->paths->renderedOffsets[id], cellLen);
+        p += cellLen;
+    }
+    else
+    {
+        *p++ = '"';
+        if (quotedPathLen != data->pathLen)
+        {
+            p = copyQuotedValue(p, data->path, data->pathLen);
+        }
+        else
+        {
+            memcpy(p, data->path, data->pathLen);
+            p += data->pathLen;
+        }
+        memcpy(p, "\",\"", 3);
+        p += 3;
+    }
+    if (quotedValueLen != valueLen)
+    {
+        p = copyQuotedValue(p, data->value, valueLen);
+    }
+    else
+    {
+        memcpy(p, data->value, valueLen);
+        p += valueLen;
+    }
+    *p++ = '"';
+    *p++ = '\n';
+
+    arena->len += p - str;
+    arena->nRows++;
+    arena->totalRows++;
+}
+
+/**
+ * @brief   Formats the collected data with strcat() and sprintf() (reference implementation).
+ *
+ * This is the previous implementation of saveData(), which rebuilds the path for every row.
+ * It is kept only as the baseline for the --bench-format microbenchmark.
+ *
+ * @param timestamp  A pointer to the Timestamp struct containing the rendered date and hour.
+ * @param data       A pointer to the Data struct containing emitter and tag information.
+ * @param arena      A pointer to the OutputArena the formatted CSV line will be appended to.
+ */
+void saveDataSprintf(const Timestamp *timestamp, Data *data, OutputArena *arena)
+{
+    size_t needed = timestamp->prefixLen + data->pathLen + strlen(data->value) + sizeof("\"\",\"\"\n");
+    char *str = reserveArena(arena, needed);
+    int len = sprintf(str, "%s\"%.*s", timestamp->prefix, (int)data->emitorLen, data->path);
+
+    for (int i = 0; i < data->nTags; i++)
+    {
+        len += sprintf(str + len, ".%.*s", (int)data->tags[i].length, data->path + data->tags[i].offset);
+    }
+    arena->len += len + sprintf(str + len, "\",\"%s\"\n", data->value);
+    arena->nRows++;
+    arena->totalRows++;
+}
+
+/**
+ * @brief   Initializes the ColumnarWriter structure, allocating the columns of one batch.
+ *
+ * @param columnar  A pointer to the ColumnarWriter structure to be initialized.
+ * @param format    The output format (FORMAT_ARROW or FORMAT_PARQUET).
+ */
+void initColumnar(ColumnarWriter *columnar, int format)
+{
+    memset(columnar, 0, sizeof(*columnar));
+    columnar->format = format;
+    columnar->dates = alocateNewMemmory(NULL, COLUMNAR_BATCH_ROWS, sizeof(int32_t));
+    columnar->hours = alocateNewMemmory(NULL, COLUMNAR_BATCH_ROWS, sizeof(uint8_t));
+    columnar->paths = alocateNewMemmory(NULL, COLUMNAR_BATCH_ROWS, sizeof(int32_t));
+    columnar->values = alocateNewMemmory(NULL, COLUMNAR_BATCH_ROWS, sizeof(int64_t));
+    columnar->valid = alocateNewMemmory(NULL, COLUMNAR_BATCH_ROWS / 8, sizeof(uint8_t));
+    memset(columnar->valid, 0, COLUMNAR_BATCH_ROWS / 8);
+    initPathDictionary(&columnar->dictionary);
+}
+
+/**
+ * @brief   Frees the memory of the ColumnarWriter structure.
+ *
+ * @param columnar  A pointer to the ColumnarWriter structure.
+ */
+void freeColumnar(ColumnarWriter *columnar)
+{
+    free(columnar->dates);
+    free(columnar->hours);
+    free(columnar->paths);
+    free(columnar->values);
+    free(columnar->valid);
+    freePathDictionary(&columnar->dictionary);
+    free(columnar->meta.buffer);
+    free(columnar->body.buffer);
+    free(columnar->batches);
+    free(columnar->rowGroups);
+}
+
+/**
+ * @brief   Appends bytes of the file to the output arena, advancing the file offset.
+ *
+ * @param columnar  A pointer to the ColumnarWriter structure.
+ * @param arena     A pointer to the OutputArena the file is written from.
+ * @param src       A pointer to the bytes to be appended.
+ * @param len       The number of bytes to be appended.
+ */
+void emitColumnar(ColumnarWriter *columnar, OutputArena *arena, const void *src, size_t len)
+{
+    appendBytes(arena, src, len);
+    columnar->offset += len;
+}
+
+/**
+ * @brief   Starts a FlatBuffers table with the given number of field slots.
+ *
+ * @param buffer  A pointer to the OutputArena the FlatBuffer is built in.
+ * @param table   A pointer to the FlatTable structure to be initialized.
+ * @param nSlots  The number of field slots in the vtable.
+ */
+void fbStartTable(OutputArena *buffer, FlatTable *table, int nSlots)
+{
+    alignBytes(buffer, 2);
+    table->vtable = appendBytes(buffer, NULL, 4 + 2 * nSlots);
+    table->nSlots = nSlots;
+    alignBytes(buffer, 4);
+    table->table = appendBytes(buffer, NULL, 4);
+}
+
+/**
+ * @brief   Adds a scalar (or offset placeholder, if value is NULL) field to the current table.
+ *
+ * @param buffer  A pointer to the OutputArena the FlatBuffer is built in.
+ * @param table   A pointer to the FlatTable structure of the current table.
+ * @param slot    The slot of the field.
+ * @param value   A pointer to the value of the field, or NULL for an offset patched later.
+ * @param size    The size of the field (1, 2, 4 or 8 bytes).
+ * @return  The position of the field.
+ */
+size_t fbField(OutputArena *buffer, FlatTable *table, int slot, const void *value, size_t size)
+{
+    alignBytes(buffer, size);
+    size_t position = appendBytes(buffer, value, size);
+    uint16_t offset = (uint16_t)(position - table->table);
+    memcpy(buffer->buffer + table->vtable + 4 + 2 * slot, &offset, sizeof(offset));
+    return position;
+}
+
+/**
+ * @brief   Finishes the current table, filling its vtable and the offset of the vtable.
+ *
+ * @param buffer  A pointer to the OutputArena the FlatBuffer is built in.
+ * @param table   A pointer to the FlatTable structure of the current table.
+ */
+void fbEndTable(OutputArena *buffer, FlatTable *table)
+{
+    uint16_t sizes[2] = {(uint16_t)(4 + 2 * table->nSlots), (uint16_t)(buffer->len - table->table)};
+    int32_t vtableOffset = (int32_t)(table->table - table->vtable);
+
+    memcpy(buffer->buffer + table->vtable, sizes, sizeof(sizes));
+    memcpy(buffer->buffer + table->table, &vtableOffset, sizeof(vtableOffset));
+}
+
+/**
+ * @brief   Points the offset field (or vector element) at the given object.
+ *
+ * @param buffer  A pointer to the OutputArena the FlatBuffer is built in.
+ * @param field   The position of the offset.
+ * @param target  The position of the object.
+ */
+void fbPatch(OutputArena *buffer, size_t field, size_t target)
+{
+    uint32_t offset = (uint32_t)(target - field);
+    memcpy(buffer->buffer + field, &offset, sizeof(offset));
+}
+
+/**
+ * @brief   Appends a vector of scalars or structs (or of offsets patched later, if elements is NULL).
+ *
+ * @param buffer       A pointer to the OutputArena the FlatBuffer is built in.
+ * @param count        The number of elements.
+ * @param elementSize  The size of one element (elements of 8 bytes or more are aligned to 8).
+ * @param elements     A pointer to the elements, or NULL.
+ * @return  The position of the vector.
+ */
+size_t fbVector(OutputArena *buffer, uint32_t count, size_t elementSize, const void *elements)
+{
+    alignBytes(buffer, elementSize >= 8 ? 8 : 4);
+    if (elementSize >= 8)
+    {
+        // The length precedes the elements, which have to be aligned to 8
+        appendBytes(buffer, NULL, 4);
+    }
+    size_t position = appendBytes(buffer, &count, sizeof(count));
+    appendBytes(buffer, elements, count * elementSize);
+    return position;
+}
+
+/**
+ * @brief   Appends a string.
+ *
+ * @param buffer  A pointer to the OutputArena the FlatBuffer is built in.
+ * @param str     The string.
+ * @return  The position of the string.
+ */
+size_t fbString(OutputArena *buffer, const char *str)
+{
+    uint32_t len = (uint32_t)strlen(str);
+
+    alignBytes(buffer, 4);
+    size_t position = appendBytes(buffer, &len, sizeof(len));
+    appendBytes(buffer, str, len + 1);
+    return position;
+}
+
+/**
+ * @brief   Appends an Int table of the Arrow schema.
+ *
+ * @param buffer    A pointer to the OutputArena the FlatBuffer is built in.
+ * @param bitWidth  The width of the integer in bits.
+ * @param isSigned  Non-zero for signed integers.
+ * @return  The position of the table.
+ */
+size_t fbArrowInt(OutputArena *buffer, int32_t bitWidth, uint8_t isSigned)
+{
+    FlatTable table;
+    fbStartTable(buffer, &table, 2);
+    fbField(buffer, &table, 0, &bitWidth, sizeof(bitWidth));
+    fbField(buffer, &table, 1, &isSigned, sizeof(isSigned));
+    fbEndTable(buffer, &table);
+    return table.table;
+}
+
+/**
+ * @brief   Appends the Schema table of the Arrow file, with its fields.
+ *
+ * @param buffer  A pointer to the OutputArena the FlatBuffer is built in.
+ * @return  The position of the table.
+ */
+size_t fbArrowSchema(OutputArena *buffer)
+{
+    FlatTable schema;
+    int16_t littleEndian = 0;
+
+    fbStartTable(buffer, &schema, 2);
+    fbField(buffer, &schema, 0, &littleEndian, sizeof(littleEndian));
+    size_t fields = fbField(buffer, &schema, 1, NULL, 4);
+    fbEndTable(buffer, &schema);
+
+    size_t vector = fbVector(buffer, COLUMNAR_COLUMNS, 4, NULL);
+    fbPatch(buffer, fields, vector);
+
+    for (int i = 0; i < COLUMNAR_COLUMNS; i++)
+    {
+        FlatTable field;
+        fbStartTable(buffer, &field, 6);
+        size_t name = fbField(buffer, &field, 0, NULL, 4);
+        fbField(buffer, &field, 1, &arrowColumns[i].nullable, 1);
+        fbField(buffer, &field, 2, &arrowColumns[i].type, 1);
+        size_t type = fbField(buffer, &field, 3, NULL, 4);
+        size_t dictionary = arrowColumns[i].dictionary ? fbField(buffer, &field, 4, NULL, 4) : 0;
+        size_t children = fbField(buffer, &field, 5, NULL, 4);
+        fbEndTable(buffer, &field);
+        fbPatch(buffer, vector + 4 + 4 * i, field.table);
+
+        fbPatch(buffer, name, fbString(buffer, arrowColumns[i].name));
+
+        FlatTable typeTable;
+        switch (arrowColumns[i].type)
+        {
+        case ARROW_TYPE_INT:
+            fbPatch(buffer, type, fbArrowInt(buffer, arrowColumns[i].bitWidth, arrowColumns[i].isSigned));
+            break;
+        case ARROW_TYPE_DATE:
+        {
+            int16_t unitDay = 0;
+            fbStartTable(buffer, &typeTable, 1);
+            fbField(buffer, &typeTable, 0, &unitDay, sizeof(unitDay));
+            fbEndTable(buffer, &typeTable);
+            fbPatch(buffer, type, typeTable.table);
+            break;
+        }
+        default:
+            fbStartTable(buffer, &typeTable, 0);
+            fbEndTable(buffer, &typeTable);
+            fbPatch(buffer, type, typeTable.table);
+            break;
+        }
+
+        if (dictionary)
+        {
+            // Dictionary 0 with signed 32-bit indices
+            FlatTable encoding;
+            int64_t id = 0;
+            fbStartTable(buffer, &encoding, 2);
+            fbField(buffer, &encoding, 0, &id, sizeof(id));
+            size_t indexType = fbField(buffer, &encoding, 1, NULL, 4);
+            fbEndTable(buffer, &encoding);
+            fbPatch(buffer, dictionary, encoding.table);
+            fbPatch(buffer, indexType, fbArrowInt(buffer, 32, 1));
+        }
+        fbPatch(buffer, children, fbVector(buffer, 0, 4, NULL));
+    }
+    return schema.table;
+}
+
+/**
+ * @brief   Appends a RecordBatch table of the Arrow format.
+ *
+ * @param buffer    A pointer to the OutputArena the FlatBuffer is built in.
+ * @param length    The number of rows.
+ * @param nodes     The FieldNode structs (length and null count of every column).
+ * @param nNodes    The number of columns.
+ * @param buffers   The Buffer structs (offset and length in the body of every buffer).
+ * @param nBuffers  The number of buffers.
+ * @return  The position of the table.
+ */
+size_t fbArrowRecordBatch(OutputArena *buffer, int64_t length, const int64_t *nodes, int nNodes, const int64_t *buffers, int nBuffers)
+{
+    FlatTable batch;
+    fbStartTable(buffer, &batch, 3);
+    fbField(buffer, &batch, 0, &length, sizeof(length));
+    size_t nodesField = fbField(buffer, &batch, 1, NULL, 4);
+    size_t buffersField = fbField(buffer, &batch, 2, NULL, 4);
+    fbEndTable(buffer, &batch);
+    fbPatch(buffer, nodesField, fbVector(buffer, nNodes, 2 * sizeof(int64_t), nodes));
+    fbPatch(buffer, buffersField, fbVector(buffer, nBuffers, 2 * sizeof(int64_t), buffers));
+    return batch.table;
+}
+
+/**
+ * @brief   Starts the metadata of an Arrow message, appending the root offset and the Message table.
+ *
+ * @param buffer      A pointer to the (empty) OutputArena the FlatBuffer is built in.
+ * @param headerType  The type of the header (ARROW_HEADER_*).
+ * @param bodyLength  The length of the body of the message.
+ * @return  The position of the header offset, to be patched with the header table.
+ */
+size_t fbArrowMessage(OutputArena *buffer, uint8_t headerType, int64_t bodyLength)
+{
+    FlatTable message;
+    int16_t version = ARROW_METADATA_V5;
+
+    size_t root = appendBytes(buffer, NULL, 4);
+    fbStartTable(buffer, &message, 4);
+    fbField(buffer, &message, 0, &version, sizeof(version));
+    fbField(buffer, &message, 1, &headerType, sizeof(headerType));
+    size_t header = fbField(buffer, &message, 2, NULL, 4);
+    fbField(buffer, &message, 3, &bodyLength, sizeof(bodyLength));
+    fbEndTable(buffer, &message);
+    fbPatch(buffer, root, message.table);
+    return header;
+}
+
+/**
+ * @brief   Appends a buffer of the message body, padded to 8 bytes, and records its location.
+ *
+ * @param body      A pointer to the OutputArena the body is built in.
+ * @param buffers   The array of Buffer structs (offset and length pairs).
+ * @param nBuffers  A pointer to the number of recorded buffers.
+ * @param data      A pointer to the data of the buffer (may be NULL if len is 0).
+ * @param len       The length of the buffer.
+ */
+void addArrowBuffer(OutputArena *body, int64_t *buffers, int *nBuffers, const void *data, size_t len)
+{
+    alignBytes(body, 8);
+    buffers[2 * *nBuffers] = (int64_t)body->len;
+    buffers[2 * *nBuffers + 1] = (int64_t)len;
+    (*nBuffers)++;
+    appendBytes(body, data, len);
+}
+
+/**
+ * @brief   Writes the metadata built in columnar->meta and the body as an encapsulated Arrow message.
+ *
+ * @param columnar  A pointer to the ColumnarWriter structure.
+ * @param arena     A pointer to the OutputArena the file is written from.
+ * @param withBody  Non-zero if the message has the body built in columnar->body.
+ * @param block     A pointer to the ArrowBlock structure describing the message, or NULL.
+ */
+void emitArrowMessage(ColumnarWriter *columnar, OutputArena *arena, int withBody, ArrowBlock *block)
+{
+    alignBytes(&columnar->meta, 8);
+    if (withBody)
+    {
+        alignBytes(&columnar->body, 8);
+    }
+
+    int32_t prefix[2] = {-1, (int32_t)columnar->meta.len};
+    if (block)
+    {
+        block->offset = (int64_t)columnar->offset;
+        block->metaDataLength = (int32_t)(sizeof(prefix) + columnar->meta.len);
+        block->padding = 0;
+        block->bodyLength = withBody ? (int64_t)columnar->body.len : 0;
+    }
+    emitColumnar(columnar, arena, prefix, sizeof(prefix));
+    emitColumnar(columnar, arena, columnar->meta.buffer, columnar->meta.len);
+    if (withBody)
+    {
+        emitColumnar(columnar, arena, columnar->body.buffer, columnar->body.len);
+    }
+}
+
+/**
+ * @brief   Writes the rows of the current batch as an Arrow record batch.
+ *
+ * @param columnar  A pointer to the ColumnarWriter structure.
+ * @param arena     A pointer to the OutputArena the file is written from.
+ */
+void writeArrowBatch(ColumnarWriter *columnar, OutputArena *arena)
+{
+    int64_t nodes[2 * COLUMNAR_COLUMNS];
+    int64_t buffers[4 * COLUMNAR_COLUMNS];
+    int nBuffers = 0;
+    size_t n = columnar->nRows;
+
+    for (int i = 0; i < COLUMNAR_COLUMNS; i++)
+    {
+        nodes[2 * i] = (int64_t)n;
+        nodes[2 * i + 1] = arrowColumns[i].nullable ? (int64_t)columnar->nNulls : 0;
+    }
+
+    // Every column has a validity bitmap (empty without nulls) and a buffer of values
+    resetArena(&columnar->body);
+    addArrowBuffer(&columnar->body, buffers, &nBuffers, NULL, 0);
+    addArrowBuffer(&columnar->body, buffers, &nBuffers, columnar->dates, n * sizeof(int32_t));
+    addArrowBuffer(&columnar->body, buffers, &nBuffers, NULL, 0);
+    addArrowBuffer(&columnar->body, buffers, &nBuffers, columnar->hours, n * sizeof(uint8_t));
+    addArrowBuffer(&columnar->body, buffers, &nBuffers, NULL, 0);
+    addArrowBuffer(&columnar->body, buffers, &nBuffers, columnar->paths, n * sizeof(int32_t));
+    addArrowBuffer(&columnar->body, buffers, &nBuffers, columnar->valid, columnar->nNulls ? (n + 7) / 8 : 0);
+    addArrowBuffer(&columnar->body, buffers, &nBuffers, columnar->values, n * sizeof(int64_t));
+    alignBytes(&columnar->body, 8);
+
+    resetArena(&columnar->meta);
+    size_t header = fbArrowMessage(&columnar->meta, ARROW_HEADER_RECORD_BATCH, (int64_t)columnar->body.len);
+    fbPatch(&columnar->meta, header, fbArrowRecordBatch(&columnar->meta, (int64_t)n, nodes, COLUMNAR_COLUMNS, buffers, nBuffers));
+
+    columnar->batches = relocateMemmory(columnar->batches, columnar->nBatches + 1, &columnar->allocatedBatches, 64, sizeof(ArrowBlock));
+    emitArrowMessage(columnar, arena, 1, &columnar->batches[columnar->nBatches++]);
+}
+
+/**
+ * @brief   Writes the path dictionary, the end of the stream and the footer of the Arrow file.
+ *
+ * The dictionary is written once, after the record batches. This is allowed by the file
+ * format, whose readers load the dictionaries listed in the footer before the batches.
+ *
+ * @param columnar  A pointer to the ColumnarWriter structure.
+ * @param arena     A pointer to the OutputArena the file is written from.
+ */
+void finishArrow(ColumnarWriter *columnar, OutputArena *arena)
+{
+    PathDictionary *dictionary = &columnar->dictionary;
+    int64_t node[2] = {dictionary->nEntries, 0};
+    int64_t buffers[6];
+    int nBuffers = 0;
+
+    resetArena(&columnar->body);
+    addArrowBuffer(&columnar->body, buffers, &nBuffers, NULL, 0);
+    addArrowBuffer(&columnar->body, buffers, &nBuffers, dictionary->offsets, (dictionary->nEntries + 1) * sizeof(uint32_t));
+    addArrowBuffer(&columnar->body, buffers, &nBuffers, dictionary->strings.buffer, dictionary->strings.len);
+    alignBytes(&columnar->body, 8);
+
+    resetArena(&columnar->meta);
+    size_t header = fbArrowMessage(&columnar->meta, ARROW_HEADER_DICTIONARY_BATCH, (int64_t)columnar->body.len);
+    FlatTable batch;
+    int64_t id = 0;
+    fbStartTable(&columnar->meta, &batch, 2);
+    fbField(&columnar->meta, &batch, 0, &id, sizeof(id));
+    size_t data = fbField(&columnar->meta, &batch, 1, NULL, 4);
+    fbEndTable(&columnar->meta, &batch);
+    fbPatch(&columnar->meta, header, batch.table);
+    fbPatch(&columnar->meta, data, fbArrowRecordBatch(&columnar->meta, dictionary->nEntries, node, 1, buffers, nBuffers));
+    emitArrowMessage(columnar, arena, 1, &columnar->dictionaryBlock);
+
+    // End of the stream
+    int32_t endOfStream[2] = {-1, 0};
+    emitColumnar(columnar, arena, endOfStream, sizeof(endOfStream));
+
+    resetArena(&columnar->meta);
+    FlatTable footer;
+    int16_t version = ARROW_METADATA_V5;
+    size_t root = appendBytes(&columnar->meta, NULL, 4);
+    fbStartTable(&columnar->meta, &footer, 4);
+    fbField(&columnar->meta, &footer, 0, &version, sizeof(version));
+    size_t schema = fbField(&columnar->meta, &footer, 1, NULL, 4);
+    size_t dictionaries = fbField(&columnar->meta, &footer, 2, NULL, 4);
+    size_t recordBatches = fbField(&columnar->meta, &footer, 3, NULL, 4);
+    fbEndTable(&columnar->meta, &footer);
+    fbPatch(&columnar->meta, root, footer.table);
+    fbPatch(&columnar->meta, schema, fbArrowSchema(&columnar->meta));
+    fbPatch(&columnar->meta, dictionaries, fbVector(&columnar->meta, 1, sizeof(ArrowBlock), &columnar->dictionaryBlock));
+    fbPatch(&columnar->meta, recordBatches, fbVector(&columnar->meta, columnar->nBatches, sizeof(ArrowBlock), columnar->batches));
+
+    int32_t footerLen = (int32_t)columnar->meta.len;
+    emitColumnar(columnar, arena, columnar->meta.buffer, columnar->meta.len);
+    emitColumnar(columnar, arena, &footerLen, sizeof(footerLen));
+    emitColumnar(columnar, arena, "ARROW1", 6);
+}
+
+/**
+ * @brief   Appends an unsigned varint (ULEB128).
+ *
+ * @param buffer  A pointer to the OutputArena the data is built in.
+ * @param value   The value.
+ */
+void thriftVarint(OutputArena *buffer, uint64_t value)
+{
+    char *p = reserveArena(buffer, 10);
+    size_t n = 0;
+
+    while (value >= 0x80)
+    {
+        p[n++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (char)value;
+    buffer->len += n;
+}
+
+/**
+ * @brief   Appends the header of a struct field.
+ *
+ * @param buffer   A pointer to the OutputArena the data is built in.
+ * @param lastId   A pointer to the identifier of the previous field of the struct.
+ * @param id       The identifier of the field.
+ * @param type     The compact type of the field (THRIFT_*).
+ */
+void thriftField(OutputArena *buffer, int *lastId, int id, int type)
+{
+    if (id > *lastId && id - *lastId <= 15)
+    {
+        uint8_t header = (uint8_t)((id - *lastId) << 4 | type);
+        appendBytes(buffer, &header, 1);
+    }
+    else
+    {
+        uint8_t header = (uint8_t)type;
+        appendBytes(buffer, &header, 1);
+        thriftVarint(buffer, (uint64_t)((id << 1) ^ (id >> 15)));
+    }
+    *lastId = id;
+}
+
+/**
+ * @brief   Appends an integer field (i32 or i64, zigzag encoded).
+ *
+ * @param buffer  A pointer to the OutputArena the data is built in.
+ * @param lastId  A pointer to the identifier of the previous field of the struct.
+ * @param id      The identifier of the field.
+ * @param type    THRIFT_I32 or THRIFT_I64.
+ * @param value   The value.
+ */
+void thriftInt(OutputArena *buffer, int *lastId, int id, int type, int64_t value)
+{
+    thriftField(buffer, lastId, id, type);
+    thriftVarint(buffer, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+/**
+ * @brief   Appends binary data (without the field header, as used in lists).
+ *
+ * @param buffer  A pointer to the OutputArena the data is built in.
+ * @param data    A pointer to the data.
+ * @param len     The length of the data.
+ */
+void thriftBinary(OutputArena *buffer, const void *data, size_t len)
+{
+    thriftVarint(buffer, len);
+    appendBytes(buffer, data, len);
+}
+
+/**
+ * @brief   Appends the header of a list (the field header must be written before).
+ *
+ * @param buffer       A pointer to the OutputArena the data is built in.
+ * @param elementType  The compact type of the elements.
+ * @param count        The number of elements.
+ */
+void thriftList(OutputArena *buffer, int elementType, size_t count)
+{
+    uint8_t header = (uint8_t)((count < 15 ? count : 15) << 4 | elementType);
+    appendBytes(buffer, &header, 1);
+    if (count >= 15)
+    {
+        thriftVarint(buffer, count);
+    }
+}
+
+/**
+ * @brief   Appends the end of a struct.
+ *
+ * @param buffer  A pointer to the OutputArena the data is built in.
+ */
+void thriftStop(OutputArena *buffer)
+{
+    appendBytes(buffer, NULL, 1);
+}
+
+/**
+ * @brief   Appends values bit-packed with the given width, as one run of the RLE/bit-packing hybrid.
+ *
+ * @param buffer    A pointer to the OutputArena the data is built in.
+ * @param values    The values (each must fit in bitWidth bits).
+ * @param n         The number of values.
+ * @param bitWidth  The width of one value in bits (1 to 32).
+ */
+void appendBitPacked(OutputArena *buffer, const int32_t *values, size_t n, int bitWidth)
+{
+    size_t groups = (n + 7) / 8;
+    thriftVarint(buffer, groups << 1 | 1);
+
+    char *p = reserveArena(buffer, groups * bitWidth);
+    uint64_t bits = 0;
+    int nBits = 0;
+    size_t len = 0;
+    for (size_t i = 0; i < groups * 8; i++)
+    {
+        bits |= (uint64_t)(i < n ? (uint32_t)values[i] : 0) << nBits;
+        for (nBits += bitWidth; nBits >= 8; nBits -= 8)
+        {
+            p[len++] = (char)bits;
+            bits >>= 8;
+        }
+    }
+    buffer->len += len;
+}
+
+/**
+ * @brief   Writes one Parquet page: its header and the data built in columnar->body.
+ *
+ * @param columnar   A pointer to the ColumnarWriter structure.
+ * @param arena      A pointer to the OutputArena the file is written from.
+ * @param pageType   PARQUET_DATA_PAGE or PARQUET_DICTIONARY_PAGE.
+ * @param nValues    The number of values in the page (including nulls).
+ * @param encoding   The encoding of the values.
+ */
+void writeParquetPage(ColumnarWriter *columnar, OutputArena *arena, int pageType, size_t nValues, int encoding)
+{
+    OutputArena *meta = &columnar->meta;
+    int id = 0;
+    int headerId = 0;
+
+    resetArena(meta);
+    thriftInt(meta, &id, 1, THRIFT_I32, pageType);
+    thriftInt(meta, &id, 2, THRIFT_I32, (int64_t)columnar->body.len);
+    thriftInt(meta, &id, 3, THRIFT_I32, (int64_t)columnar->body.len);
+    thriftField(meta, &id, pageType == PARQUET_DICTIONARY_PAGE ? 7 : 5, THRIFT_STRUCT);
+    thriftInt(meta, &headerId, 1, THRIFT_I32, (int64_t)nValues);
+    thriftInt(meta, &headerId, 2, THRIFT_I32, encoding);
+    if (pageType == PARQUET_DATA_PAGE)
+    {
+        thriftInt(meta, &headerId, 3, THRIFT_I32, PARQUET_RLE);
+        thriftInt(meta, &headerId, 4, THRIFT_I32, PARQUET_RLE);
+    }
+    thriftStop(meta);
+    thriftStop(meta);
+
+    emitColumnar(columnar, arena, meta->buffer, meta->len);
+    emitColumnar(columnar, arena, columnar->body.buffer, columnar->body.len);
+}
+
+/**
+ * @brief   Writes the rows of the current batch as a Parquet row group.
+ *
+ * The date, hour and pkt columns are PLAIN encoded (pkt with definition levels for the nulls),
+ * the path column has a dictionary page with all paths seen so far and the indices of the rows.
+ * The pages are not compressed.
+ *
+ * @param columnar  A pointer to the ColumnarWriter structure.
+ * @param arena     A pointer to the OutputArena the file is written from.
+ */
+void writeParquetRowGroup(ColumnarWriter *columnar, OutputArena *arena)
+{
+    PathDictionary *dictionary = &columnar->dictionary;
+    OutputArena *body = &columnar->body;
+    size_t n = columnar->nRows;
+
+    columnar->rowGroups = relocateMemmory(columnar->rowGroups, columnar->nRowGroups + 1, &columnar->allocatedRowGroups, 64,
+                                          sizeof(ParquetRowGroup));
+    ParquetRowGroup *group = &columnar->rowGroups[columnar->nRowGroups++];
+    group->rows = (int64_t)n;
+
+    // Date and Hour (stored as INT32)
+    for (int column = 0; column < 2; column++)
+    {
+        group->dictionaryOffset[column] = -1;
+        group->dataOffset[column] = (int64_t)columnar->offset;
+        resetArena(body);
+        if (column == 0)
+        {
+            appendBytes(body, columnar->dates, n * sizeof(int32_t));
+        }
+        else
+        {
+            int32_t *hours = (int32_t *)reserveArena(body, n * sizeof(int32_t));
+            for (size_t i = 0; i < n; i++)
+            {
+                hours[i] = columnar->hours[i];
+            }
+            body->len += n * sizeof(int32_t);
+        }
+        writeParquetPage(columnar, arena, PARQUET_DATA_PAGE, n, PARQUET_PLAIN);
+        group->size[column] = (int64_t)columnar->offset - group->dataOffset[column];
+    }
+
+    // Emitor.Tags: the dictionary page and the indices
+    group->dictionaryOffset[2] = (int64_t)columnar->offset;
+    resetArena(body);
+    for (int entry = 0; entry < dictionary->nEntries; entry++)
+    {
+        uint32_t len = dictionary->offsets[entry + 1] - dictionary->offsets[entry];
+        appendBytes(body, &len, sizeof(len));
+        appendBytes(body, dictionary->strings.buffer + dictionary->offsets[entry], len);
+    }
+    writeParquetPage(columnar, arena, PARQUET_DICTIONARY_PAGE, (size_t)dictionary->nEntries, PARQUET_PLAIN);
+
+    group->dataOffset[2] = (int64_t)columnar->offset;
+    uint8_t bitWidth = 1;
+    while (bitWidth < 32 && ((uint32_t)dictionary->nEntries - 1) >> bitWidth)
+    {
+        bitWidth++;
+    }
+    resetArena(body);
+    appendBytes(body, &bitWidth, 1);
+    appendBitPacked(body, columnar->paths, n, bitWidth);
+    writeParquetPage(columnar, arena, PARQUET_DATA_PAGE, n, PARQUET_PLAIN_DICTIONARY);
+    group->size[2] = (int64_t)columnar->offset - group->dictionaryOffset[2];
+
+    // Pkt_Value: the definition levels (the validity bitmap is a bit-packed run of width 1)
+    // followed by the values which are not null
+    group->dictionaryOffset[3] = -1;
+    group->dataOffset[3] = (int64_t)columnar->offset;
+    resetArena(body);
+    size_t levelsLen = appendBytes(body, NULL, sizeof(uint32_t));
+    if (columnar->nNulls == 0)
+    {
+        uint8_t one = 1;
+        thriftVarint(body, (uint64_t)n << 1);
+        appendBytes(body, &one, 1);
+    }
+    else
+    {
+        thriftVarint(body, ((n + 7) / 8) << 1 | 1);
+        appendBytes(body, columnar->valid, (n + 7) / 8);
+    }
+    uint32_t levels = (uint32_t)(body->len - levelsLen - sizeof(uint32_t));
+    memcpy(body->buffer + levelsLen, &levels, sizeof(levels));
+    for (size_t i = 0; i < n; i++)
+    {
+        if (columnar->valid[i >> 3] & (1 << (i & 7)))
+        {
+            appendBytes(body, &columnar->values[i], sizeof(int64_t));
+        }
+    }
+    writeParquetPage(columnar, arena, PARQUET_DATA_PAGE, n, PARQUET_PLAIN);
+    group->size[3] = (int64_t)columnar->offset - group->dataOffset[3];
+}
+
+/**
+ * @brief   Writes the footer (FileMetaData) of the Parquet file.
+ *
+ * @param columnar  A pointer to the ColumnarWriter structure.
+ * @param arena     A pointer to the OutputArena the file is written from.
+ */
+void finishParquet(ColumnarWriter *columnar, OutputArena *arena)
+{
+    OutputArena *meta = &columnar->meta;
+    int64_t totalRows = 0;
+    int id = 0;
+
+    for (int i = 0; i < columnar->nRowGroups; i++)
+    {
+        totalRows += columnar->rowGroups[i].rows;
+    }
+
+    resetArena(meta);
+    thriftInt(meta, &id, 1, THRIFT_I32, 1);
+
+    // The schema: the root and its columns
+    thriftField(meta, &id, 2, THRIFT_LIST);
+    thriftList(meta, THRIFT_STRUCT, COLUMNAR_COLUMNS + 1);
+    int elementId = 0;
+    thriftField(meta, &elementId, 4, THRIFT_BINARY);
+    thriftBinary(meta, "schema", 6);
+    thriftInt(meta, &elementId, 5, THRIFT_I32, COLUMNAR_COLUMNS);
+    thriftStop(meta);
+    for (int column = 0; column < COLUMNAR_COLUMNS; column++)
+    {
+        elementId = 0;
+        thriftInt(meta, &elementId, 1, THRIFT_I32, parquetColumns[column].type);
+        thriftInt(meta, &elementId, 3, THRIFT_I32, parquetColumns[column].repetition);
+        thriftField(meta, &elementId, 4, THRIFT_BINARY);
+        thriftBinary(meta, parquetColumns[column].name, strlen(parquetColumns[column].name));
+        if (parquetColumns[column].convertedType >= 0)
+        {
+            thriftInt(meta, &elementId, 6, THRIFT_I32, parquetColumns[column].convertedType);
+        }
+        thriftStop(meta);
+    }
+
+    thriftInt(meta, &id, 3, THRIFT_I64, totalRows);
+
+    thriftField(meta, &id, 4, THRIFT_LIST);
+    thriftList(meta, THRIFT_STRUCT, (size_t)columnar->nRowGroups);
+    for (int i = 0; i < columnar->nRowGroups; i++)
+    {
+        const ParquetRowGroup *group = &columnar->rowGroups[i];
+        int groupId = 0;
+        int64_t totalSize = 0;
+
+        thriftField(meta, &groupId, 1, THRIFT_LIST);
+        thriftList(meta, THRIFT_STRUCT, COLUMNAR_COLUMNS);
+        for (int column = 0; column < COLUMNAR_COLUMNS; column++)
+        {
+            int64_t start = group->dictionaryOffset[column] >= 0 ? group->dictionaryOffset[column] : group->dataOffset[column];
+            int chunkId = 0;
+            int metaId = 0;
+
+            totalSize += group->size[column];
+            thriftInt(meta, &chunkId, 2, THRIFT_I64, start);
+            thriftField(meta, &chunkId, 3, THRIFT_STRUCT);
+            thriftInt(meta, &metaId, 1, THRIFT_I32, parquetColumns[column].type);
+            thriftField(meta, &metaId, 2, THRIFT_LIST);
+            if (group->dictionaryOffset[column] >= 0)
+            {
+                thriftList(meta, THRIFT_I32, 3);
+                thriftVarint(meta, PARQUET_PLAIN << 1);
+                thriftVarint(meta, PARQUET_PLAIN_DICTIONARY << 1);
+            }
+            else
+            {
+                thriftList(meta, THRIFT_I32, 2);
+                thriftVarint(meta, PARQUET_PLAIN << 1);
+            }
+            thriftVarint(meta, PARQUET_RLE << 1);
+            thriftField(meta, &metaId, 3, THRIFT_LIST);
+            thriftList(meta, THRIFT_BINARY, 1);
+            thriftBinary(meta, parquetColumns[column].name, strlen(parquetColumns[column].name));
+            thriftInt(meta, &metaId, 4, THRIFT_I32, 0);
+            thriftInt(meta, &metaId, 5, THRIFT_I64, group->rows);
+            thriftInt(meta, &metaId, 6, THRIFT_I64, group->size[column]);
+            thriftInt(meta, &metaId, 7, THRIFT_I64, group->size[column]);
+            thriftInt(meta, &metaId, 9, THRIFT_I64, group->dataOffset[column]);
+            if (group->dictionaryOffset[column] >= 0)
+            {
+                thriftInt(meta, &metaId, 11, THRIFT_I64, group->dictionaryOffset[column]);
+            }
+            thriftStop(meta);
+            thriftStop(meta);
+        }
+        thriftInt(meta, &groupId, 2, THRIFT_I64, totalSize);
+        thriftInt(meta, &groupId, 3, THRIFT_I64, group->rows);
+        thriftStop(meta);
+    }
+
+    thriftField(meta, &id, 6, THRIFT_BINARY);
+    thriftBinary(meta, "emitor_expat", 12);
+    thriftStop(meta);
+
+    uint32_t metaLen = (uint32_t)meta->len;
+    emitColumnar(columnar, arena, meta->buffer, meta->len);
+    emitColumnar(columnar, arena, &metaLen, sizeof(metaLen));
+    emitColumnar(columnar, arena, "PAR1", 4);
+}
+
+/**
+ * @brief   Writes the beginning of the columnar file: the magic bytes and, for Arrow, the schema.
+ *
+ * @param columnar  A pointer to the ColumnarWriter structure.
+ * @param arena     A pointer to the OutputArena the file is written from.
+ */
+void startColumnar(ColumnarWriter *columnar, OutputArena *arena)
+{
+    if (columnar->format == FORMAT_PARQUET)
+    {
+        emitColumnar(columnar, arena, "PAR1", 4);
+        return;
+    }
+
+    emitColumnar(columnar, arena, "ARROW1\0\0", 8);
+    resetArena(&columnar->meta);
+    size_t header = fbArrowMessage(&columnar->meta, ARROW_HEADER_SCHEMA, 0);
+    fbPatch(&columnar->meta, header, fbArrowSchema(&columnar->meta));
+    emitArrowMessage(columnar, arena, 0, NULL);
+}
+
+/**
+ * @brief   Writes the rows of the current batch (if any) as a record batch or row group.
+ *
+ * @param columnar  A pointer to the ColumnarWriter structure.
+ * @param arena     A pointer to the OutputArena the file is written from.
+ */
+void flushColumnar(ColumnarWriter *columnar, OutputArena *arena)
+{
+    if (columnar->nRows == 0)
+    {
+        return;
+    }
+    if (columnar->format == FORMAT_PARQUET)
+    {
+        writeParquetRowGroup(columnar, arena);
+    }
+    else
+    {
+        writeArrowBatch(columnar, arena);
+    }
+    memset(columnar->valid, 0, (columnar->nRows + 7) / 8);
+    columnar->nRows = 0;
+    columnar->nNulls = 0;
+}
+
+/**
+ * @brief   Writes the last batch and the end of the columnar file.
+ *
+ * @param columnar  A pointer to the ColumnarWriter structure.
+ * @param arena     A pointer to the OutputArena the file is written from.
+ */
+void finishColumnar(ColumnarWriter *columnar, OutputArena *arena)
+{
+    flushColumnar(columnar, arena);
+    if (columnar->format == FORMAT_PARQUET)
+    {
+        finishParquet(columnar, arena);
+    }
+    else
+    {
+        finishArrow(columnar, arena);
+    }
+}
+
+/**
+ * @brief   Appends the collected data as a row of the columnar output.
+ *
+ * The row model is the one of saveData(): the date and hour of the timestamp, the dotted
+ * path (stored as an index into the path dictionary) and the value, stored as an integer
+ * (null if the value is not an integer). Full batches are encoded into the output arena.
+ *
+ * @param columnar   A pointer to the ColumnarWriter structure.
+ * @param timestamp  A pointer to the Timestamp struct containing the date and hour.
+ * @param data       A pointer to the Data struct containing the path and the value.
+ * @param arena      A pointer to the OutputArena the encoded batches are appended to.
+ */
+void appendColumnarRow(ColumnarWriter *columnar, const Timestamp *timestamp, const Data *data, OutputArena *arena)
+{
+    size_t row = columnar->nRows++;
+    char *end;
+
+    errno = 0;
+    long long value = strtoll(data->value, &end, 10);
+    columnar->dates[row] = timestamp->days;
+    columnar->hours[row] = (uint8_t)timestamp->hour;
+    columnar->paths[row] = lookupPath(&columnar->dictionary, data->path, data->pathLen);
+    if (end == data->value || *end != '\0' || errno == ERANGE)
+    {
+        columnar->values[row] = 0;
+        columnar->nNulls++;
+    }
+    else
+    {
+        columnar->values[row] = value;
+        columnar->valid[row >> 3] |= (uint8_t)(1 << (row & 7));
+    }
+    arena->nRows++;
+    arena->totalRows++;
+
+    if (columnar->nRows == COLUMNAR_BATCH_ROWS)
+    {
+        flushColumnar(columnar, arena);
+    }
+}
+
+/**
+ * @brief   Initializes the Aggregation structure.
+ *
+ * @param aggregation  A pointer to the Aggregation structure to be initialized.
+ */
+void initAggregation(Aggregation *aggregation)
+{
+    memset(aggregation, 0, sizeof(*aggregation));
+    initPathDictionary(&aggregation->keys);
+}
+
+/**
+ * @brief   Adds a value to the statistics of one key, creating them for a new key.
+ *
+ * @param aggregation  A pointer to the Aggregation structure.
+ * @param key          The key (the rendered timestamp prefix followed by the path).
+ * @param len          The length of the key.
+ * @param prefixLen    The length of the timestamp prefix.
+ * @param add          A pointer to the statistics to be added.
+ */
+void addStatistics(Aggregation *aggregation, const char *key, size_t len, size_t prefixLen, const PathStatistics *add)
+{
+    int before = aggregation->keys.nEntries;
+    int32_t index = lookupPath(&aggregation->keys, key, len);
+    if (aggregation->keys.nEntries > before)
+    {
+        aggregation->statistics = relocateMemmory(aggregation->statistics, index, &aggregation->allocatedStatistics,
+                                                  DICTIONARY_INITIAL_SLOTS, sizeof(PathStatistics));
+        aggregation->statistics[index] = *add;
+        aggregation->statistics[index].prefixLen = prefixLen;
+        return;
+    }
+
+    PathStatistics *statistics = &aggregation->statistics[index];
+    statistics->count += add->count;
+    statistics->sum += add->sum;
+    statistics->min = add->min < statistics->min ? add->min : statistics->min;
+    statistics->max = add->max > statistics->max ? add->max : statistics->max;
+}
+
+/**
+ * @brief   Checks whether a value is a plain decimal number: [+-]digits[.digits][e[+-]digits].
+ *
+ * Unlike strtod() alone, leading whitespace, hexadecimal numbers, "inf" and "nan" are not numbers.
+ *
+ * @param str  The value.
+ * @return  Non-zero if the whole value is a decimal number.
+ */
+int isDecimalNumber(const char *str)
+{
+    const char *p = str + (*str == '+' || *str == '-');
+    size_t digits = strspn(p, "0123456789");
+    p += digits;
+    if (*p == '.')
+    {
+        size_t fraction = strspn(p + 1, "0123456789");
+        digits += fraction;
+        p += 1 + fraction;
+    }
+    if (digits == 0)
+    {
+        return 0;
+    }
+    if (*p == 'e' || *p == 'E')
+    {
+        p += 1 + (p[1] == '+' || p[1] == '-');
+        size_t exponent = strspn(p, "0123456789");
+        if (exponent == 0)
+        {
+            return 0;
+        }
+        p += exponent;
+    }
+    return *p == '\0';
+}
+
+/**
+ * @brief   Adds the value of the current row to the statistics of its path in the current hour.
+ *
+ * The key is looked up in an open addressing hash table, so one row costs one copy of the
+ * timestamp prefix and the path and one hash of the key. Values which are not finite decimal
+ * numbers are counted.
+ *
+ * @param aggregation  A pointer to the Aggregation structure.
+ * @param timestamp    A pointer to the Timestamp struct containing the rendered date and hour.
+ * @param data         A pointer to the Data struct containing the path and the value.
+ */
+void aggregateRow(Aggregation *aggregation, const Timestamp *timestamp, const Data *data)
+{
+    double value = isDecimalNumber(data->value) ? strtod(data->value, NULL) : NAN;
+    if (!isfinite(value))
+    {
+        aggregation->nonNumeric++;
+        return;
+    }
+
+    OutputArena *key = &aggregation->key;
+    key->len = 0;
+    appendBytes(key, timestamp->prefix, timestamp->prefixLen);
+    appendBytes(key, data->path, data->pathLen);
+
+    PathStatistics add = {1, value, value, value, 0};
+    addStatistics(aggregation, key->buffer, key->len, timestamp->prefixLen, &add);
+}
+
+/**
+ * @brief   Adds the statistics of one aggregation (a partial aggregation of a worker) to another.
+ *
+ * @param into  A pointer to the Aggregation structure the statistics are added to.
+ * @param from  A pointer to the Aggregation structure with the statistics to be added.
+ */
+void mergeAggregation(Aggregation *into, const Aggregation *from)
+{
+    for (int i = 0; i < from->keys.nEntries; i++)
+    {
+        uint32_t start = from->keys.offsets[i];
+        addStatistics(into, from->keys.strings.buffer + start, from->keys.offsets[i + 1] - start,
+                      from->statistics[i].prefixLen, &from->statistics[i]);
+    }
+    into->nonNumeric += from->nonNumeric;
+}
+
+/**
+ * @brief   Compares the keys of two entries of an aggregation (for qsort_r()).
+ *
+ * @param a            A pointer to the index of the first entry.
+ * @param b            A pointer to the index of the second entry.
+ * @param aggregation  A pointer to the Aggregation structure.
+ * @return  A negative, zero or positive number, as for qsort().
+ */
+int compareAggregationKeys(const void *a, const void *b, void *aggregation)
+{
+    const PathDictionary *keys = &((const Aggregation *)aggregation)->keys;
+    int32_t x = *(const int32_t *)a;
+    int32_t y = *(const int32_t *)b;
+    size_t xLen = keys->offsets[x + 1] - keys->offsets[x];
+    size_t yLen = keys->offsets[y + 1] - keys->offsets[y];
+    int order = memcmp(keys->strings.buffer + keys->offsets[x], keys->strings.buffer + keys->offsets[y], xLen < yLen ? xLen : yLen);
+    return order ? order : (xLen > yLen) - (xLen < yLen);
+}
+
+/**
+ * @brief   Writes one summary row per path and hour, ordered by the hour and the path.
+ *
+ * @param aggregation  A pointer to the Aggregation structure.
+ * @param arena        A pointer to the OutputArena the rows are appended to.
+ */
+void writeAggregation(const Aggregation *aggregation, OutputArena *arena)
+{
+    const PathDictionary *keys = &aggregation->keys;
+    int32_t *order = alocateNewMemmory(NULL, keys->nEntries + 1, sizeof(int32_t));
+    for (int32_t i = 0; i < keys->nEntries; i++)
+    {
+        order[i] = i;
+    }
+    qsort_r(order, keys->nEntries, sizeof(int32_t), compareAggregationKeys, (void *)aggregation);
+
+    for (int i = 0; i < keys->nEntries; i++)
+    {
+        const PathStatistics *statistics = &aggregation->statistics[order[i]];
+        const char *key = keys->strings.buffer + keys->offsets[order[i]];
+        size_t pathLen = keys->offsets[order[i] + 1] - keys->offsets[order[i]] - statistics->prefixLen;
+        char *str = reserveArena(arena, statistics->prefixLen + quotedLength(key + statistics->prefixLen, pathLen) + 128);
+
+        memcpy(str, key, statistics->prefixLen);
+        char *p = str + statistics->prefixLen;
+        *p++ = '"';
+        p = copyQuotedValue(p, key + statistics->prefixLen, pathLen);
+        p += sprintf(p, "\",\"%llu\",\"%.15g\",\"%.15g\",\"%.15g\"\n", (unsigned long long)statistics->count, statistics->min,
+                     statistics->max, statistics->sum / statistics->count);
+        arena->len += p - str;
+        arena->nRows++;
+        arena->totalRows++;
+    }
+    free(order);
+}
+
+/**
+ * @brief   Frees the memory of the Aggregation structure.
+ *
+ * @param aggregation  A pointer to the Aggregation structure.
+ */
+void freeAggregation(Aggregation *aggregation)
+{
+    freePathDictionary(&aggregation->keys);
+    free(aggregation->statistics);
+    free(aggregation->key.buffer);
+}
+
+/**
+ * @brief   Writes the whole buffer to the descriptor, retrying after partial writes.
+ *
+ * @param fd      The descriptor the data is written to.
+ * @param buffer  A pointer to the data.
+ * @param len     The number of bytes to be written.
+ * @return  Returns 0 on success, or -1 if writing failed.
+ */
+int writeAll(int fd, const char *buffer, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t written = write(fd, buffer, len);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        buffer += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/**
+ * @brief   Initializes the Sorter structure.
+ *
+ * @param sorter   A pointer to the Sorter structure to be initialized.
+ * @param options  A pointer to the command line options (the memory limit and the temporary directory).
+ */
+void initSorter(Sorter *sorter, const Options *options)
+{
+    memset(sorter, 0, sizeof(*sorter));
+    sorter->memoryLimit = options->memoryLimit;
+    sorter->tmpDir = options->tmpDir;
+}
+
+/**
+ * @brief   Compares the paths of two rows of the run kept in memory (for qsort_r()).
+ *
+ * Rows with equal paths keep the order of the document.
+ *
+ * @param a     A pointer to the first SortEntry.
+ * @param b     A pointer to the second SortEntry.
+ * @param rows  A pointer to the buffer of the run.
+ * @return  A negative, zero or positive number, as for qsort().
+ */
+int compareSortEntries(const void *a, const void *b, void *rows)
+{
+    const SortEntry *x = (const SortEntry *)a;
+    const SortEntry *y = (const SortEntry *)b;
+    const char *buffer = (const char *)rows;
+    uint32_t len = x->header.keyLen < y->header.keyLen ? x->header.keyLen : y->header.keyLen;
+    int order = memcmp(buffer + x->offset + x->header.keyOffset, buffer + y->offset + y->header.keyOffset, len);
+    if (order == 0)
+    {
+        order = (x->header.keyLen > y->header.keyLen) - (x->header.keyLen < y->header.keyLen);
+    }
+    return order ? order : (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/**
+ * @brief   Creates an anonymous temporary file for one sorted run in the given directory.
+ *
+ * The file is unlinked at once, so it is removed when it is closed, also if the program fails.
+ *
+ * @param tmpDir  The directory of the temporary files.
+ * @return  A pointer to the file opened for writing and reading, or NULL on error.
+ */
+FILE *createRun(const char *tmpDir)
+{
+    char filename[PATH_MAX];
+    if (snprintf(filename, sizeof(filename), "%s/emitor_sort_XXXXXX", tmpDir) >= (int)sizeof(filename))
+    {
+        return NULL;
+    }
+    int fd = mkstemp(filename);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    unlink(filename);
+
+    FILE *run = fdopen(fd, "w+");
+    if (!run)
+    {
+        close(fd);
+        return NULL;
+    }
+    setvbuf(run, NULL, _IOFBF, SORT_RUN_BUFFER);
+    return run;
+}
+
+/**
+ * @brief   Appends one row with its header to a sorted run.
+ *
+ * @param run     A pointer to the file of the run.
+ * @param header  A pointer to the header of the row.
+ * @param row     A pointer to the formatted row.
+ * @return  Returns 0 on success, or -1 if writing failed.
+ */
+int writeRunRow(FILE *run, const SortHeader *header, const char *row)
+{
+    if (fwrite(header, sizeof(*header), 1, run) != 1 || fwrite(row, 1, header->rowLen, run) != header->rowLen)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief   Sorts the run kept in memory and writes it to a new temporary file.
+ *
+ * @param sorter  A pointer to the Sorter structure.
+ * @return  Returns 0 on success, or -1 if the run could not be written.
+ */
+int spillRun(Sorter *sorter)
+{
+    qsort_r(sorter->entries, sorter->nEntries, sizeof(SortEntry), compareSortEntries, sorter->rows.buffer);
+
+    FILE *run = createRun(sorter->tmpDir);
+    if (!run)
+    {
+        fprintf(stderr, "Nie można utworzyć pliku tymczasowego w katalogu %s.\n", sorter->tmpDir);
+        return -1;
+    }
+    int result = 0;
+    for (int i = 0; i < sorter->nEntries && result == 0; i++)
+    {
+        result = writeRunRow(run, &sorter->entries[i].header, sorter->rows.buffer + sorter->entries[i].offset);
+    }
+    if (result < 0 || fflush(run) != 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu pliku tymczasowego.\n");
+        fclose(run);
+        return -1;
+    }
+
+    sorter->runs = relocateMemmory(sorter->runs, sorter->nRuns, &sorter->allocatedRuns, SORT_MERGE_WAYS, sizeof(FILE *));
+    sorter->runs[sorter->nRuns++] = run;
+    sorter->spilledRows += sorter->nEntries;
+    sorter->nEntries = 0;
+    resetArena(&sorter->rows);
+    return 0;
+}
+
+/**
+ * @brief   Adds the current row to the run kept in memory, spilling the run when it reaches the memory limit.
+ *
+ * @param sorter     A pointer to the Sorter structure.
+ * @param timestamp  A pointer to the Timestamp struct containing the rendered date and hour.
+ * @param data       A pointer to the Data struct containing the path and the value.
+ * @return  Returns 0 on success, or -1 if a run could not be spilled.
+ */
+int sortRow(Sorter *sorter, const Timestamp *timestamp, Data *data)
+{
+    size_t offset = sorter->rows.len;
+    saveData(timestamp, data, &sorter->rows);
+
+    sorter->entries = relocateMemmory(sorter->entries, sorter->nEntries, &sorter->allocatedEntries,
+                                      sorter->allocatedEntries ? sorter->allocatedEntries : SORT_INITIAL_ENTRIES, sizeof(SortEntry));
+    SortEntry *entry = &sorter->entries[sorter->nEntries++];
+    entry->offset = offset;
+    entry->header.rowLen = (uint32_t)(sorter->rows.len - offset);
+    // The path cell starts with a quote right after the timestamp prefix, its quotes are doubled
+    entry->header.keyOffset = (uint32_t)timestamp->prefixLen + 1;
+    entry->header.keyLen = (uint32_t)quotedLength(data->path, data->pathLen);
+    entry->header.emitorLen = (uint32_t)quotedLength(data->path, data->emitorLen);
+
+    if (sorter->rows.len + (size_t)sorter->nEntries * sizeof(SortEntry) >= sorter->memoryLimit)
+    {
+        return spillRun(sorter);
+    }
+    return 0;
+}
+
+/**
+ * @brief   Frees the memory of the Sorter structure, closing (and so removing) the remaining runs.
+ *
+ * @param sorter  A pointer to the Sorter structure.
+ */
+void freeSorter(Sorter *sorter)
+{
+    for (int i = 0; i < sorter->nRuns; i++)
+    {
+        fclose(sorter->runs[i]);
+    }
+    free(sorter->runs);
+    free(sorter->entries);
+    free(sorter->rows.buffer);
+}
+
+/**
+ * @brief   Initializes the PartitionSet structure.
+ *
+ * The memory limit is shared by the buffers of the open files.
+ *
+ * @param set      A pointer to the PartitionSet structure to be initialized.
+ * @param options  A pointer to the command line options (the directory, the limit of open files and the memory limit).
+ */
+void initPartitions(PartitionSet *set, const Options *options)
+{
+    memset(set, 0, sizeof(*set));
+    set->directory = options->partitionDir;
+    initPathDictionary(&set->emitors);
+    initPathDictionary(&set->names);
+    set->maxOpen = options->openFiles;
+    set->open = alocateNewMemmory(NULL, set->maxOpen, sizeof(PartitionHandle));
+    memset(set->open, 0, set->maxOpen * sizeof(PartitionHandle));
+    set->bufferSize = options->memoryLimit / set->maxOpen;
+    if (set->bufferSize < PARTITION_MIN_BUFFER)
+    {
+        set->bufferSize = PARTITION_MIN_BUFFER;
+    }
+    set->lastPartition = -1;
+}
+
+/**
+ * @brief   Writes the buffered rows of an open partition file once the buffer is full.
+ *
+ * @param set     A pointer to the PartitionSet structure.
+ * @param handle  A pointer to the open file.
+ * @param force   Non-zero if the rows should be written regardless of their size.
+ * @return  Returns 0 on success, or -1 if writing failed.
+ */
+int flushPartition(const PartitionSet *set, PartitionHandle *handle, int force)
+{
+    if (handle->rows.len == 0 || (!force && handle->rows.len < set->bufferSize))
+    {
+        return 0;
+    }
+    if (writeAll(handle->fd, handle->rows.buffer, handle->rows.len) < 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu pliku partycji.\n");
+        return -1;
+    }
+    resetArena(&handle->rows);
+    return 0;
+}
+
+/**
+ * @brief   Writes the buffered rows of an open partition file and closes it.
+ *
+ * @param set     A pointer to the PartitionSet structure.
+ * @param handle  A pointer to the open file (its slot may also be empty).
+ * @return  Returns 0 on success, or -1 if writing failed.
+ */
+int closePartition(PartitionSet *set, PartitionHandle *handle)
+{
+    if (handle->fd < 0)
+    {
+        return 0;
+    }
+    int result = flushPartition(set, handle, 1);
+    if (close(handle->fd) != 0 && result == 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu pliku partycji.\n");
+        result = -1;
+    }
+    set->handles[handle->partition] = -1;
+    handle->fd = -1;
+    resetArena(&handle->rows);
+    return result;
+}
+
+/**
+ * @brief   Returns the open file of the partition of the given emitor, opening it if needed.
+ *
+ * The name of the file is the emitor name with every character other than letters, digits,
+ * '-', '_' and '.' replaced by '_'. A name with replaced characters gets the hash of the emitor
+ * name as a suffix (K/3 gives K_3-<hash>, K_3 stays K_3), and a file name that is still taken
+ * gets a number (-2, -3, ...), so the rows of two emitors never go to the same file. When the pool of open files is full, the least recently
+ * used file is closed. A file is truncated (and gets the CSV header) when it is opened
+ * for the first time, and appended to when it is opened again.
+ *
+ * @param set        A pointer to the PartitionSet structure.
+ * @param emitor     A pointer to the emitor name (not terminated).
+ * @param emitorLen  The length of the emitor name.
+ * @return  A pointer to the open file, or NULL on error.
+ */
+PartitionHandle *openPartition(PartitionSet *set, const char *emitor, size_t emitorLen)
+{
+    if (set->lastPartition >= 0 && set->lastEmitor.len == emitorLen &&
+        (emitorLen == 0 || memcmp(set->lastEmitor.buffer, emitor, emitorLen) == 0))
+    {
+        PartitionHandle *handle = &set->open[set->handles[set->lastPartition]];
+        handle->lastUse = ++set->clock;
+        return handle;
+    }
+
+    int before = set->emitors.nEntries;
+    int32_t partition = lookupPath(&set->emitors, emitor, emitorLen);
+    int created = set->emitors.nEntries > before;
+    if (created)
+    {
+        OutputArena *name = &set->name;
+        name->len = 0;
+        char *p = reserveArena(name, emitorLen + 1);
+        int replaced = 0;
+        for (size_t i = 0; i < emitorLen; i++)
+        {
+            unsigned char c = (unsigned char)emitor[i];
+            p[i] = (c >= 0x80 || (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '-' || c == '_' || c == '.') ? c : '_';
+            replaced |= p[i] != emitor[i];
+        }
+        name->len = emitorLen ? emitorLen : 1;
+        // Neither hidden files nor the "." and ".." entries
+        if (emitorLen == 0 || p[0] == '.')
+        {
+            p[0] = '_';
+            replaced = 1;
+        }
+        // A replaced name is told apart by the hash of the emitor name, whatever the order of the emitors
+        if (replaced)
+        {
+            char *end = reserveArena(name, 16);
+            name->len += sprintf(end, "-%08x", hashPath(emitor, emitorLen));
+        }
+
+        // The names still taken (an emitor named like a hashed name, or two equal hashes) get a number
+        size_t baseLen = name->len;
+        for (int suffix = 2; set->names.slots[findPathSlot(&set->names, name->buffer, name->len)] != 0; suffix++)
+        {
+            name->len = baseLen;
+            char *end = reserveArena(name, 16);
+            name->len += sprintf(end, "-%d", suffix);
+        }
+        set->renamed += replaced || name->len != baseLen;
+        lookupPath(&set->names, name->buffer, name->len);
+
+        set->handles = relocateMemmory(set->handles, partition, &set->allocatedHandles, DICTIONARY_INITIAL_SLOTS, sizeof(int));
+        set->handles[partition] = -1;
+    }
+
+    if (set->handles[partition] < 0)
+    {
+        int slot = set->nOpen;
+        if (slot == set->maxOpen)
+        {
+            slot = 0;
+            for (int i = 1; i < set->nOpen; i++)
+            {
+                if (set->open[i].lastUse < set->open[slot].lastUse)
+                {
+                    slot = i;
+                }
+            }
+            if (closePartition(set, &set->open[slot]) < 0)
+            {
+                return NULL;
+            }
+        }
+
+        const char *name = set->names.strings.buffer + set->names.offsets[partition];
+        int nameLen = (int)(set->names.offsets[partition + 1] - set->names.offsets[partition]);
+        char filename[PATH_MAX];
+        if (snprintf(filename, sizeof(filename), "%s/%.*s.csv", set->directory, nameLen, name) >= (int)sizeof(filename))
+        {
+            fprintf(stderr, "Zbyt długa nazwa pliku partycji emitora %.*s.\n", (int)emitorLen, emitor);
+            return NULL;
+        }
+        int fd = open(filename, created ? O_WRONLY | O_CREAT | O_TRUNC : O_WRONLY | O_APPEND, 0644);
+        if (fd < 0)
+        {
+            fprintf(stderr, "Nie można otworzyć pliku partycji %s.\n", filename);
+            return NULL;
+        }
+
+        PartitionHandle *handle = &set->open[slot];
+        handle->partition = partition;
+        handle->fd = fd;
+        if (created)
+        {
+            appendBytes(&handle->rows, CSV_HEADER, sizeof(CSV_HEADER) - 1);
+        }
+        else
+        {
+            set->reopened++;
+        }
+        set->handles[partition] = slot;
+        if (slot == set->nOpen)
+        {
+            set->nOpen++;
+        }
+    }
+
+    set->lastEmitor.len = 0;
+    appendBytes(&set->lastEmitor, emitor, emitorLen);
+    set->lastPartition = partition;
+    PartitionHandle *handle = &set->open[set->handles[partition]];
+    handle->lastUse = ++set->clock;
+    return handle;
+}
+
+/**
+ * @brief   Writes the buffered rows of all partitions, closes their files and frees the PartitionSet structure.
+ *
+ * @param set  A pointer to the PartitionSet structure.
+ * @return  Returns 0 on success, or -1 if writing failed.
+ */
+int closePartitions(PartitionSet *set)
+{
+    int result = 0;
+    for (int i = 0; i < set->nOpen; i++)
+    {
+        if (closePartition(set, &set->open[i]) < 0)
+        {
+            result = -1;
+        }
+        free(set->open[i].rows.buffer);
+    }
+    free(set->open);
+    free(set->handles);
+    free(set->lastEmitor.buffer);
+    free(set->unquoted.buffer);
+    free(set->name.buffer);
+    freePathDictionary(&set->emitors);
+    freePathDictionary(&set->names);
+    return result;
+}
+
+/**
+ * @brief   Stops the parser because of an error detected by the callbacks.
+ *
+ * @param context  A pointer to the ParserContext struct.
+ * @param error    The error to be reported (CONTEXT_*).
+ */
+void stopParser(ParserContext *context, int error)
+{
+    context->error = error;
+    XML_StopParser(context->parser, XML_FALSE);
+}
+
+/**
+ * @brief   Adds a new element of data, appending a timestamp and calling saveData().
+ *
+ * The function refreshes the cached timestamp and appends the entry formatted by
+ * saveData() to the output arena (or to the rows of the emitor held back in delta mode,
+ * to the sorted run or to the file of its partition), or the row to the columnar writer
+ * if there is one. With the row sink of the library the slices of the row are passed
+ * to the sink instead, without formatting.
+ *
+ * @param context  A pointer to the ParserContext struct containing the output arena and parsed XML data to be saved.
+ */
+void saveOneElement(ParserContext *context)
+{
+    const Data *data = context->data;
+    // After the fast scanner falls back to Expat the rows it has already saved are skipped
+    if (context->rowsSeen++ < context->skipRows)
+    {
+        return;
+    }
+    // Rows with longer fields are counted and skipped, they are never truncated
+    if (data->pathLen > fieldLimits.maxLength || data->valueLen > fieldLimits.maxLength)
+    {
+        __atomic_add_fetch(&fieldLimits.skippedRows, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (context->sink)
+    {
+        EmitorRecord record = {data->path, data->pathLen, data->emitorLen, data->value, data->valueLen};
+        if (context->sink(context->sinkData, &record) != 0)
+        {
+            stopParser(context, CONTEXT_SINK);
+        }
+        return;
+    }
+
+    STAGE_BEGIN(save);
+    refreshTimestamp(context->timestamp);
+    if (context->aggregation)
+    {
+        aggregateRow(context->aggregation, context->timestamp, context->data);
+    }
+    else if (context->columnar)
+    {
+        appendColumnarRow(context->columnar, context->timestamp, context->data, &context->output);
+    }
+    else if (context->sorter)
+    {
+        if (sortRow(context->sorter, context->timestamp, context->data) < 0)
+        {
+            stopParser(context, CONTEXT_OUTPUT);
+        }
+    }
+    else if (context->partitions)
+    {
+        PartitionHandle *handle = openPartition(context->partitions, data->path, data->emitorLen);
+        if (handle)
+        {
+            saveData(context->timestamp, context->data, &handle->rows);
+            context->output.totalRows++;
+        }
+        if (!handle || flushPartition(context->partitions, handle, 0) < 0)
+        {
+            stopParser(context, CONTEXT_OUTPUT);
+        }
+    }
+    else
+    {
+        // In delta mode the rows of an emitor are held back until it is known whether it changed
+        DeltaState *delta = context->delta;
+        saveData(context->timestamp, context->data, delta && delta->emitorDepth ? &delta->rows : &context->output);
+        // The same row is also added to the Arrow copy, from the same parse
+        if (context->arrow)
+        {
+            appendColumnarRow(context->arrow, context->timestamp, context->data, context->arrowOutput);
+        }
+    }
+    STAGE_END(context->stages, STAGE_SAVE_DATA, save);
+}
+
+/**
+ * @brief   Adds bytes to a 64-bit FNV-1a hash.
+ *
+ * @param hash  The hash of the preceding bytes.
+ * @param str   A pointer to the bytes.
+ * @param len   The number of bytes.
+ * @return  The updated hash.
+ */
+uint64_t hashBytes(uint64_t hash, const char *str, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ (unsigned char)str[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief   Adds the start of an element to the content hash of the current emitor.
+ *
+ * The emitor starts with its own element. The hash covers the names and the attributes
+ * of all elements of the subtree; the text saved by text() rules is added by saveText()
+ * (other text is not converted, so it is not hashed).
+ *
+ * @param context  A pointer to the ParserContext struct with the DeltaState.
+ * @param id       The identifier of the element (ELEMENT_*).
+ * @param name     The name of the element.
+ * @param attr     The attributes of the element.
+ */
+void deltaStartElement(ParserContext *context, int id, const char *name, const char **attr)
+{
+    DeltaState *delta = context->delta;
+
+    if (!delta->emitorDepth)
+    {
+        if (id != ELEMENT_EMITOR)
+        {
+            return;
+        }
+        delta->emitorDepth = context->depth;
+        delta->named = 0;
+        delta->hash = 0xCBF29CE484222325ULL;
+        resetArena(&delta->rows);
+    }
+
+    delta->hash = hashBytes(delta->hash, name, strlen(name) + 1);
+    for (int i = 0; attr[i]; i += 2)
+    {
+        delta->hash = hashBytes(delta->hash, attr[i], strlen(attr[i]) + 1);
+        delta->hash = hashBytes(delta->hash, attr[i + 1], strlen(attr[i + 1]) + 1);
+        if (context->depth == delta->emitorDepth && lookupAttribute(attr[i]) == ATTR_NAZWA)
+        {
+            delta->named = 1;
+        }
+    }
+    delta->hash = hashBytes(delta->hash, ">", 1);
+}
+
+/**
+ * @brief   Adds the end of an element to the content hash and finishes the emitor it closes.
+ *
+ * The hash of a finished emitor is recorded for the next run. If the previous run recorded
+ * the same hash for an emitor with that name, its rows are dropped, otherwise they are moved
+ * to the output arena. Emitors without a name, and repeated names, are always converted.
+ *
+ * @param context  A pointer to the ParserContext struct with the DeltaState.
+ */
+void deltaEndElement(ParserContext *context)
+{
+    DeltaState *delta = context->delta;
+    Data *data = context->data;
+
+    if (!delta->emitorDepth)
+    {
+        return;
+    }
+    delta->hash = hashBytes(delta->hash, "/", 1);
+    if (context->depth != delta->emitorDepth)
+    {
+        return;
+    }
+    delta->emitorDepth = 0;
+
+    size_t nameLen = data->nTags > 0 ? data->tags[0].offset - 1 : data->pathLen;
+    PathDictionary *current = &delta->current;
+    if (delta->named && memchr(data->path, '\n', nameLen) == NULL &&
+        current->slots[findPathSlot(current, data->path, nameLen)] == 0)
+    {
+        int32_t index = lookupPath(current, data->path, nameLen);
+        delta->currentHashes = relocateMemmory(delta->currentHashes, index, &delta->allocatedCurrent, DICTIONARY_INITIAL_SLOTS, sizeof(uint64_t));
+        delta->currentHashes[index] = delta->hash;
+
+        uint32_t slot = delta->previous.slots[findPathSlot(&delta->previous, data->path, nameLen)];
+        if (slot != 0 && delta->previousHashes[slot - 1] == delta->hash)
+        {
+            delta->unchanged++;
+            resetArena(&delta->rows);
+            return;
+        }
+    }
+
+    OutputArena *output = &context->output;
+    appendBytes(output, delta->rows.buffer, delta->rows.len);
+    output->nRows += delta->rows.nRows;
+    output->totalRows += delta->rows.nRows;
+    delta->changed++;
+    resetArena(&delta->rows);
+}
+
+/**
+ * @brief   Returns the identifier of an element name, including the names known only from the rules.
+ *
+ * @param matcher  A pointer to the compiled Matcher.
+ * @param name     The element name.
+ * @return  The identifier of the element (ELEMENT_* or a rule element), or ELEMENT_OTHER.
+ */
+int matchElement(const Matcher *matcher, const char *name)
+{
+    int id = lookupElement(name);
+    if (id == ELEMENT_OTHER && matcher->elementNames.nEntries > 0)
+    {
+        uint32_t slot = matcher->elementNames.slots[findPathSlot(&matcher->elementNames, name, strlen(name))];
+        id = slot != 0 ? ELEMENT_COUNT + (int)slot - 1 : ELEMENT_OTHER;
+    }
+    return id;
+}
+
+/**
+ * @brief   Returns the identifier of an attribute name, including the names known only from the rules.
+ *
+ * @param matcher  A pointer to the compiled Matcher.
+ * @param name     The attribute name.
+ * @return  The identifier of the attribute (ATTR_* or a rule attribute), or ATTR_OTHER.
+ */
+int matchAttribute(const Matcher *matcher, const char *name)
+{
+    int id = lookupAttribute(name);
+    if (id == ATTR_OTHER && matcher->attributeNames.nEntries > 0)
+    {
+        uint32_t slot = matcher->attributeNames.slots[findPathSlot(&matcher->attributeNames, name, strlen(name))];
+        id = slot != 0 ? ATTR_COUNT + (int)slot - 1 : ATTR_OTHER;
+    }
+    return id;
+}
+
+/**
+ * @brief   Finds the value of the attribute with the given identifier.
+ *
+ * @param matcher  A pointer to the compiled Matcher.
+ * @param attr     The attributes of the element.
+ * @param id       The identifier of the attribute.
+ * @return  The value of the attribute, or NULL if the element does not have it.
+ */
+const char *findAttribute(const Matcher *matcher, const char **attr, int id)
+{
+    for (int i = 0; attr[i]; i += 2)
+    {
+        if (matchAttribute(matcher, attr[i]) == id)
+        {
+            return attr[i + 1];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief   Interns an element or attribute name of a rule.
+ *
+ * @param names    A pointer to the PathDictionary of the names outside the built-in vocabulary.
+ * @param name     The name (not terminated).
+ * @param len      The length of the name.
+ * @param element  Non-zero for an element name, zero for an attribute name.
+ * @return  The identifier of the name, or -1 if it is too long.
+ */
+int internRuleName(PathDictionary *names, const char *name, size_t len, int element)
+{
+    char buffer[RULE_NAME_SIZE];
+    if (len >= sizeof(buffer))
+    {
+        return -1;
+    }
+    memcpy(buffer, name, len);
+    buffer[len] = '\0';
+
+    int id = element ? lookupElement(buffer) : lookupAttribute(buffer);
+    if (id == (element ? ELEMENT_OTHER : ATTR_OTHER))
+    {
+        id = (element ? ELEMENT_COUNT : ATTR_COUNT) + lookupPath(names, buffer, len);
+    }
+    return id;
+}
+
+/**
+ * @brief   Returns the length of the name at the beginning of a rule fragment.
+ *
+ * @param p  A pointer to the fragment.
+ * @return  The number of characters of the name.
+ */
+size_t ruleNameLength(const char *p)
+{
+    return strcspn(p, "/[]@?* \t\r\n");
+}
+
+/**
+ * @brief   Compiles one rule of the XPath-like subset and adds it to the matcher.
+ *
+ * A rule is a list of steps separated by "/" (child) or "//" (descendant), ending with the
+ * attribute holding the value of the row, e.g. emitor[@nazwa]/parametr[@typ]/wartosc/@pkt,
+ * or with text() if the value is the text of the last element.
+ * A step is an element name or "*", with optional [@attr] predicates (the element must have
+ * the attribute) and [@attr?] predicates (the attribute is optional); the values of the
+ * predicate attributes follow the element name in the path. A rule starting with "/" is
+ * anchored at the document root, other rules match at any depth. The path of a row consists
+ * of the elements below the last emitor step (or below the first step's parent if there is none),
+ * including the elements matched by "//".
+ *
+ * @param matcher  A pointer to the Matcher the rule is added to.
+ * @param text     The text of the rule (without comments and surrounding whitespace).
+ * @return  Returns 0 on success, or -1 if the rule is invalid.
+ */
+int addRule(Matcher *matcher, const char *text)
+{
+    matcher->rules = relocateMemmory(matcher->rules, matcher->nRules, &matcher->allocatedRules, 16, sizeof(Rule));
+    Rule *rule = &matcher->rules[matcher->nRules];
+    const char *p = text;
+    int descendant = 1;
+
+    memset(rule, 0, sizeof(*rule));
+    if (p[0] == '/')
+    {
+        descendant = p[1] == '/';
+        p += descendant ? 2 : 1;
+    }
+
+    for (;;)
+    {
+        if (strcmp(p, TEXT_STEP) == 0)
+        {
+            if (rule->nSteps == 0 || descendant)
+            {
+                return -1;
+            }
+            rule->valueAttribute = VALUE_TEXT;
+            break;
+        }
+        if (*p == '@')
+        {
+            size_t len = ruleNameLength(p + 1);
+            if (rule->nSteps == 0 || descendant || len == 0 || p[1 + len] != '\0')
+            {
+                return -1;
+            }
+            rule->valueAttribute = internRuleName(&matcher->attributeNames, p + 1, len, 0);
+            if (rule->valueAttribute < 0)
+            {
+                return -1;
+            }
+            break;
+        }
+        if (rule->nSteps == MAX_RULE_STEPS)
+        {
+            return -1;
+        }
+
+        RuleStep *step = &rule->steps[rule->nSteps++];
+        step->descendant = descendant;
+        if (*p == '*')
+        {
+            step->element = -1;
+            p++;
+        }
+        else
+        {
+            size_t len = ruleNameLength(p);
+            if (len == 0 || (step->element = internRuleName(&matcher->elementNames, p, len, 1)) < 0)
+            {
+                return -1;
+            }
+            p += len;
+        }
+        if (step->element == ELEMENT_EMITOR)
+        {
+            rule->firstPathStep = rule->nSteps;
+        }
+
+        while (*p == '[')
+        {
+            size_t len = ruleNameLength(p + 2);
+            if (p[1] != '@' || len == 0 || step->nPredicates == MAX_STEP_PREDICATES)
+            {
+                return -1;
+            }
+            int id = internRuleName(&matcher->attributeNames, p + 2, len, 0);
+            if (id < 0)
+            {
+                return -1;
+            }
+            p += 2 + len;
+            step->predicates[step->nPredicates] = id;
+            step->required[step->nPredicates] = *p != '?';
+            step->nPredicates++;
+            p += *p == '?';
+            if (*p++ != ']')
+            {
+                return -1;
+            }
+        }
+
+        if (*p != '/')
+        {
+            return -1;
+        }
+        descendant = p[1] == '/';
+        p += descendant ? 2 : 1;
+    }
+
+    matcher->nRules++;
+    return 0;
+}
+
+/**
+ * @brief   Compares two NFA positions (used to sort the positions of a DFA state).
+ *
+ * @param a  A pointer to the first position.
+ * @param b  A pointer to the second position.
+ * @return  A negative, zero or positive value, as required by qsort().
+ */
+int comparePositions(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *)a;
+    int32_t y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief   Adds a DFA state (or finds the identical one) for the given positions and actions.
+ *
+ * The key of a state is the sorted, deduplicated list of its NFA positions followed by
+ * its actions, so two states are merged only if they behave identically.
+ *
+ * @param matcher     A pointer to the Matcher being built.
+ * @param positions   The NFA positions (rule * (MAX_RULE_STEPS + 1) + matched steps); sorted in place.
+ * @param nPositions  The number of positions.
+ * @param action      A pointer to the MatchState with the actions of the state.
+ * @return  The index of the state, or -1 if the automaton has too many states.
+ */
+int32_t addMatchState(Matcher *matcher, int32_t *positions, int nPositions, const MatchState *action)
+{
+    int n = 0;
+    qsort(positions, nPositions, sizeof(int32_t), comparePositions);
+    for (int i = 0; i < nPositions; i++)
+    {
+        if (n == 0 || positions[n - 1] != positions[i])
+        {
+            positions[n++] = positions[i];
+        }
+    }
+
+    if (n > MATCH_MAX_POSITIONS)
+    {
+        return -1;
+    }
+
+    int32_t key[MATCH_MAX_POSITIONS + MAX_STATE_VALUES + MAX_STATE_PUSH + 3];
+    int keyLen = n;
+    memcpy(key, positions, n * sizeof(int32_t));
+    key[keyLen++] = action->onPath;
+    key[keyLen++] = action->nValues;
+    memcpy(key + keyLen, action->values, action->nValues * sizeof(int32_t));
+    keyLen += action->nValues;
+    key[keyLen++] = action->nPush;
+    memcpy(key + keyLen, action->push, action->nPush * sizeof(int32_t));
+    keyLen += action->nPush;
+
+    int before = matcher->stateKeys.nEntries;
+    int32_t index = lookupPath(&matcher->stateKeys, (const char *)key, keyLen * sizeof(int32_t));
+    if (matcher->stateKeys.nEntries == before)
+    {
+        return index;
+    }
+    if (index >= MATCH_MAX_STATES)
+    {
+        return -1;
+    }
+
+    matcher->states = relocateMemmory(matcher->states, index, &matcher->allocatedStates, 256, sizeof(MatchState));
+    matcher->states[index] = *action;
+    matcher->states[index].positionsStart = matcher->nPositions;
+    matcher->states[index].nPositions = n;
+    matcher->positions = relocateMemmory(matcher->positions, matcher->nPositions + n, &matcher->allocatedPositions,
+                                         matcher->nPositions + n + 1024, sizeof(int32_t));
+    memcpy(matcher->positions + matcher->nPositions, positions, n * sizeof(int32_t));
+    matcher->nPositions += n;
+    matcher->nStates++;
+    return index;
+}
+
+/**
+ * @brief   Builds the DFA of the rules with the subset construction over all input symbols.
+ *
+ * An input symbol is an element identifier combined with the bits of the attributes used
+ * by [@attr] predicates that the element has. Every state gets a full row of the transition
+ * table, so the callbacks only index the table: the cost of an element does not depend on
+ * the number of rules.
+ *
+ * @param matcher  A pointer to the Matcher with the parsed rules.
+ * @return  Returns 0 on success, or -1 if the automaton is too large.
+ */
+int buildMatcher(Matcher *matcher)
+{
+    // Bits of the attributes tested by the predicates
+    matcher->nAttributes = ATTR_COUNT + matcher->attributeNames.nEntries;
+    matcher->attributeBits = calloc(matcher->nAttributes, sizeof(uint32_t));
+    matcher->nBits = 0;
+    for (int r = 0; r < matcher->nRules; r++)
+    {
+        for (int k = 0; k < matcher->rules[r].nSteps; k++)
+        {
+            RuleStep *step = &matcher->rules[r].steps[k];
+            step->requiredMask = 0;
+            for (int i = 0; i < step->nPredicates; i++)
+            {
+                if (!step->required[i])
+                {
+                    continue;
+                }
+                uint32_t *bit = &matcher->attributeBits[step->predicates[i]];
+                if (*bit == 0)
+                {
+                    if (matcher->nBits == MATCH_MAX_BITS)
+                    {
+                        return -1;
+                    }
+                    *bit = 1u << matcher->nBits++;
+                }
+                step->requiredMask |= *bit;
+            }
+        }
+    }
+    matcher->nElements = ELEMENT_COUNT + matcher->elementNames.nEntries;
+    matcher->nSymbols = matcher->nElements << matcher->nBits;
+
+    int32_t positions[2 * MATCH_MAX_POSITIONS];
+    int nPositions = 0;
+    MatchState action;
+    memset(&action, 0, sizeof(action));
+    if (matcher->nRules > MATCH_MAX_POSITIONS)
+    {
+        return -1;
+    }
+    for (int r = 0; r < matcher->nRules; r++)
+    {
+        positions[nPositions++] = r * (MAX_RULE_STEPS + 1);
+    }
+    if (addMatchState(matcher, positions, nPositions, &action) != MATCH_START_STATE)
+    {
+        return -1;
+    }
+
+    int allocatedNext = 0;
+    for (int32_t s = 0; s < matcher->nStates; s++)
+    {
+        matcher->next = relocateMemmory(matcher->next, (s + 1) * matcher->nSymbols, &allocatedNext,
+                                        64 * matcher->nSymbols, sizeof(int32_t));
+        for (int symbol = 0; symbol < matcher->nSymbols; symbol++)
+        {
+            int element = symbol >> matcher->nBits;
+            uint32_t mask = symbol & ((1u << matcher->nBits) - 1);
+            const MatchState *state = &matcher->states[s];
+
+            nPositions = 0;
+            memset(&action, 0, sizeof(action));
+            for (int i = 0; i < state->nPositions; i++)
+            {
+                int32_t position = matcher->positions[state->positionsStart + i];
+                const Rule *rule = &matcher->rules[position / (MAX_RULE_STEPS + 1)];
+                int k = position % (MAX_RULE_STEPS + 1);
+                if (k == rule->nSteps)
+                {
+                    continue;
+                }
+
+                const RuleStep *step = &rule->steps[k];
+                if (step->descendant)
+                {
+                    positions[nPositions++] = position;
+                }
+                if ((step->element >= 0 && step->element != element) || (step->requiredMask & mask) != step->requiredMask)
+                {
+                    continue;
+                }
+                positions[nPositions++] = position + 1;
+                for (int p = 0; p < step->nPredicates && k >= rule->firstPathStep; p++)
+                {
+                    int known = 0;
+                    for (int j = 0; j < action.nPush; j++)
+                    {
+                        known |= action.push[j] == step->predicates[p];
+                    }
+                    if (!known)
+                    {
+                        if (action.nPush == MAX_STATE_PUSH)
+                        {
+                            return -1;
+                        }
+                        action.push[action.nPush++] = step->predicates[p];
+                    }
+                }
+                if (k + 1 == rule->nSteps)
+                {
+                    // Every completed rule gives its own row, identical values are saved once
+                    int known = 0;
+                    for (int j = 0; j < action.nValues; j++)
+                    {
+                        known |= action.values[j] == rule->valueAttribute;
+                    }
+                    if (!known)
+                    {
+                        if (action.nValues == MAX_STATE_VALUES)
+                        {
+                            return -1;
+                        }
+                        action.values[action.nValues++] = rule->valueAttribute;
+                    }
+                }
+            }
+            for (int i = 0; i < nPositions; i++)
+            {
+                const Rule *rule = &matcher->rules[positions[i] / (MAX_RULE_STEPS + 1)];
+                action.onPath |= positions[i] % (MAX_RULE_STEPS + 1) > rule->firstPathStep;
+            }
+
+            int32_t target = addMatchState(matcher, positions, nPositions, &action);
+            if (target < 0)
+            {
+                return -1;
+            }
+            matcher->next[s * matcher->nSymbols + symbol] = target;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief   Compiles the extraction rules, read from a file or the built-in defaults.
+ *
+ * Every non-empty line of the file which does not start with '#' holds one rule.
+ *
+ * @param matcher   A pointer to the Matcher structure to be initialized.
+ * @param filename  The name of the rule file, or NULL for the default rules.
+ * @return  Returns 0 on success, or -1 if the rules could not be read or compiled.
+ */
+int initMatcher(Matcher *matcher, const char *filename)
+{
+    memset(matcher, 0, sizeof(*matcher));
+    initPathDictionary(&matcher->elementNames);
+    initPathDictionary(&matcher->attributeNames);
+    initPathDictionary(&matcher->stateKeys);
+
+    if (!filename)
+    {
+        for (size_t i = 0; i < sizeof(defaultRules) / sizeof(defaultRules[0]); i++)
+        {
+            addRule(matcher, defaultRules[i]);
+        }
+    }
+    else
+    {
+        FILE *file = fopen(filename, "r");
+        if (!file)
+        {
+            fprintf(stderr, "Nie można otworzyć pliku reguł.\n");
+            return -1;
+        }
+
+        char *line = NULL;
+        size_t allocated = 0;
+        int lineNumber = 0;
+        while (getline(&line, &allocated, file) > 0)
+        {
+            char *start = line + strspn(line, " \t");
+            size_t len = strlen(start);
+            lineNumber++;
+            while (len > 0 && strchr(" \t\r\n", start[len - 1]))
+            {
+                start[--len] = '\0';
+            }
+            if (len == 0 || start[0] == '#')
+            {
+                continue;
+            }
+            if (addRule(matcher, start) < 0)
+            {
+                fprintf(stderr, "Niepoprawna reguła w wierszu %d: %s\n", lineNumber, start);
+                free(line);
+                fclose(file);
+                return -1;
+            }
+        }
+        free(line);
+        fclose(file);
+    }
+
+    if (buildMatcher(matcher) < 0)
+    {
+        fprintf(stderr, "Reguły tworzą zbyt duży automat.\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief   Frees the memory of the Matcher structure.
+ *
+ * @param matcher  A pointer to the Matcher structure.
+ */
+void freeMatcher(Matcher *matcher)
+{
+    free(matcher->rules);
+    freePathDictionary(&matcher->elementNames);
+    freePathDictionary(&matcher->attributeNames);
+    freePathDictionary(&matcher->stateKeys);
+    free(matcher->attributeBits);
+    free(matcher->states);
+    free(matcher->positions);
+    free(matcher->next);
+}
+
+/**
+ * @brief   Makes sure that the stack of the automaton states can hold the current depth.
+ *
+ * @param context  A pointer to the ParserContext struct.
+ */
+void reserveMatchStack(ParserContext *context)
+{
+    if (context->depth >= context->allocatedDepth)
+    {
+        int allocated = context->allocatedDepth;
+        context->matchStates = relocateMemmory(context->matchStates, context->depth, &context->allocatedDepth,
+                                               allocated ? allocated : MATCH_INITIAL_DEPTH, sizeof(int32_t));
+        context->pushedTags = relocateMemmory(context->pushedTags, context->depth, &allocated,
+                                              allocated ? allocated : MATCH_INITIAL_DEPTH, sizeof(uint8_t));
+        if (allocated == context->allocatedDepth && context->depth == 1)
+        {
+            context->matchStates[0] = MATCH_START_STATE;
+        }
+    }
+}
+
+/**
+ * @brief   Function called when the parser encounters text data in an XML element.
+ *
+ * Expat may split the text of one element into many fragments, which are appended to the text
+ * buffer of the parser context (reused by all elements, so it does not allocate once warm).
+ * The handler is registered only while an element whose text is the value of a row is open.
+ *
+ * @param userData  A pointer to user data (the ParserContext struct in this case).
+ * @param s         A pointer to the text data (string) contained in the XML element.
+ * @param len       Length of the text data.
+ */
+void XMLCALL characterData(void *userData, const XML_Char *s, int len)
+{
+    ParserContext *context = (ParserContext *)userData;
+    appendBytes(&context->text, s, len);
+}
+
+/**
+ * @brief   Function called when the parser encounters the beginning of an XML element.
+ *
+ * This function handles the start of an XML element and extracts relevant data such as
+ * emitter names, tags, and values from the element's attributes.
+ * The state of the element is one lookup in the transition table of the compiled rules,
+ * which tells whether the element (and which of its attribute values) is part of the path
+ * and which of its attributes (or its text) are saved as rows, one per completed rule. The emitor element only names the rows.
+ * The character data handler is registered only while the text of an element is collected.
+ *
+ * @param userData  A pointer to user data (the ParserContext struct in this case).
+ * @param name      Name of the currently processed XML element.
+ * @param attr      An array of attributes of the XML element (alternating name and attribute value).
+ */
+void XMLCALL startElement(void *userData, const char *name, const char **attr)
+{
+    ParserContext *context = (ParserContext *)userData;
+    Data *data = context->data;
+    const Matcher *matcher = context->matcher;
+    int id = matchElement(matcher, name);
+    uint32_t mask = 0;
+
+    if (matcher->nBits > 0)
+    {
+        for (int i = 0; attr[i]; i += 2)
+        {
+            mask |= matcher->attributeBits[matchAttribute(matcher, attr[i])];
+        }
+    }
+
+    context->depth++;
+    if (context->delta)
+    {
+        deltaStartElement(context, id, name, attr);
+    }
+    reserveMatchStack(context);
+    int32_t state = matcher->next[context->matchStates[context->depth - 1] * matcher->nSymbols + ((id << matcher->nBits) | mask)];
+    context->matchStates[context->depth] = state;
+    context->pushedTags[context->depth] = 0;
+
+    if (id == ELEMENT_EMITOR)
+    {
+        int named = 0;
+        for (int i = 0; attr[i]; i += 2)
+        {
+            if (lookupAttribute(attr[i]) == ATTR_NAZWA)
+            {
+                setEmitor(data, attr[i + 1], strlen(attr[i + 1]));
+                named = 1;
+            }
+        }
+        context->unnamedEmitors += !named;
+        return;
+    }
+
+    const MatchState *match = &matcher->states[state];
+    if (!match->onPath)
+    {
+        return;
+    }
+
+    int nTags = data->nTags;
+    int full = addTag(data, id, name) < 0;
+    for (int i = 0; i < match->nPush && !full; i++)
+    {
+        const char *value = findAttribute(matcher, attr, match->push[i]);
+        full = value && addTag(data, ELEMENT_OTHER, value) < 0;
+    }
+    context->pushedTags[context->depth] = (uint8_t)(data->nTags - nTags);
+    if (full)
+    {
+        stopParser(context, CONTEXT_TAG_DEPTH);
+        return;
+    }
+
+    for (int i = 0; i < match->nValues; i++)
+    {
+        if (match->values[i] >= 0)
+        {
+            const char *value = findAttribute(matcher, attr, match->values[i]);
+            if (value)
+            {
+                data->value = value;
+                data->valueLen = strlen(value);
+                saveOneElement(context);
+            }
+        }
+        else if (context->textDepth == 0)
+        {
+            context->textDepth = context->depth;
+            context->text.len = 0;
+            XML_SetCharacterDataHandler(context->parser, characterData);
+        }
+    }
+}
+
+/**
+ * @brief   Saves the collected text of the element as a row and stops collecting text.
+ *
+ * The text is saved without the surrounding whitespace, elements with blank text are skipped.
+ * In delta mode the saved text is added to the content hash of the emitor.
+ *
+ * @param context  A pointer to the ParserContext struct.
+ */
+void saveText(ParserContext *context)
+{
+    OutputArena *text = &context->text;
+    size_t start = 0;
+
+    while (text->len > 0 && strchr(" \t\r\n", text->buffer[text->len - 1]))
+    {
+        text->len--;
+    }
+    while (start < text->len && strchr(" \t\r\n", text->buffer[start]))
+    {
+        start++;
+    }
+    if (start < text->len)
+    {
+        appendBytes(text, "", 1);
+        if (context->delta && context->delta->emitorDepth)
+        {
+            // The saved text is part of the content of the emitor, like its attributes
+            context->delta->hash = hashBytes(context->delta->hash, text->buffer + start, text->len - start);
+        }
+        context->data->value = text->buffer + start;
+        context->data->valueLen = text->len - 1 - start;
+        saveOneElement(context);
+    }
+    context->textDepth = 0;
+    XML_SetCharacterDataHandler(context->parser, NULL);
+}
+
+/**
+ * @brief   Function called when the parser encounters the end of an XML element.
+ *
+ * This function saves the text of the element if it is the value of a row and removes the tags
+ * the element added to the tag stack and the dotted path.
+ *
+ * @param userData  A pointer to user data (the ParserContext struct in this case).
+ * @param name      Name of the currently terminated XML element.
+ */
+void XMLCALL endElement(void *userData, const char *name)
+{
+    ParserContext *context = (ParserContext *)userData;
+    Data *data = context->data;
+    (void)name;
+
+    if (context->depth == context->textDepth)
+    {
+        saveText(context);
+    }
+    if (context->delta)
+    {
+        deltaEndElement(context);
+    }
+    for (int i = context->pushedTags[context->depth]; i > 0; i--)
+    {
+        removeTag(data);
+    }
+    context->depth--;
+}
+
+
+#ifdef EMITOR_STATS
+/**
+ * @brief   startElement() measured by the stage timers (registered in builds with -DEMITOR_STATS).
+ *
+ * @param userData  A pointer to user data (the ParserContext struct in this case).
+ * @param name      Name of the currently processed XML element.
+ * @param attr      An array of attributes of the XML element (alternating name and attribute value).
+ */
+void XMLCALL timedStartElement(void *userData, const char *name, const char **attr)
+{
+    STAGE_BEGIN(start);
+    startElement(userData, name, attr);
+    STAGE_END(((ParserContext *)userData)->stages, STAGE_START_ELEMENT, start);
+}
+
+/**
+ * @brief   endElement() measured by the stage timers (registered in builds with -DEMITOR_STATS).
+ *
+ * @param userData  A pointer to user data (the ParserContext struct in this case).
+ * @param name      Name of the currently terminated XML element.
+ */
+void XMLCALL timedEndElement(void *userData, const char *name)
+{
+    STAGE_BEGIN(end);
+    endElement(userData, name);
+    STAGE_END(((ParserContext *)userData)->stages, STAGE_END_ELEMENT, end);
+}
+#endif
+
+/**
+ * @brief   Writes one batch to one output.
+ *
+ * @param writer  A pointer to the OutputWriter structure.
+ * @param sink    A pointer to the output.
+ * @param buffer  A pointer to the data.
+ * @param len     The number of bytes to be written.
+ * @return  Returns 0 on success, or -1 if writing failed.
+ */
+int writeSink(OutputWriter *writer, OutputSink *sink, const char *buffer, size_t len)
+{
+    int result;
+    // Only the output file is timed, the outputs are written by several threads at once
+    if (sink == &writer->sinks[0])
+    {
+        STAGE_BEGIN(write);
+        result = writeAll(sink->fd, buffer, len);
+        STAGE_END(writer->stages, STAGE_WRITE, write);
+    }
+    else
+    {
+        result = writeAll(sink->fd, buffer, len);
+    }
+    if (result < 0)
+    {
+        return -1;
+    }
+    sink->bytesWritten += len;
+    sink->writes++;
+    return 0;
+}
+
+/**
+ * @brief   Returns a batch to the free list once the last of its outputs has written it.
+ *
+ * Must be called with the lock of the writer held.
+ *
+ * @param writer  A pointer to the OutputWriter structure.
+ * @param batch   A pointer to the batch.
+ */
+void releaseBatch(OutputWriter *writer, RowBatch *batch)
+{
+    if (--batch->refs == 0)
+    {
+        batch->next = writer->spare;
+        writer->spare = batch;
+        pthread_cond_broadcast(&writer->cond);
+    }
+}
+
+/**
+ * @brief   The thread of one output of the asynchronous writer, writing the batches queued for it.
+ *
+ * An output which failed keeps taking its batches without writing them, so it never holds back
+ * the other outputs.
+ *
+ * @param arg  A pointer to the OutputWriter structure (the thread takes the next output without a thread).
+ * @return  Always NULL.
+ */
+void *sinkThread(void *arg)
+{
+    OutputWriter *writer = (OutputWriter *)arg;
+
+    pthread_mutex_lock(&writer->lock);
+    OutputSink *sink = &writer->sinks[writer->nStarted++];
+    for (;;)
+    {
+        while (sink->count == 0 && !writer->stop)
+        {
+            pthread_cond_wait(&sink->cond, &writer->lock);
+        }
+        if (sink->count == 0)
+        {
+            break;
+        }
+        RowBatch *batch = sink->queue[sink->head];
+        int failed = sink->error != 0;
+        pthread_mutex_unlock(&writer->lock);
+
+        int result = failed ? 0 : writeSink(writer, sink, batch->buffer, batch->len);
+
+        pthread_mutex_lock(&writer->lock);
+        if (result < 0 && !sink->error)
+        {
+            sink->error = errno ? errno : EIO;
+        }
+        sink->head = (sink->head + 1) % SINK_QUEUE_DEPTH;
+        sink->count--;
+        releaseBatch(writer, batch);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+/**
+ * @brief   Opens the destination of a --tee output: a file, "tcp:HOST:PORT" or "unix:PATH".
+ *
+ * @param destination  The destination (without the "arrow:" prefix).
+ * @return  The descriptor, or -1 if the destination could not be opened.
+ */
+int openTee(const char *destination)
+{
+    if (strncmp(destination, TEE_UNIX_PREFIX, strlen(TEE_UNIX_PREFIX)) == 0)
+    {
+        struct sockaddr_un address;
+        const char *path = destination + strlen(TEE_UNIX_PREFIX);
+        if (strlen(path) >= sizeof(address.sun_path))
+        {
+            return -1;
+        }
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+    if (strncmp(destination, TEE_TCP_PREFIX, strlen(TEE_TCP_PREFIX)) == 0)
+    {
+        char host[256];
+        const char *hostStart = destination + strlen(TEE_TCP_PREFIX);
+        const char *port = strrchr(hostStart, ':');
+        if (!port || (size_t)(port - hostStart) >= sizeof(host))
+        {
+            return -1;
+        }
+        memcpy(host, hostStart, port - hostStart);
+        host[port - hostStart] = '\0';
+
+        struct addrinfo hints, *addresses;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, port + 1, &hints, &addresses) != 0)
+        {
+            return -1;
+        }
+        int fd = -1;
+        for (struct addrinfo *address = addresses; address && fd < 0; address = address->ai_next)
+        {
+            fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) < 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        return fd;
+    }
+    return strcmp(destination, STDIO_NAME) == 0 ? dup(STDOUT_FILENO) : open(destination, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+/**
+ * @brief   Registers one output of the writer.
+ *
+ * @param writer    A pointer to the OutputWriter structure.
+ * @param fd        The descriptor of the output.
+ * @param name      The name of the output used in messages.
+ * @param stream    The stream of batches written to the output (STREAM_*).
+ * @param owned     Non-zero if the writer closes the descriptor.
+ * @param optional  Non-zero if the errors of the output are ignored.
+ */
+void addSink(OutputWriter *writer, int fd, const char *name, int stream, int owned, int optional)
+{
+    OutputSink *sink = &writer->sinks[writer->nSinks++];
+    sink->fd = fd;
+    sink->name = name;
+    sink->stream = stream;
+    sink->owned = owned;
+    sink->optional = optional;
+}
+
+/**
+ * @brief   Waits until all batches have been written, stops the writing threads and closes the --tee outputs.
+ *
+ * @param writer  A pointer to the OutputWriter structure.
+ * @return  Returns 0 on success, or -1 if any of the writes failed.
+ */
+int closeOutputWriter(OutputWriter *writer)
+{
+    int result = 0;
+
+    if (writer->async)
+    {
+        pthread_mutex_lock(&writer->lock);
+        writer->stop = 1;
+        for (int i = 0; i < writer->nSinks; i++)
+        {
+            pthread_cond_signal(&writer->sinks[i].cond);
+        }
+        pthread_mutex_unlock(&writer->lock);
+        for (int i = 0; i < writer->nSinks; i++)
+        {
+            pthread_join(writer->sinks[i].thread, NULL);
+            pthread_cond_destroy(&writer->sinks[i].cond);
+        }
+
+        while (writer->spare)
+        {
+            RowBatch *batch = writer->spare;
+            writer->spare = batch->next;
+            free(batch->buffer);
+            free(batch);
+        }
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->cond);
+    }
+
+    for (int i = 0; i < writer->nSinks; i++)
+    {
+        OutputSink *sink = &writer->sinks[i];
+        if (sink->owned && close(sink->fd) != 0 && !sink->error)
+        {
+            sink->error = errno ? errno : EIO;
+        }
+        if (sink->error && !sink->optional)
+        {
+            fprintf(stderr, "Błąd podczas zapisu do wyjścia: %s.\n", sink->name);
+            result = -1;
+        }
+    }
+    writer->bytesWritten = writer->sinks[0].bytesWritten;
+    writer->writes = writer->sinks[0].writes;
+    return result;
+}
+
+/**
+ * @brief   Initializes the OutputWriter structure and starts the writing threads if requested.
+ *
+ * The first output is the output file. In verbose mode the CSV rows are also written to the
+ * console, and every --tee destination is one more output, of the output format or of its Arrow
+ * copy ("arrow:" prefix). With the asynchronous backend (the default with --tee) every output has
+ * its own thread and queue, so a slow output holds back only the parser, once its queue is full.
+ *
+ * @param writer   A pointer to the OutputWriter structure to be initialized.
+ * @param fd       The descriptor of the output file.
+ * @param options  A pointer to the command line options.
+ * @return  Returns 0 on success, or -1 if an output could not be opened or a writing thread could not be started.
+ */
+int initOutputWriter(OutputWriter *writer, int fd, const Options *options)
+{
+    memset(writer, 0, sizeof(*writer));
+    addSink(writer, fd, "plik wynikowy", STREAM_MAIN, FALSE_ARG, FALSE_ARG);
+    // The rows are echoed to the console only if they do not go to the standard output already
+    // Binary formats are never echoed to the console
+    if (options->verbose && fd != STDOUT_FILENO && options->format == FORMAT_CSV)
+    {
+        addSink(writer, STDOUT_FILENO, "konsola", STREAM_MAIN, FALSE_ARG, TRUE_ARG);
+    }
+    for (int i = 0; i < options->nTees; i++)
+    {
+        const char *destination = options->tees[i];
+        int arrow = strncmp(destination, TEE_ARROW_PREFIX, strlen(TEE_ARROW_PREFIX)) == 0;
+        int teeFd = openTee(arrow ? destination + strlen(TEE_ARROW_PREFIX) : destination);
+        if (teeFd < 0)
+        {
+            fprintf(stderr, "Nie można otworzyć wyjścia %s.\n", destination);
+            for (int j = 0; j < writer->nSinks; j++)
+            {
+                if (writer->sinks[j].owned)
+                {
+                    close(writer->sinks[j].fd);
+                }
+            }
+            return -1;
+        }
+        addSink(writer, teeFd, destination, arrow && options->format == FORMAT_CSV ? STREAM_ARROW : STREAM_MAIN, TRUE_ARG, FALSE_ARG);
+    }
+    writer->flushSize = options->outBufferSize;
+    writer->async = options->writerMode == WRITER_ASYNC || options->nTees > 0;
+
+    if (writer->async)
+    {
+        pthread_mutex_init(&writer->lock, NULL);
+        pthread_cond_init(&writer->cond, NULL);
+        for (int i = 0; i < writer->nSinks; i++)
+        {
+            pthread_cond_init(&writer->sinks[i].cond, NULL);
+        }
+        for (int i = 0; i < writer->nSinks; i++)
+        {
+            if (pthread_create(&writer->sinks[i].thread, NULL, sinkThread, writer) != 0)
+            {
+                fprintf(stderr, "Nie można uruchomić wątku zapisu.\n");
+                // The threads already started take the first outputs and stop at once
+                for (int j = i; j < writer->nSinks; j++)
+                {
+                    pthread_cond_destroy(&writer->sinks[j].cond);
+                    if (writer->sinks[j].owned)
+                    {
+                        close(writer->sinks[j].fd);
+                    }
+                }
+                writer->nSinks = i;
+                closeOutputWriter(writer);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief   Hands the rows collected in one arena to all the outputs of its stream.
+ *
+ * The synchronous backend writes the buffer to every output in turn. The asynchronous one wraps
+ * the buffer in a batch queued for every output without copying it, and gives the arena the buffer
+ * of a batch all the outputs have already written. When the queue of an output is full, the
+ * parser waits for it (backpressure); the other outputs keep writing their queued batches.
+ * Only an error of the output file stops the conversion, the other outputs which failed are
+ * skipped and reported when the writer is closed.
+ *
+ * @param writer  A pointer to the OutputWriter structure.
+ * @param stream  The stream of the arena (STREAM_*).
+ * @param arena   A pointer to the OutputArena with the rows.
+ * @return  Returns 0 on success, or -1 if writing to the output file failed.
+ */
+int publishBatch(OutputWriter *writer, int stream, OutputArena *arena)
+{
+    int result = 0;
+    if (!writer->async)
+    {
+        for (int i = 0; i < writer->nSinks; i++)
+        {
+            OutputSink *sink = &writer->sinks[i];
+            if (sink->stream == stream && !sink->error && writeSink(writer, sink, arena->buffer, arena->len) < 0)
+            {
+                sink->error = errno ? errno : EIO;
+            }
+        }
+        result = writer->sinks[0].error ? -1 : 0;
+        resetArena(arena);
+        return result;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    RowBatch *batch = writer->spare;
+    if (batch)
+    {
+        writer->spare = batch->next;
+    }
+    else
+    {
+        batch = alocateNewMemmory(NULL, 1, sizeof(RowBatch));
+        batch->buffer = NULL;
+        batch->allocated = 0;
+    }
+    // The buffer of the batch was written by all its outputs, it becomes the next arena buffer
+    char *buffer = batch->buffer;
+    size_t allocated = batch->allocated;
+    batch->buffer = arena->buffer;
+    batch->len = arena->len;
+    batch->allocated = arena->allocated;
+    batch->refs = 1;
+    arena->buffer = buffer;
+    arena->allocated = allocated;
+
+    for (int i = 0; i < writer->nSinks; i++)
+    {
+        OutputSink *sink = &writer->sinks[i];
+        if (sink->stream != stream)
+        {
+            continue;
+        }
+        if (sink->count == SINK_QUEUE_DEPTH)
+        {
+            sink->stalls++;
+            while (sink->count == SINK_QUEUE_DEPTH)
+            {
+                pthread_cond_wait(&writer->cond, &writer->lock);
+            }
+        }
+        batch->refs++;
+        sink->queue[(sink->head + sink->count) % SINK_QUEUE_DEPTH] = batch;
+        sink->count++;
+        pthread_cond_signal(&sink->cond);
+    }
+    releaseBatch(writer, batch);
+    result = writer->sinks[0].error ? -1 : 0;
+    pthread_mutex_unlock(&writer->lock);
+    resetArena(arena);
+    return result;
+}
+
+/**
+ * @brief   Writes the entries collected in the output arena once enough of them were collected.
+ *
+ * The function is called after every parsed block. When the arena holds at least
+ * flushSize bytes (or when forced), its content is handed to the outputs (see publishBatch()).
+ * The Arrow copy of the rows of --tee=arrow: is flushed in the same way.
+ *
+ * @param writer  A pointer to the OutputWriter structure.
+ * @param arena   A pointer to the OutputArena with the entries to be written.
+ * @param force   Non-zero if the arena should be written regardless of its size.
+ * @return  Returns 0 on success, or -1 if writing to the output file failed.
+ */
+int flushOutput(OutputWriter *writer, OutputArena *arena, int force)
+{
+    int result = 0;
+    if (arena->len > 0 && (force || arena->len >= writer->flushSize))
+    {
+        result = publishBatch(writer, STREAM_MAIN, arena);
+    }
+    if (writer->arrow && writer->arrow->len > 0 && (force || writer->arrow->len >= writer->flushSize) &&
+        publishBatch(writer, STREAM_ARROW, writer->arrow) < 0)
+    {
+        result = -1;
+    }
+
+    if (result < 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
+    }
+    return result;
+}
+
+
+/**
+ * @brief   Reads the next row of a sorted run.
+ *
+ * @param reader  A pointer to the SortRunReader structure.
+ * @return  Returns 1 if a row was read, 0 at the end of the run, or -1 if reading failed.
+ */
+int readRunRow(SortRunReader *reader)
+{
+    if (fread(&reader->header, sizeof(reader->header), 1, reader->file) != 1)
+    {
+        return ferror(reader->file) ? -1 : 0;
+    }
+    reader->row.len = 0;
+    char *row = reserveArena(&reader->row, reader->header.rowLen);
+    if (fread(row, 1, reader->header.rowLen, reader->file) != reader->header.rowLen)
+    {
+        return -1;
+    }
+    reader->row.len = reader->header.rowLen;
+    return 1;
+}
+
+/**
+ * @brief   Checks whether the current row of one run goes before the current row of another.
+ *
+ * Rows with equal paths are taken from the earlier run, so the merge keeps the order of the document.
+ *
+ * @param readers  A pointer to the array of the SortRunReader structures.
+ * @param a        The index of the first run.
+ * @param b        The index of the second run.
+ * @return  Returns 1 if the row of the first run goes first, otherwise 0.
+ */
+int runRowPrecedes(const SortRunReader *readers, int a, int b)
+{
+    const SortHeader *x = &readers[a].header;
+    const SortHeader *y = &readers[b].header;
+    uint32_t len = x->keyLen < y->keyLen ? x->keyLen : y->keyLen;
+    int order = memcmp(readers[a].row.buffer + x->keyOffset, readers[b].row.buffer + y->keyOffset, len);
+    if (order == 0)
+    {
+        order = (x->keyLen > y->keyLen) - (x->keyLen < y->keyLen);
+    }
+    return order < 0 || (order == 0 && a < b);
+}
+
+/**
+ * @brief   Moves the run at the given position of the heap down until the heap is ordered again.
+ *
+ * @param readers  A pointer to the array of the SortRunReader structures.
+ * @param heap     A pointer to the heap of the run indices.
+ * @param n        The number of runs on the heap.
+ * @param i        The position of the run to be moved.
+ */
+void siftRunHeap(const SortRunReader *readers, int *heap, int n, int i)
+{
+    for (;;)
+    {
+        int first = i;
+        int left = 2 * i + 1;
+        if (left < n && runRowPrecedes(readers, heap[left], heap[first]))
+        {
+            first = left;
+        }
+        if (left + 1 < n && runRowPrecedes(readers, heap[left + 1], heap[first]))
+        {
+            first = left + 1;
+        }
+        if (first == i)
+        {
+            return;
+        }
+        int swap = heap[i];
+        heap[i] = heap[first];
+        heap[first] = swap;
+        i = first;
+    }
+}
+
+/**
+ * @brief   Writes one sorted row to a run, to the file of its partition or to the output arena.
+ *
+ * @param header      A pointer to the header of the row.
+ * @param row         A pointer to the formatted row.
+ * @param run         A pointer to the run the row is written to (NULL for the final output).
+ * @param arena       A pointer to the output arena (also counts the rows written to the partitions).
+ * @param writer      A pointer to the OutputWriter the arena is flushed with.
+ * @param partitions  A pointer to the partitioned output (NULL if the rows go to the arena).
+ * @return  Returns 0 on success, or -1 if writing failed.
+ */
+int emitSortedRow(const SortHeader *header, const char *row, FILE *run, OutputArena *arena, OutputWriter *writer,
+                  PartitionSet *partitions)
+{
+    if (run)
+    {
+        return writeRunRow(run, header, row);
+    }
+    arena->totalRows++;
+    if (partitions)
+    {
+        // The emitor name is quoted in the row, the partitions are named after the name itself
+        const char *emitor = row + header->keyOffset;
+        size_t emitorLen = header->emitorLen;
+        if (memchr(emitor, '"', emitorLen))
+        {
+            partitions->unquoted.len = 0;
+            char *name = reserveArena(&partitions->unquoted, emitorLen);
+            emitorLen = unquoteValue(name, emitor, emitorLen);
+            emitor = name;
+        }
+        PartitionHandle *handle = openPartition(partitions, emitor, emitorLen);
+        if (!handle)
+        {
+            return -1;
+        }
+        appendBytes(&handle->rows, row, header->rowLen);
+        return flushPartition(partitions, handle, 0);
+    }
+    appendBytes(arena, row, header->rowLen);
+    arena->nRows++;
+    return flushOutput(writer, arena, 0);
+}
+
+/**
+ * @brief   Merges the first runs of the sorter into a new run or into the final output.
+ *
+ * The runs are read through their stdio buffers and merged with a binary heap, then they
+ * are closed (and so removed) and taken off the list of runs.
+ *
+ * @param sorter      A pointer to the Sorter structure.
+ * @param count       The number of runs to be merged.
+ * @param run         A pointer to the run the rows are written to (NULL for the final output).
+ * @param arena       A pointer to the output arena.
+ * @param writer      A pointer to the OutputWriter the arena is flushed with.
+ * @param partitions  A pointer to the partitioned output (NULL if the rows go to the arena).
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int mergeRuns(Sorter *sorter, int count, FILE *run, OutputArena *arena, OutputWriter *writer, PartitionSet *partitions)
+{
+    SortRunReader *readers = alocateNewMemmory(NULL, count, sizeof(SortRunReader));
+    int *heap = alocateNewMemmory(NULL, count, sizeof(int));
+    int n = 0;
+    int result = 0;
+
+    memset(readers, 0, count * sizeof(SortRunReader));
+    for (int i = 0; i < count; i++)
+    {
+        readers[i].file = sorter->runs[i];
+        rewind(readers[i].file);
+        int read = readRunRow(&readers[i]);
+        if (read < 0)
+        {
+            result = -1;
+        }
+        else if (read > 0)
+        {
+            heap[n++] = i;
+        }
+    }
+    for (int i = n / 2 - 1; i >= 0; i--)
+    {
+        siftRunHeap(readers, heap, n, i);
+    }
+
+    while (n > 0 && result == 0)
+    {
+        SortRunReader *reader = &readers[heap[0]];
+        result = emitSortedRow(&reader->header, reader->row.buffer, run, arena, writer, partitions);
+        int read = readRunRow(reader);
+        if (read < 0)
+        {
+            result = -1;
+        }
+        else if (read == 0)
+        {
+            heap[0] = heap[--n];
+        }
+        siftRunHeap(readers, heap, n, 0);
+    }
+    if (result < 0)
+    {
+        fprintf(stderr, "Błąd podczas scalania posortowanych plików tymczasowych.\n");
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        fclose(readers[i].file);
+        free(readers[i].row.buffer);
+    }
+    sorter->nRuns -= count;
+    memmove(sorter->runs, sorter->runs + count, sorter->nRuns * sizeof(FILE *));
+    free(readers);
+    free(heap);
+    return result;
+}
+
+/**
+ * @brief   Writes all collected rows ordered by the path.
+ *
+ * If no run was spilled, the rows are sorted in memory. Otherwise the last run is spilled
+ * too, its memory is released, and the runs are merged: in passes of SORT_MERGE_WAYS runs
+ * into new runs while there are more of them, and then into the output.
+ *
+ * @param sorter      A pointer to the Sorter structure.
+ * @param arena       A pointer to the output arena.
+ * @param writer      A pointer to the OutputWriter the arena is flushed with.
+ * @param partitions  A pointer to the partitioned output (NULL if the rows go to the arena).
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int finishSorter(Sorter *sorter, OutputArena *arena, OutputWriter *writer, PartitionSet *partitions)
+{
+    if (sorter->nRuns == 0)
+    {
+        qsort_r(sorter->entries, sorter->nEntries, sizeof(SortEntry), compareSortEntries, sorter->rows.buffer);
+        for (int i = 0; i < sorter->nEntries; i++)
+        {
+            const SortEntry *entry = &sorter->entries[i];
+            if (emitSortedRow(&entry->header, sorter->rows.buffer + entry->offset, NULL, arena, writer, partitions) < 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    if (sorter->nEntries > 0 && spillRun(sorter) < 0)
+    {
+        return -1;
+    }
+    free(sorter->rows.buffer);
+    free(sorter->entries);
+    memset(&sorter->rows, 0, sizeof(sorter->rows));
+    sorter->entries = NULL;
+    sorter->allocatedEntries = 0;
+
+    while (sorter->nRuns > SORT_MERGE_WAYS)
+    {
+        FILE *run = createRun(sorter->tmpDir);
+        if (!run)
+        {
+            fprintf(stderr, "Nie można utworzyć pliku tymczasowego w katalogu %s.\n", sorter->tmpDir);
+            return -1;
+        }
+        if (mergeRuns(sorter, SORT_MERGE_WAYS, run, NULL, NULL, NULL) < 0 || fflush(run) != 0)
+        {
+            fclose(run);
+            return -1;
+        }
+        // The merged run takes the place of its parts, so the earlier rows still come first
+        memmove(sorter->runs + 1, sorter->runs, sorter->nRuns * sizeof(FILE *));
+        sorter->runs[0] = run;
+        sorter->nRuns++;
+    }
+    return mergeRuns(sorter, sorter->nRuns, NULL, arena, writer, partitions);
+}
+
+/**
+ * @brief   Writes the dictionary of the numeric path identifiers as a CSV file.
+ *
+ * @param dictionary  A pointer to the PathDictionary structure.
+ * @param filename    The name of the file.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int writePathDictionary(const PathDictionary *dictionary, const char *filename)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Nie można otworzyć pliku słownika ścieżek.\n");
+        return -1;
+    }
+
+    OutputArena arena;
+    memset(&arena, 0, sizeof(arena));
+    appendBytes(&arena, PATH_DICTIONARY_HEADER, sizeof(PATH_DICTIONARY_HEADER) - 1);
+    for (int i = 0; i < dictionary->nEntries; i++)
+    {
+        const char *path = dictionary->strings.buffer + dictionary->offsets[i];
+        uint32_t len = dictionary->offsets[i + 1] - dictionary->offsets[i];
+        char *str = reserveArena(&arena, quotedLength(path, len) + 16);
+        char *p = str + sprintf(str, "%d,\"", i);
+        p = copyQuotedValue(p, path, len);
+        memcpy(p, "\"\n", 2);
+        arena.len += p + 2 - str;
+    }
+
+    int result = writeAll(fd, arena.buffer, arena.len);
+    if (close(fd) != 0)
+    {
+        result = -1;
+    }
+    if (result < 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu słownika ścieżek.\n");
+    }
+    free(arena.buffer);
+    return result;
+}
+
+/**
+ * @brief   Initializes the DeltaState structure, reading the state file of the previous run.
+ *
+ * Every line of the state file holds the content hash of one emitor (16 hexadecimal digits),
+ * a space and the name of the emitor. A missing file means that every emitor has changed.
+ *
+ * @param delta     A pointer to the DeltaState structure to be initialized.
+ * @param filename  The name of the state file.
+ * @return  Returns 0 on success, or -1 if the file could not be read.
+ */
+int initDelta(DeltaState *delta, const char *filename)
+{
+    memset(delta, 0, sizeof(*delta));
+    initPathDictionary(&delta->previous);
+    initPathDictionary(&delta->current);
+
+    FILE *state = fopen(filename, "r");
+    if (!state)
+    {
+        if (errno == ENOENT)
+        {
+            return 0;
+        }
+        fprintf(stderr, "Nie można otworzyć pliku stanu.\n");
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t allocated = 0;
+    ssize_t len;
+    int result = 0;
+    while ((len = getline(&line, &allocated, state)) > 0)
+    {
+        char *end;
+        if (line[len - 1] == '\n')
+        {
+            line[--len] = '\0';
+        }
+        errno = 0;
+        uint64_t hash = strtoull(line, &end, 16);
+        if (end != line + 16 || *end != ' ' || errno != 0)
+        {
+            fprintf(stderr, "Niepoprawny wiersz pliku stanu: %s\n", line);
+            result = -1;
+            break;
+        }
+        int32_t index = lookupPath(&delta->previous, end + 1, line + len - (end + 1));
+        delta->previousHashes = relocateMemmory(delta->previousHashes, index, &delta->allocatedPrevious, DICTIONARY_INITIAL_SLOTS, sizeof(uint64_t));
+        delta->previousHashes[index] = hash;
+    }
+    free(line);
+    fclose(state);
+    return result;
+}
+
+/**
+ * @brief   Writes the content hashes of the emitors of the current document to the state file.
+ *
+ * The state is written to a temporary file renamed over the state file, so an interrupted
+ * run leaves the previous state in place.
+ *
+ * @param delta     A pointer to the DeltaState structure.
+ * @param filename  The name of the state file.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int saveDelta(const DeltaState *delta, const char *filename)
+{
+    size_t nameLen = strlen(filename);
+    char *temporary = alocateNewMemmory(NULL, nameLen + sizeof(".tmp"), sizeof(char));
+    memcpy(temporary, filename, nameLen);
+    memcpy(temporary + nameLen, ".tmp", sizeof(".tmp"));
+
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Nie można zapisać pliku stanu.\n");
+        free(temporary);
+        return -1;
+    }
+
+    const PathDictionary *current = &delta->current;
+    OutputArena arena;
+    memset(&arena, 0, sizeof(arena));
+    for (int i = 0; i < current->nEntries; i++)
+    {
+        uint32_t len = current->offsets[i + 1] - current->offsets[i];
+        char *p = reserveArena(&arena, len + 19);
+        int hashLen = sprintf(p, "%016llx ", (unsigned long long)delta->currentHashes[i]);
+        memcpy(p + hashLen, current->strings.buffer + current->offsets[i], len);
+        p[hashLen + len] = '\n';
+        arena.len += hashLen + len + 1;
+    }
+
+    int result = writeAll(fd, arena.buffer, arena.len);
+    if (close(fd) != 0 || (result == 0 && rename(temporary, filename) != 0))
+    {
+        result = -1;
+    }
+    if (result < 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu pliku stanu.\n");
+        unlink(temporary);
+    }
+    free(arena.buffer);
+    free(temporary);
+    return result;
+}
+
+/**
+ * @brief   Frees the memory of the DeltaState structure.
+ *
+ * @param delta  A pointer to the DeltaState structure.
+ */
+void freeDelta(DeltaState *delta)
+{
+    freePathDictionary(&delta->previous);
+    freePathDictionary(&delta->current);
+    free(delta->previousHashes);
+    free(delta->currentHashes);
+    free(delta->rows.buffer);
+}
+
+/**
+ * @brief   Reads from the descriptor until the buffer is full or the end of data is reached.
+ *
+ * @param fd      The descriptor to be read from.
+ * @param buffer  A pointer to the buffer.
+ * @param len     The size of the buffer.
+ * @return  The number of bytes read, or -1 on error.
+ */
+ssize_t readFull(int fd, void *buffer, size_t len)
+{
+    size_t total = 0;
+
+    while (total < len)
+    {
+        ssize_t bytesRead = read(fd, (char *)buffer + total, len - total);
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (bytesRead == 0)
+        {
+            break;
+        }
+        total += (size_t)bytesRead;
+    }
+    return (ssize_t)total;
+}
+
+/**
+ * @brief   Detects the codec of the input by its magic bytes.
+ *
+ * Regular files are inspected with pread(), so nothing is consumed. From pipes the magic
+ * bytes have to be read; they are returned in the prefix and must be handed on before
+ * the rest of the input.
+ *
+ * @param fd         The descriptor of the input.
+ * @param prefix     A buffer for CODEC_MAGIC_SIZE bytes, filled with the bytes consumed from the input.
+ * @param prefixLen  A pointer to the number of consumed bytes (0 for regular files).
+ * @return  CODEC_NONE, CODEC_GZIP or CODEC_ZSTD.
+ */
+int detectCodec(int fd, unsigned char *prefix, size_t *prefixLen)
+{
+    struct stat st;
+    ssize_t len;
+
+    *prefixLen = 0;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        len = pread(fd, prefix, CODEC_MAGIC_SIZE, 0);
+    }
+    else
+    {
+        len = readFull(fd, prefix, CODEC_MAGIC_SIZE);
+        *prefixLen = len > 0 ? (size_t)len : 0;
+    }
+
+    if (len >= 2 && prefix[0] == 0x1f && prefix[1] == 0x8b)
+    {
+        return CODEC_GZIP;
+    }
+    if (len >= 4 && prefix[0] == 0x28 && prefix[1] == 0xb5 && prefix[2] == 0x2f && prefix[3] == 0xfd)
+    {
+        return CODEC_ZSTD;
+    }
+    return CODEC_NONE;
+}
+
+/**
+ * @brief   Decompresses gzip data (one or more concatenated members) from inFd to outFd.
+ *
+ * @param stage  A pointer to the CodecStage structure.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int inflateGzip(CodecStage *stage)
+{
+    unsigned char *in = malloc(CODEC_BUFFER_SIZE);
+    unsigned char *out = malloc(CODEC_BUFFER_SIZE);
+    z_stream zs;
+    int result = -1;
+    int finished = 0;
+
+    memset(&zs, 0, sizeof(zs));
+    if (!in || !out || inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+    {
+        free(in);
+        free(out);
+        return -1;
+    }
+
+    memcpy(in, stage->prefix, stage->prefixLen);
+    ssize_t len = (ssize_t)stage->prefixLen;
+    for (;;)
+    {
+        if (len == 0)
+        {
+            len = readFull(stage->inFd, in, CODEC_BUFFER_SIZE);
+            if (len <= 0)
+            {
+                result = len == 0 && finished ? 0 : -1;
+                break;
+            }
+        }
+
+        zs.next_in = in;
+        zs.avail_in = (uInt)len;
+        int status = Z_OK;
+        do
+        {
+            // Another member follows the finished one
+            if (finished && zs.avail_in > 0)
+            {
+                inflateReset(&zs);
+                finished = 0;
+            }
+            zs.next_out = out;
+            zs.avail_out = CODEC_BUFFER_SIZE;
+            status = inflate(&zs, Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+            {
+                status = Z_STREAM_ERROR;
+            }
+            if (writeAll(stage->outFd, (char *)out, CODEC_BUFFER_SIZE - zs.avail_out) < 0)
+            {
+                status = Z_STREAM_ERROR;
+            }
+            finished = status == Z_STREAM_END;
+        } while ((zs.avail_in > 0 || zs.avail_out == 0) && status != Z_STREAM_ERROR);
+        if (status == Z_STREAM_ERROR)
+        {
+            break;
+        }
+        len = 0;
+    }
+
+    inflateEnd(&zs);
+    free(in);
+    free(out);
+    return result;
+}
+
+/**
+ * @brief   Compresses the data read from inFd into gzip format written to outFd.
+ *
+ * @param stage  A pointer to the CodecStage structure.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int deflateGzip(CodecStage *stage)
+{
+    unsigned char *in = malloc(CODEC_BUFFER_SIZE);
+    unsigned char *out = malloc(CODEC_BUFFER_SIZE);
+    z_stream zs;
+    int result = 0;
+
+    memset(&zs, 0, sizeof(zs));
+    if (!in || !out || deflateInit2(&zs, stage->level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        free(in);
+        free(out);
+        return -1;
+    }
+
+    int flush = Z_NO_FLUSH;
+    while (flush != Z_FINISH && result == 0)
+    {
+        ssize_t len = readFull(stage->inFd, in, CODEC_BUFFER_SIZE);
+        if (len < 0)
+        {
+            result = -1;
+            break;
+        }
+        flush = len == 0 ? Z_FINISH : Z_NO_FLUSH;
+        zs.next_in = in;
+        zs.avail_in = (uInt)len;
+        do
+        {
+            zs.next_out = out;
+            zs.avail_out = CODEC_BUFFER_SIZE;
+            deflate(&zs, flush);
+            if (writeAll(stage->outFd, (char *)out, CODEC_BUFFER_SIZE - zs.avail_out) < 0)
+            {
+                result = -1;
+                break;
+            }
+        } while (zs.avail_out == 0);
+    }
+
+    deflateEnd(&zs);
+    free(in);
+    free(out);
+    return result;
+}
+
+#ifdef EMITOR_WITH_ZSTD
+/**
+ * @brief   Decompresses zstd data (one or more concatenated frames) from inFd to outFd.
+ *
+ * @param stage  A pointer to the CodecStage structure.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int decompressZstd(CodecStage *stage)
+{
+    size_t inSize = ZSTD_DStreamInSize();
+    size_t outSize = ZSTD_DStreamOutSize();
+    char *in = malloc(inSize > CODEC_MAGIC_SIZE ? inSize : CODEC_MAGIC_SIZE);
+    char *out = malloc(outSize);
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    int result = -1;
+    size_t pending = 0;
+
+    if (!in || !out || !dctx)
+    {
+        free(in);
+        free(out);
+        ZSTD_freeDCtx(dctx);
+        return -1;
+    }
+
+    memcpy(in, stage->prefix, stage->prefixLen);
+    ssize_t len = (ssize_t)stage->prefixLen;
+    for (;;)
+    {
+        if (len == 0)
+        {
+            len = readFull(stage->inFd, in, inSize);
+            if (len <= 0)
+            {
+                // pending is 0 only at the end of a frame
+                result = len == 0 && pending == 0 ? 0 : -1;
+                break;
+            }
+        }
+
+        ZSTD_inBuffer input = {in, (size_t)len, 0};
+        while (input.pos < input.size)
+        {
+            ZSTD_outBuffer output = {out, outSize, 0};
+            pending = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(pending) || writeAll(stage->outFd, out, output.pos) < 0)
+            {
+                break;
+            }
+        }
+        if (input.pos < input.size)
+        {
+            break;
+        }
+        len = 0;
+    }
+
+    ZSTD_freeDCtx(dctx);
+    free(in);
+    free(out);
+    return result;
+}
+
+/**
+ * @brief   Compresses the data read from inFd into zstd format written to outFd.
+ *
+ * @param stage  A pointer to the CodecStage structure.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int compressZstd(CodecStage *stage)
+{
+    size_t inSize = ZSTD_CStreamInSize();
+    size_t outSize = ZSTD_CStreamOutSize();
+    char *in = malloc(inSize);
+    char *out = malloc(outSize);
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    int result = 0;
+
+    if (!in || !out || !cctx || ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, stage->level)))
+    {
+        free(in);
+        free(out);
+        ZSTD_freeCCtx(cctx);
+        return -1;
+    }
+
+    ZSTD_EndDirective mode = ZSTD_e_continue;
+    while (mode != ZSTD_e_end && result == 0)
+    {
+        ssize_t len = readFull(stage->inFd, in, inSize);
+        if (len < 0)
+        {
+            result = -1;
+            break;
+        }
+        mode = len == 0 ? ZSTD_e_end : ZSTD_e_continue;
+
+        ZSTD_inBuffer input = {in, (size_t)len, 0};
+        size_t remaining;
+        do
+        {
+            ZSTD_outBuffer output = {out, outSize, 0};
+            remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(remaining) || writeAll(stage->outFd, out, output.pos) < 0)
+            {
+                result = -1;
+                break;
+            }
+        } while (mode == ZSTD_e_end ? remaining != 0 : input.pos < input.size);
+    }
+
+    ZSTD_freeCCtx(cctx);
+    free(in);
+    free(out);
+    return result;
+}
+#endif
+
+/**
+ * @brief   The thread of a codec stage, (de)compressing the data until the end of its input.
+ *
+ * The stage closes its pipe end when finished, so the other side of the pipe sees the end
+ * of data (or EPIPE, if the stage failed).
+ *
+ * @param arg  A pointer to the CodecStage structure.
+ * @return  Always NULL.
+ */
+void *codecThread(void *arg)
+{
+    CodecStage *stage = (CodecStage *)arg;
+
+    stage->result = -1;
+    switch (stage->codec)
+    {
+    case CODEC_GZIP:
+        stage->result = stage->compress ? deflateGzip(stage) : inflateGzip(stage);
+        break;
+#ifdef EMITOR_WITH_ZSTD
+    case CODEC_ZSTD:
+        stage->result = stage->compress ? compressZstd(stage) : decompressZstd(stage);
+        break;
+#endif
+    }
+
+    close(stage->compress ? stage->inFd : stage->outFd);
+    return NULL;
+}
+
+/**
+ * @brief   Starts a codec stage between the given descriptor and a new pipe.
+ *
+ * A decompressing stage reads the given input and the descriptor is replaced with the
+ * reading end of the pipe. A compressing stage writes to the given output and the
+ * descriptor is replaced with the writing end of the pipe.
+ *
+ * @param stage  A pointer to the CodecStage structure with the codec, direction, level and prefix set.
+ * @param fd     A pointer to the descriptor to be replaced.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int startCodecStage(CodecStage *stage, int *fd)
+{
+    int pipeFds[2];
+
+#ifndef EMITOR_WITH_ZSTD
+    if (stage->codec == CODEC_ZSTD)
+    {
+        fprintf(stderr, "Program skompilowano bez obsługi zstd (-DEMITOR_WITH_ZSTD -lzstd).\n");
+        return -1;
+    }
+#endif
+    if (pipe(pipeFds) < 0)
+    {
+        perror("Nie można utworzyć potoku");
+        return -1;
+    }
+    // Larger pipes mean fewer switches between the threads (best effort)
+    fcntl(pipeFds[1], F_SETPIPE_SZ, CODEC_BUFFER_SIZE * 4);
+    // Failures of the other side are reported as EPIPE instead of a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    if (stage->compress)
+    {
+        stage->inFd = pipeFds[0];
+        stage->outFd = *fd;
+        *fd = pipeFds[1];
+    }
+    else
+    {
+        stage->inFd = *fd;
+        stage->outFd = pipeFds[1];
+        *fd = pipeFds[0];
+    }
+
+    if (pthread_create(&stage->thread, NULL, codecThread, stage) != 0)
+    {
+        fprintf(stderr, "Nie można uruchomić wątku kompresji.\n");
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        *fd = stage->compress ? stage->outFd : stage->inFd;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief   Waits for the codec stage to finish.
+ *
+ * The caller must close its own end of the pipe first. A stage whose other side stopped
+ * early fails with EPIPE, so the caller decides whether the failure is worth reporting.
+ *
+ * @param stage  A pointer to the CodecStage structure.
+ * @return  Returns 0 on success, or -1 if the data could not be (de)compressed.
+ */
+int finishCodecStage(CodecStage *stage)
+{
+    pthread_join(stage->thread, NULL);
+    return stage->result;
+}
+
+/**
+ * @brief   Starts the compressing stage of the output if --compress was given.
+ *
+ * @param stage    A pointer to the CodecStage structure to be initialized.
+ * @param fd       A pointer to the output descriptor, replaced with the pipe of the stage.
+ * @param options  A pointer to the command line options.
+ * @return  Returns 0 on success (also when the output is not compressed), or -1 on error.
+ */
+int startOutputCompression(CodecStage *stage, int *fd, const Options *options)
+{
+    memset(stage, 0, sizeof(*stage));
+    stage->codec = options->compressCodec;
+    stage->compress = TRUE_ARG;
+    stage->level = options->compressLevel;
+    return stage->codec == CODEC_NONE ? 0 : startCodecStage(stage, fd);
+}
+
+/**
+ * @brief   Closes the pipe of the compressing stage of the output and waits for the stage.
+ *
+ * @param stage  A pointer to the CodecStage structure.
+ * @param fd     The writing end of the pipe returned by startOutputCompression().
+ * @return  Returns 0 on success (also when the output is not compressed), or -1 on error.
+ */
+int finishOutputCompression(CodecStage *stage, int fd)
+{
+    if (stage->codec == CODEC_NONE)
+    {
+        return 0;
+    }
+    int result = close(fd) == 0 ? 0 : -1;
+    if (finishCodecStage(stage) < 0)
+    {
+        fprintf(stderr, "Błąd kompresji pliku wynikowego.\n");
+        result = -1;
+    }
+    return result;
+}
+
+/**
+ * @brief   Prints the statistics of the run (verbose mode only).
+ *
+ * @param context  A pointer to the ParserContext struct containing the output arena.
+ * @param writer   A pointer to the OutputWriter the arena was written with.
+ */
+void printStatistics(const ParserContext *context, const OutputWriter *writer)
+{
+    const OutputArena *arena = &context->output;
+
+    fprintf(stderr, "Zapisane wiersze: %zu\n", arena->totalRows);
+    fprintf(stderr, "Szczytowe zużycie bufora wyjściowego: %zu B (zaalokowane: %zu B)\n", arena->peak, arena->allocated);
+    fprintf(stderr, "Zapisane dane: %zu B w %zu wywołaniach write()\n", writer->bytesWritten, writer->writes);
+    for (int i = 1; i < writer->nSinks; i++)
+    {
+        const OutputSink *sink = &writer->sinks[i];
+        fprintf(stderr, "Wyjście %s: %zu B w %zu wywołaniach write(), oczekiwania na pełną kolejkę: %zu\n",
+                sink->name, sink->bytesWritten, sink->writes, sink->stalls);
+    }
+    fprintf(stderr, "Wczytane dane: %zu B w %zu blokach\n", context->input.bytes, context->input.blocks);
+    fprintf(stderr, "Czas oczekiwania na dane: %.3f s, czas parsowania: %.3f s, czas odczytu: %.3f s\n",
+            context->input.waitSeconds, context->input.parseSeconds, context->input.readSeconds);
+    if (context->data->paths)
+    {
+        fprintf(stderr, "Różne ścieżki w słowniku: %d\n", context->data->paths->nEntries);
+    }
+    if (context->delta)
+    {
+        const DeltaState *delta = context->delta;
+        const PathDictionary *previous = &delta->previous;
+        int removed = 0;
+        for (int i = 0; i < previous->nEntries; i++)
+        {
+            uint32_t start = previous->offsets[i];
+            size_t slot = findPathSlot(&delta->current, previous->strings.buffer + start, previous->offsets[i + 1] - start);
+            removed += delta->current.slots[slot] == 0;
+        }
+        fprintf(stderr, "Emitory zmienione: %zu, niezmienione: %zu, usunięte: %d\n", delta->changed, delta->unchanged, removed);
+    }
+}
+
+/**
+ * @brief   Warns about the rows skipped because their path or value exceeded the --max-field limit.
+ */
+void printSkippedRows(void)
+{
+    if (fieldLimits.skippedRows > 0)
+    {
+        fprintf(stderr, "Pominięte wiersze z polem dłuższym niż %zu B: %zu\n", fieldLimits.maxLength, fieldLimits.skippedRows);
+    }
+}
+
+/**
+ * @brief   Prints the description of the last parser error.
+ *
+ * Errors detected by the callbacks (which stopped the parser) take precedence over
+ * the error reported by Expat.
+ *
+ * @param parser   The Expat parser that reported the error.
+ * @param context  A pointer to the ParserContext struct filled by the callbacks.
+ */
+void printParseError(XML_Parser parser, const ParserContext *context)
+{
+    if (context->error == CONTEXT_TAG_DEPTH)
+    {
+        fprintf(stderr, "Błąd: przekroczono maksymalną głębokość zagnieżdżenia znaczników (%d) at line %ld\n",
+                MAX_TAG_DEPTH, XML_GetCurrentLineNumber(parser));
+        return;
+    }
+    if (context->error == CONTEXT_OUTPUT)
+    {
+        fprintf(stderr, "Błąd: konwersja przerwana po błędzie zapisu at line %ld\n", XML_GetCurrentLineNumber(parser));
+        return;
+    }
+    fprintf(stderr, "Błąd: %s at line %ld\n", XML_ErrorString(XML_GetErrorCode(parser)), XML_GetCurrentLineNumber(parser));
+}
+
+/**
+ * @brief   Returns the time elapsed since the given moment, in seconds.
+ *
+ * @param start  A pointer to the moment read from CLOCK_MONOTONIC.
+ * @return  The number of seconds elapsed.
+ */
+double secondsSince(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief   Returns the number of ticks of the stage timers per second.
+ *
+ * The time stamp counter is calibrated against CLOCK_MONOTONIC over a short pause.
+ *
+ * @return  The number of ticks per second (0 if the timers are not compiled in).
+ */
+double ticksPerSecond(void)
+{
+#if defined(EMITOR_STATS) && (defined(__x86_64__) || defined(__i386__))
+    struct timespec start;
+    struct timespec pause = {0, 20 * 1000 * 1000};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t ticks = readTicks();
+    nanosleep(&pause, NULL);
+    return (readTicks() - ticks) / secondsSince(&start);
+#elif defined(EMITOR_STATS)
+    return 1e9;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief   Prints the --stats report: the bytes read and written, the rows, the allocations,
+ *          the time spent on the input and, in builds with -DEMITOR_STATS, the calls and
+ *          the time of every stage (STAGE_*).
+ *
+ * The JSON form is one object (the stages are null if the timers are not compiled in).
+ * The stage times overlap: startElement() includes the rows it saves.
+ *
+ * @param context  A pointer to the ParserContext struct of the conversion.
+ * @param writer   A pointer to the OutputWriter the rows were written with.
+ * @param options  A pointer to the command line options.
+ */
+void printStatsReport(const ParserContext *context, const OutputWriter *writer, const Options *options)
+{
+    StageStats stages = *context->stages;
+    double ticks = ticksPerSecond();
+
+    stages.calls[STAGE_WRITE] = writer->stages ? writer->stages->calls[STAGE_WRITE] : 0;
+    stages.ticks[STAGE_WRITE] = writer->stages ? writer->stages->ticks[STAGE_WRITE] : 0;
+    if (options->stats == STATS_TEXT)
+    {
+        if (!options->verbose)
+        {
+            printStatistics(context, writer);
+        }
+        fprintf(stderr, "Alokacje: %zu wywołań, %zu B\n", allocationStats.calls, allocationStats.bytes);
+        if (context->pool)
+        {
+            fprintf(stderr, "Pula parsera XML: %zu wywołań, %zu B, bloki systemowe: %zu (%zu B), zwolnienia puli: %zu\n",
+                    context->pool->calls, context->pool->bytes, context->pool->chunkCalls, context->pool->chunkBytes,
+                    context->pool->resets);
+        }
+        if (ticks == 0)
+        {
+            fprintf(stderr, "Czasy etapów są dostępne po kompilacji z -DEMITOR_STATS.\n");
+            return;
+        }
+        for (int i = 0; i < STAGE_COUNT; i++)
+        {
+            fprintf(stderr, "Etap %s: %llu wywołań, %.3f s (%.1f ns na wywołanie)\n", stageNames[i],
+                    (unsigned long long)stages.calls[i], stages.ticks[i] / ticks,
+                    stages.calls[i] ? stages.ticks[i] / ticks * 1e9 / stages.calls[i] : 0.0);
+        }
+        return;
+    }
+
+    fprintf(stderr, "{\n");
+    fprintf(stderr, "  \"input\": {\"bytes\": %zu, \"blocks\": %zu, \"block_size\": %zu},\n",
+            context->input.bytes, context->input.blocks, options->blockSize);
+    fprintf(stderr, "  \"output\": {\"bytes\": %zu, \"writes\": %zu, \"rows\": %zu, \"peak_output_buffer\": %zu},\n",
+            writer->bytesWritten, writer->writes, context->output.totalRows, context->output.peak);
+    fprintf(stderr, "  \"allocations\": {\"calls\": %zu, \"bytes\": %zu},\n", allocationStats.calls, allocationStats.bytes);
+    if (context->pool)
+    {
+        fprintf(stderr, "  \"parser_pool\": {\"calls\": %zu, \"bytes\": %zu, \"chunks\": %zu, \"chunk_bytes\": %zu, \"resets\": %zu},\n",
+                context->pool->calls, context->pool->bytes, context->pool->chunkCalls, context->pool->chunkBytes,
+                context->pool->resets);
+    }
+    fprintf(stderr, "  \"seconds\": {\"wait\": %.6f, \"parse\": %.6f, \"read\": %.6f},\n",
+            context->input.waitSeconds, context->input.parseSeconds, context->input.readSeconds);
+    if (ticks == 0)
+    {
+        fprintf(stderr, "  \"elements\": null,\n  \"stages\": null\n}\n");
+        return;
+    }
+    fprintf(stderr, "  \"elements\": %llu,\n  \"stages\": {", (unsigned long long)stages.calls[STAGE_START_ELEMENT]);
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        fprintf(stderr, "%s\"%s\": {\"calls\": %llu, \"seconds\": %.6f}", i ? ", " : "", stageNames[i],
+                (unsigned long long)stages.calls[i], stages.ticks[i] / ticks);
+    }
+    fprintf(stderr, "}\n}\n");
+}
+
+/**
+ * @brief   Parses the rest of the document held in memory, in blocks of the configured size.
+ *
+ * The last block is marked as final. The rows are flushed after every block once the
+ * output buffer is full, or unconditionally in streaming mode. With read-ahead enabled the
+ * kernel is asked to fetch the following blocks of a mapped file while the current one is parsed.
+ *
+ * @param parser      The Expat parser.
+ * @param context     A pointer to the ParserContext struct filled by the callbacks.
+ * @param buffer      A pointer to the document (or its remaining part).
+ * @param size        The number of bytes to be parsed.
+ * @param options     A pointer to the command line options.
+ * @param writer      A pointer to the OutputWriter the entries are written with.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int parseBuffer(XML_Parser parser, ParserContext *context, const char *buffer, size_t size, const Options *options, OutputWriter *writer)
+{
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+
+    for (size_t offset = 0; offset < size; offset += options->blockSize)
+    {
+        size_t len = size - offset < options->blockSize ? size - offset : options->blockSize;
+        int isFinal = offset + len == size;
+
+        if (options->readAhead && !isFinal)
+        {
+            size_t ahead = offset + len;
+            size_t aheadLen = options->blockSize * options->readAhead;
+            uintptr_t start = (uintptr_t)(buffer + ahead) & ~(uintptr_t)(pageSize - 1);
+            if (aheadLen > size - ahead)
+            {
+                aheadLen = size - ahead;
+            }
+            madvise((void *)start, (uintptr_t)(buffer + ahead + aheadLen) - start, MADV_WILLNEED);
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        enum XML_Status status = XML_Parse(parser, buffer + offset, (int)len, isFinal);
+        context->input.parseSeconds += secondsSince(&start);
+        context->input.blocks++;
+        context->input.bytes += len;
+        if (status == XML_STATUS_ERROR)
+        {
+            printParseError(parser, context);
+            return -1;
+        }
+        if (flushOutput(writer, &context->output, options->stream) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief   Skips the XML whitespace at the beginning of a range.
+ *
+ * @param p    The beginning of the range.
+ * @param end  The end of the range.
+ * @return  A pointer to the first other character, or end.
+ */
+const char *skipSpaces(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * @brief   Checks whether there is a byte that the fast scanner cannot pass on unchanged.
+ *
+ * Entity and character references need decoding, carriage returns in text are turned into
+ * line feeds, and attribute values with whitespace other than spaces are normalized by Expat.
+ *
+ * @param str        A pointer to the bytes.
+ * @param len        The number of bytes.
+ * @param attribute  Non-zero for an attribute value.
+ * @return  Non-zero if the bytes need Expat.
+ */
+int needsExpat(const char *str, size_t len, int attribute)
+{
+    if (memchr(str, '&', len) || memchr(str, attribute ? '<' : '\r', len))
+    {
+        return 1;
+    }
+    for (size_t i = 0; attribute && i < len; i++)
+    {
+        if (str[i] == '\t' || str[i] == '\n' || str[i] == '\r')
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief   Returns whether the XML declaration allows the fast scanner (no encoding other than UTF-8).
+ *
+ * @param start  A pointer to the declaration (after "<?").
+ * @param end    A pointer to the "?>" ending it.
+ * @return  Non-zero if the document is UTF-8.
+ */
+int isUtf8Declaration(const char *start, const char *end)
+{
+    const char *encoding = memmem(start, end - start, "encoding", 8);
+    if (!encoding)
+    {
+        return 1;
+    }
+    const char *quote = encoding + 8;
+    while (quote < end && *quote != '"' && *quote != '\'')
+    {
+        quote++;
+    }
+    return end - quote > 6 && (strncasecmp(quote + 1, "utf-8", 5) == 0 || strncasecmp(quote + 1, "utf8", 4) == 0) &&
+           quote[quote[4] == '8' ? 5 : 6] == *quote;
+}
+
+/**
+ * @brief   Parses a mapped document with the fast scanner, calling the Expat callbacks directly.
+ *
+ * The scanner supports the subset of XML written by the telemetry exporter: UTF-8, elements with
+ * quoted attributes, comments, processing instructions and text without references. The next
+ * '<' and the closing quotes are found with memchr(), which scans with the SIMD instructions of
+ * the processor. The names of the element and its attributes are copied into a scratch buffer
+ * (they must be terminated for the callbacks), and the end tags are checked against the open
+ * elements. Anything else (references, carriage returns in text, CDATA, DOCTYPE, other encodings,
+ * non-ASCII or invalid names, duplicate attributes, errors) makes the function return FAST_FALLBACK,
+ * and the document is parsed again by Expat.
+ *
+ * @param context     A pointer to the ParserContext struct filled by the callbacks.
+ * @param buffer      A pointer to the document.
+ * @param size        The size of the document.
+ * @param options     A pointer to the command line options.
+ * @param writer      A pointer to the OutputWriter the entries are written with.
+ * @return  Returns 0 on success, FAST_FALLBACK if Expat is needed, or -1 on write error.
+ */
+int parseFast(ParserContext *context, const char *buffer, size_t size, const Options *options, OutputWriter *writer)
+{
+    const char *p = buffer;
+    const char *end = buffer + size;
+    const char *flushed = buffer;
+    OutputArena scratch;
+    const char **attr = NULL;
+    int allocatedAttr = 0;
+    size_t *offsets = NULL;
+    int allocatedOffsets = 0;
+    TagSlice *open = NULL;
+    int allocatedOpen = 0;
+    int depth = 0;
+    int roots = 0;
+    int result = FAST_FALLBACK;
+    struct timespec start;
+
+    memset(&scratch, 0, sizeof(scratch));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;)
+    {
+        const char *lt = memchr(p, '<', end - p);
+        const char *textEnd = lt ? lt : end;
+        if (context->textDepth)
+        {
+            if (needsExpat(p, textEnd - p, 0))
+            {
+                break;
+            }
+            characterData(context, p, (int)(textEnd - p));
+        }
+        else if (depth == 0 && skipSpaces(p, textEnd) < textEnd)
+        {
+            break;
+        }
+        if (!lt)
+        {
+            result = depth == 0 && roots == 1 ? 0 : FAST_FALLBACK;
+            break;
+        }
+
+        p = lt + 1;
+        if (p < end && (*p == '?' || *p == '!'))
+        {
+            const char *close = *p == '?' ? memmem(p, end - p, "?>", 2) : NULL;
+            if (*p == '!')
+            {
+                close = end - p > 3 && p[1] == '-' && p[2] == '-' ? memmem(p + 3, end - p - 3, "-->", 3) : NULL;
+            }
+            if (!close || (*p == '?' && close - p >= 4 && strncmp(p, "?xml", 4) == 0 && !isUtf8Declaration(p, close)))
+            {
+                break;
+            }
+            p = close + (*p == '?' ? 2 : 3);
+            continue;
+        }
+
+        int isEnd = p < end && *p == '/';
+        const char *name = p + isEnd;
+        const char *nameEnd = name;
+        while (nameEnd < end && nameChars[(unsigned char)*nameEnd])
+        {
+            nameEnd++;
+        }
+        size_t nameLen = nameEnd - name;
+        if (nameLen == 0 || nameEnd == end || !(nameChars[(unsigned char)*name] & NAME_START))
+        {
+            break;
+        }
+        scratch.len = 0;
+        appendBytes(&scratch, name, nameLen);
+        appendBytes(&scratch, "", 1);
+
+        if (isEnd)
+        {
+            p = skipSpaces(nameEnd, end);
+            if (p >= end || *p != '>' || depth == 0 || open[depth - 1].length != nameLen ||
+                memcmp(buffer + open[depth - 1].offset, name, nameLen) != 0)
+            {
+                break;
+            }
+            p++;
+            depth--;
+            endElement(context, scratch.buffer);
+        }
+        else
+        {
+            // The attributes are collected as offsets, the scratch buffer may move while it grows
+            int nAttr = 0;
+            int empty = 0;
+            p = nameEnd;
+            for (;;)
+            {
+                p = skipSpaces(p, end);
+                if (p >= end || *p == '>' || (*p == '/' && p + 1 < end && p[1] == '>'))
+                {
+                    break;
+                }
+                const char *attrName = p;
+                while (p < end && nameChars[(unsigned char)*p])
+                {
+                    p++;
+                }
+                size_t attrNameLen = p - attrName;
+                p = skipSpaces(p, end);
+                if (attrNameLen == 0 || !(nameChars[(unsigned char)*attrName] & NAME_START) || p >= end || *p != '=')
+                {
+                    p = end;
+                    break;
+                }
+                p = skipSpaces(p + 1, end);
+                const char *quote = p < end && (*p == '"' || *p == '\'') ? memchr(p + 1, *p, end - p - 1) : NULL;
+                if (!quote || needsExpat(p + 1, quote - p - 1, 1))
+                {
+                    p = end;
+                    break;
+                }
+                // Duplicate attributes are an error reported by Expat
+                int duplicate = 0;
+                for (int i = 0; i < nAttr && !duplicate; i += 2)
+                {
+                    duplicate = strncmp(scratch.buffer + offsets[i], attrName, attrNameLen) == 0 &&
+                                scratch.buffer[offsets[i] + attrNameLen] == '\0';
+                }
+                if (duplicate)
+                {
+                    p = end;
+                    break;
+                }
+                offsets = relocateMemmory(offsets, nAttr + 2, &allocatedOffsets, FAST_INITIAL_ATTRIBUTES, sizeof(size_t));
+                offsets[nAttr++] = appendBytes(&scratch, attrName, attrNameLen);
+                appendBytes(&scratch, "", 1);
+                offsets[nAttr++] = appendBytes(&scratch, p + 1, quote - p - 1);
+                appendBytes(&scratch, "", 1);
+                p = quote + 1;
+                // The attributes must be separated by whitespace
+                if (p < end && *p != '>' && *p != '/' && skipSpaces(p, end) == p)
+                {
+                    p = end;
+                    break;
+                }
+            }
+            if (p >= end)
+            {
+                break;
+            }
+            empty = *p == '/';
+            p += empty ? 2 : 1;
+
+            attr = relocateMemmory(attr, nAttr, &allocatedAttr, FAST_INITIAL_ATTRIBUTES, sizeof(const char *));
+            for (int i = 0; i < nAttr; i++)
+            {
+                attr[i] = scratch.buffer + offsets[i];
+            }
+            attr[nAttr] = NULL;
+            roots += depth == 0;
+            startElement(context, scratch.buffer, attr);
+            if (empty)
+            {
+                endElement(context, scratch.buffer);
+            }
+            else
+            {
+                open = relocateMemmory(open, depth, &allocatedOpen, MATCH_INITIAL_DEPTH, sizeof(TagSlice));
+                open[depth].offset = name - buffer;
+                open[depth].length = nameLen;
+                depth++;
+            }
+        }
+        if (context->error != CONTEXT_OK)
+        {
+            // The errors of the document are reported by Expat, the rows written so far cannot be taken back
+            result = context->error == CONTEXT_OUTPUT ? -1 : FAST_FALLBACK;
+            break;
+        }
+
+        // The rows are flushed at the same points as after the blocks handed to Expat
+        if ((size_t)(p - flushed) >= options->blockSize)
+        {
+            context->input.parseSeconds += secondsSince(&start);
+            context->input.blocks++;
+            context->input.bytes += p - flushed;
+            flushed = p;
+            if (flushOutput(writer, &context->output, options->stream) < 0)
+            {
+                result = -1;
+                break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        }
+    }
+
+    if (result == 0)
+    {
+        context->input.parseSeconds += secondsSince(&start);
+        context->input.blocks++;
+        context->input.bytes += end - flushed;
+        result = flushOutput(writer, &context->output, options->stream);
+    }
+    else if (result == FAST_FALLBACK && options->verbose)
+    {
+        fprintf(stderr, "Silnik fast: nieobsługiwana konstrukcja w bajcie %zu, parsowanie przez Expat.\n", (size_t)(p - buffer));
+    }
+    free(scratch.buffer);
+    free(attr);
+    free(offsets);
+    free(open);
+    return result;
+}
+
+/**
+ * @brief   Restores the state of the callbacks after the fast scanner fell back to Expat.
+ *
+ * The rows the scanner has already saved stay in the output, the callbacks skip them.
+ *
+ * @param context  A pointer to the ParserContext struct.
+ */
+void resetAfterFallback(ParserContext *context)
+{
+    Data *data = context->data;
+
+    data->emitorLen = 0;
+    data->nTags = 0;
+    data->pathLen = 0;
+    context->error = CONTEXT_OK;
+    context->depth = 0;
+    context->unnamedEmitors = 0;
+    context->textDepth = 0;
+    context->skipRows = context->rowsSeen;
+    context->rowsSeen = 0;
+    XML_SetCharacterDataHandler(context->parser, NULL);
+}
+
+/**
+ * @brief   Parses the input file by mapping it into memory.
+ *
+ * The mapped file is handed to parseBuffer() (or first to the fast scanner with --engine=fast),
+ * the kernel is advised that the pages will be read sequentially.
+ *
+ * @param parser      The Expat parser.
+ * @param context     A pointer to the ParserContext struct filled by the callbacks.
+ * @param fd          The descriptor of the input file (must be a regular, non-empty file).
+ * @param fileSize    The size of the input file in bytes.
+ * @param options     A pointer to the command line options.
+ * @param writer      A pointer to the OutputWriter the entries are written with.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int parseMapped(XML_Parser parser, ParserContext *context, int fd, size_t fileSize, const Options *options, OutputWriter *writer)
+{
+    char *map = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("Błąd mapowania pliku z danymi");
+        return -1;
+    }
+    madvise(map, fileSize, MADV_SEQUENTIAL);
+
+    int result = options->engine == ENGINE_FAST ? parseFast(context, map, fileSize, options, writer) : FAST_FALLBACK;
+    if (result == FAST_FALLBACK)
+    {
+        if (options->engine == ENGINE_FAST)
+        {
+            resetAfterFallback(context);
+        }
+        result = parseBuffer(parser, context, map, fileSize, options, writer);
+    }
+
+    munmap(map, fileSize);
+    return result;
+}
+
+/**
+ * @brief   Parses the input by reading it straight into the internal Expat buffer.
+ *
+ * Used for pipes, terminals and whenever mapping is not possible. Short reads are
+ * handled correctly: the document is finished only when read() reports the end of data.
+ * In streaming mode the rows of every block are written before the next block is read,
+ * so the memory used does not depend on the size of the input.
+ *
+ * @param parser      The Expat parser.
+ * @param context     A pointer to the ParserContext struct filled by the callbacks.
+ * @param fd          The descriptor of the input.
+ * @param options     A pointer to the command line options.
+ * @param writer      A pointer to the OutputWriter the entries are written with.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int parseRead(XML_Parser parser, ParserContext *context, int fd, const Options *options, OutputWriter *writer)
+{
+    for (;;)
+    {
+        void *buffer = XML_GetBuffer(parser, (int)options->blockSize);
+        if (!buffer)
+        {
+            printParseError(parser, context);
+            return -1;
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ssize_t bytesRead = read(fd, buffer, options->blockSize);
+        double readSeconds = secondsSince(&start);
+        context->input.waitSeconds += readSeconds;
+        context->input.readSeconds += readSeconds;
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Błąd odczytu pliku z danymi");
+            return -1;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        enum XML_Status status = XML_ParseBuffer(parser, (int)bytesRead, bytesRead == 0);
+        context->input.parseSeconds += secondsSince(&start);
+        context->input.blocks++;
+        context->input.bytes += (size_t)bytesRead;
+        if (status == XML_STATUS_ERROR)
+        {
+            printParseError(parser, context);
+            return -1;
+        }
+        if (flushOutput(writer, &context->output, options->stream) < 0)
+        {
+            return -1;
+        }
+        if (bytesRead == 0)
+        {
+            return 0;
+        }
+    }
+}
+
+/**
+ * @brief   Waits a moment for the other side of the read-ahead ring.
+ *
+ * The ring is checked busily at first, then the processor is yielded, and finally the
+ * thread sleeps shortly, so a slow input does not keep the processor busy.
+ *
+ * @param spins  A pointer to the number of checks made so far.
+ */
+void waitForRing(unsigned *spins)
+{
+    if (++*spins < READ_AHEAD_SPINS)
+    {
+        return;
+    }
+    if (*spins < 2 * READ_AHEAD_SPINS)
+    {
+        sched_yield();
+        return;
+    }
+    const struct timespec pause = {0, 50 * 1000};
+    nanosleep(&pause, NULL);
+}
+
+/**
+ * @brief   The reading thread of the read-ahead ring, filling the free blocks until the end of data.
+ *
+ * @param arg  A pointer to the ReadAhead structure.
+ * @return  Always NULL.
+ */
+void *readAheadThread(void *arg)
+{
+    ReadAhead *ring = (ReadAhead *)arg;
+
+    for (size_t filled = 0;; filled++)
+    {
+        unsigned spins = 0;
+        while (filled - __atomic_load_n(&ring->released, __ATOMIC_ACQUIRE) == ring->nBlocks)
+        {
+            if (__atomic_load_n(&ring->stop, __ATOMIC_RELAXED))
+            {
+                return NULL;
+            }
+            waitForRing(&spins);
+        }
+
+        ReadBlock *block = &ring->blocks[filled % ring->nBlocks];
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do
+        {
+            block->len = read(ring->fd, block->buffer, ring->blockSize);
+        } while (block->len < 0 && errno == EINTR);
+        block->error = block->len < 0 ? errno : 0;
+        ring->readSeconds += secondsSince(&start);
+
+        __atomic_store_n(&ring->filled, filled + 1, __ATOMIC_RELEASE);
+        if (block->len <= 0)
+        {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * @brief   Parses the input read by a separate thread, which keeps the next blocks in flight.
+ *
+ * The blocks are handed over through a single-producer/single-consumer ring of
+ * readAhead + 1 blocks (the one being parsed and the ones read ahead of it).
+ *
+ * @param parser      The Expat parser.
+ * @param context     A pointer to the ParserContext struct filled by the callbacks.
+ * @param fd          The descriptor of the input.
+ * @param options     A pointer to the command line options.
+ * @param writer      A pointer to the OutputWriter the entries are written with.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int parseReadAhead(XML_Parser parser, ParserContext *context, int fd, const Options *options, OutputWriter *writer)
+{
+    ReadAhead ring;
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = fd;
+    ring.blockSize = options->blockSize;
+    ring.nBlocks = (size_t)options->readAhead + 1;
+    ring.blocks = alocateNewMemmory(NULL, (int)ring.nBlocks, sizeof(ReadBlock));
+    for (size_t i = 0; i < ring.nBlocks; i++)
+    {
+        ring.blocks[i].buffer = alocateNewMemmory(NULL, (int)ring.blockSize, sizeof(char));
+    }
+
+    int result = -1;
+    int started = pthread_create(&ring.thread, NULL, readAheadThread, &ring) == 0;
+    if (!started)
+    {
+        fprintf(stderr, "Nie można uruchomić wątku odczytu.\n");
+    }
+
+    for (size_t released = 0; started; released++)
+    {
+        struct timespec start;
+        unsigned spins = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (__atomic_load_n(&ring.filled, __ATOMIC_ACQUIRE) == released)
+        {
+            waitForRing(&spins);
+        }
+        context->input.waitSeconds += secondsSince(&start);
+
+        ReadBlock *block = &ring.blocks[released % ring.nBlocks];
+        if (block->len < 0)
+        {
+            errno = block->error;
+            perror("Błąd odczytu pliku z danymi");
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        enum XML_Status status = XML_Parse(parser, block->buffer, (int)block->len, block->len == 0);
+        context->input.parseSeconds += secondsSince(&start);
+        context->input.blocks++;
+        context->input.bytes += (size_t)block->len;
+        if (status == XML_STATUS_ERROR)
+        {
+            printParseError(parser, context);
+            break;
+        }
+        if (flushOutput(writer, &context->output, options->stream) < 0)
+        {
+            break;
+        }
+        if (block->len == 0)
+        {
+            result = 0;
+            break;
+        }
+        __atomic_store_n(&ring.released, released + 1, __ATOMIC_RELEASE);
+    }
+
+    if (started)
+    {
+        // The reading thread may be blocked in read() on a pipe which never ends
+        __atomic_store_n(&ring.stop, 1, __ATOMIC_RELAXED);
+        if (result < 0)
+        {
+            pthread_cancel(ring.thread);
+        }
+        pthread_join(ring.thread, NULL);
+        context->input.readSeconds += ring.readSeconds;
+    }
+    for (size_t i = 0; i < ring.nBlocks; i++)
+    {
+        free(ring.blocks[i].buffer);
+    }
+    free(ring.blocks);
+    return result;
+}
+
+/**
+ * @brief   Registers the callbacks and the parser context in the Expat parser of the converter.
+ *
+ * @param converter  A pointer to the Converter structure.
+ */
+void setParserHandlers(Converter *converter)
+{
+#ifdef EMITOR_STATS
+    XML_SetElementHandler(converter->parser, timedStartElement, timedEndElement);
+#else
+    XML_SetElementHandler(converter->parser, startElement, endElement);
+#endif
+    XML_SetUserData(converter->parser, &converter->context);
+}
+
+/**
+ * @brief   Initializes the Converter structure, creating the Expat parser.
+ *
+ * @param converter  A pointer to the Converter structure to be initialized.
+ * @return  Returns 0 on success, or -1 if the parser could not be created.
+ */
+int initConverter(Converter *converter)
+{
+    initPool(&converter->pool);
+    converter->parser = XML_ParserCreate_MM(NULL, &poolMemorySuite, NULL);
+    if (!converter->parser)
+    {
+        fprintf(stderr, "Nie można utworzyć parsera XML.\n");
+        freePool(&converter->pool);
+        return -1;
+    }
+    initData(&converter->data);
+    initPathDictionary(&converter->paths);
+    initParserContext(&converter->context, &converter->data, &converter->timestamp);
+    converter->context.parser = converter->parser;
+    converter->context.pool = &converter->pool;
+    setParserHandlers(converter);
+    return 0;
+}
+
+/**
+ * @brief   Makes the pool of the converter the one its parser allocates from in the calling thread.
+ *
+ * Must be called before the parser is used by a thread which may have run another converter.
+ *
+ * @param converter  A pointer to the Converter structure.
+ */
+void useConverter(Converter *converter)
+{
+    activePool = &converter->pool;
+}
+
+/**
+ * @brief   Prepares the converter for the next document, keeping the buffers warm.
+ *
+ * All the memory of the parser comes from its pool, so the parser is not freed block by block:
+ * the pool is reset at once and a new parser is created in the kept chunks.
+ *
+ * @param converter  A pointer to the Converter structure.
+ */
+void resetConverter(Converter *converter)
+{
+    resetPool(&converter->pool);
+    converter->parser = XML_ParserCreate_MM(NULL, &poolMemorySuite, NULL);
+    if (!converter->parser)
+    {
+        perror("Błąd alokacji pamięci!");
+        exit(EXIT_FAILURE);
+    }
+    converter->context.parser = converter->parser;
+    setParserHandlers(converter);
+    converter->data.emitorLen = 0;
+    converter->data.nTags = 0;
+    converter->data.pathLen = 0;
+    converter->context.error = CONTEXT_OK;
+    converter->context.depth = 0;
+    converter->context.unnamedEmitors = 0;
+    converter->context.textDepth = 0;
+    converter->context.rowsSeen = 0;
+    converter->context.skipRows = 0;
+    resetArena(&converter->context.output);
+}
+
+/**
+ * @brief   Frees the parser (with all the chunks of its pool) and the buffers of the converter.
+ *
+ * @param converter  A pointer to the Converter structure.
+ */
+void freeConverter(Converter *converter)
+{
+    freePool(&converter->pool);
+    free(converter->data.path);
+    free(converter->context.output.buffer);
+    freePathDictionary(&converter->paths);
+    free(converter->context.matchStates);
+    free(converter->context.pushedTags);
+    free(converter->context.text.buffer);
+}
+
+/**
+ * @brief   Compiles the extraction rules shared by all the parsers of the library.
+ *
+ * @param filename  The name of the rule file, or NULL for the default rules.
+ * @return  Returns 0 on success, or -1 if the rules could not be read or compiled.
+ */
+int emitorLoadRules(const char *filename)
+{
+    if (extractionRules.next)
+    {
+        freeMatcher(&extractionRules);
+    }
+    return initMatcher(&extractionRules, filename);
+}
+
+/**
+ * @brief   Creates a parser of the library which hands the rows to the given sink.
+ *
+ * The default rules are compiled with the first parser, unless emitorLoadRules() was called.
+ *
+ * @param sink      The row sink.
+ * @param userData  The pointer passed to every call of the sink.
+ * @return  A pointer to the parser, or NULL if it could not be created.
+ */
+EmitorParser *emitorCreate(EmitorRowSink sink, void *userData)
+{
+    if (!extractionRules.next && initMatcher(&extractionRules, NULL) < 0)
+    {
+        return NULL;
+    }
+    EmitorParser *parser = malloc(sizeof(*parser));
+    if (!parser || initConverter(&parser->converter) < 0)
+    {
+        free(parser);
+        return NULL;
+    }
+    parser->converter.context.sink = sink;
+    parser->converter.context.sinkData = userData;
+    return parser;
+}
+
+/**
+ * @brief   Parses the next part of the document, in pieces Expat can take at once.
+ *
+ * @param parser  A pointer to the parser.
+ * @param bytes   A pointer to the part of the document.
+ * @param len     The number of bytes.
+ * @return  Returns 0 on success, or -1 on a parse error or if the sink stopped the parser.
+ */
+int emitorFeed(EmitorParser *parser, const char *bytes, size_t len)
+{
+    useConverter(&parser->converter);
+    do
+    {
+        int piece = len > INT_MAX ? INT_MAX : (int)len;
+        if (XML_Parse(parser->converter.parser, bytes, piece, 0) == XML_STATUS_ERROR)
+        {
+            return -1;
+        }
+        bytes += piece;
+        len -= piece;
+    } while (len > 0);
+    return 0;
+}
+
+/**
+ * @brief   Finishes the document parsed by the parser of the library.
+ *
+ * @param parser  A pointer to the parser.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int emitorFinish(EmitorParser *parser)
+{
+    useConverter(&parser->converter);
+    return XML_Parse(parser->converter.parser, NULL, 0, 1) == XML_STATUS_ERROR ? -1 : 0;
+}
+
+/**
+ * @brief   Prepares the parser of the library for the next document.
+ *
+ * @param parser  A pointer to the parser.
+ */
+void emitorReset(EmitorParser *parser)
+{
+    resetConverter(&parser->converter);
+}
+
+/**
+ * @brief   Returns the description of the error which made the last call of the library fail.
+ *
+ * @param parser  A pointer to the parser.
+ * @param line    A pointer to the variable where the line of the error will be stored (may be NULL).
+ * @return  The description of the error.
+ */
+const char *emitorError(const EmitorParser *parser, long *line)
+{
+    const Converter *converter = &parser->converter;
+
+    if (line)
+    {
+        *line = XML_GetCurrentLineNumber(converter->parser);
+    }
+    if (converter->context.error == CONTEXT_TAG_DEPTH)
+    {
+        return "przekroczono maksymalną głębokość zagnieżdżenia znaczników";
+    }
+    if (converter->context.error == CONTEXT_SINK)
+    {
+        return "przerwane przez odbiorcę wierszy";
+    }
+    return XML_ErrorString(XML_GetErrorCode(converter->parser));
+}
+
+/**
+ * @brief   Frees the parser of the library.
+ *
+ * @param parser  A pointer to the parser (may be NULL).
+ */
+void emitorDestroy(EmitorParser *parser)
+{
+    if (parser)
+    {
+        freeConverter(&parser->converter);
+        free(parser);
+    }
+}
+
+/**
+ * @brief   Start element handler of the index builder, recording the start of every outermost emitor.
+ *
+ * @param userData  A pointer to the EmitorIndex structure.
+ * @param name      The name of the element.
+ * @param attr      The attributes of the element.
+ */
+void XMLCALL indexStartElement(void *userData, const char *name, const char **attr)
+{
+    EmitorIndex *index = (EmitorIndex *)userData;
+
+    index->depth++;
+    if (index->emitorDepth > 0 || strcmp(name, "emitor") != 0)
+    {
+        return;
+    }
+    index->entries = relocateMemmory(index->entries, (int)index->header.nEntries, &index->allocatedEntries,
+                                     INDEX_INITIAL_ENTRIES, sizeof(IndexEntry));
+    IndexEntry *entry = &index->entries[index->header.nEntries];
+    entry->start = (uint64_t)XML_GetCurrentByteIndex(index->parser);
+    entry->length = 0;
+    entry->nameLen = 0;
+    for (int i = 0; attr[i]; i += 2)
+    {
+        if (strcmp(attr[i], "nazwa") == 0)
+        {
+            entry->nameLen = (uint32_t)strlen(attr[i + 1]);
+            appendBytes(&index->names, attr[i + 1], entry->nameLen);
+            break;
+        }
+    }
+    index->emitorDepth = index->depth;
+}
+
+/**
+ * @brief   End element handler of the index builder, recording the end of the open outermost emitor.
+ *
+ * The end of an element without content is reported at the end of its start tag, so in both
+ * cases the element ends at the current byte index plus the length of the current event.
+ *
+ * @param userData  A pointer to the EmitorIndex structure.
+ * @param name      The name of the element (unused).
+ */
+void XMLCALL indexEndElement(void *userData, const char *name)
+{
+    EmitorIndex *index = (EmitorIndex *)userData;
+    (void)name;
+
+    if (index->depth-- != index->emitorDepth)
+    {
+        return;
+    }
+    IndexEntry *entry = &index->entries[index->header.nEntries];
+    uint64_t end = (uint64_t)XML_GetCurrentByteIndex(index->parser) + (uint64_t)XML_GetCurrentByteCount(index->parser);
+    if (end - entry->start > INT_MAX)
+    {
+        // Longer ranges cannot be handed to XML_Parse() at once
+        index->error = 1;
+        XML_StopParser(index->parser, XML_FALSE);
+        return;
+    }
+    entry->length = (uint32_t)(end - entry->start);
+    index->header.nEntries++;
+    index->emitorDepth = 0;
+}
+
+/**
+ * @brief   Frees the memory of the EmitorIndex structure.
+ *
+ * @param index  A pointer to the EmitorIndex structure.
+ */
+void freeIndex(EmitorIndex *index)
+{
+    free(index->entries);
+    free(index->names.buffer);
+}
+
+/**
+ * @brief   Builds the index sidecar of an XML file (--build-index).
+ *
+ * The mapped document is parsed by an Expat parser without the conversion callbacks, and the
+ * byte range (from XML_GetCurrentByteIndex()) and the name of every outermost <emitor> element
+ * are recorded. The sidecar holds the IndexHeader, the IndexEntry array and the names.
+ *
+ * @param inputFilename  The name of the XML file (must be a regular, non-empty file).
+ * @param indexFilename  The name of the sidecar.
+ * @param options        A pointer to the command line options (the block size and verbose mode).
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int runBuildIndex(const char *inputFilename, const char *indexFilename, const Options *options)
+{
+    struct stat st;
+    int fd = open(inputFilename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        fprintf(stderr, "Indeks można utworzyć tylko dla niepustego pliku z danymi.\n");
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("Błąd mapowania pliku z danymi");
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    EmitorIndex index;
+    memset(&index, 0, sizeof(index));
+    memcpy(index.header.magic, INDEX_MAGIC, sizeof(index.header.magic));
+    index.header.version = INDEX_VERSION;
+    index.header.fileSize = size;
+    index.header.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    index.parser = XML_ParserCreate_MM(NULL, &countingMemorySuite, NULL);
+    if (!index.parser)
+    {
+        fprintf(stderr, "Nie można utworzyć parsera XML.\n");
+        munmap(map, size);
+        return -1;
+    }
+    XML_SetUserData(index.parser, &index);
+    XML_SetElementHandler(index.parser, indexStartElement, indexEndElement);
+
+    int result = 0;
+    for (size_t offset = 0; offset < size && result == 0; offset += options->blockSize)
+    {
+        size_t len = size - offset < options->blockSize ? size - offset : options->blockSize;
+        if (XML_Parse(index.parser, map + offset, (int)len, offset + len == size) == XML_STATUS_ERROR)
+        {
+            if (index.error)
+            {
+                fprintf(stderr, "Błąd: element <emitor> dłuższy niż %d B at line %ld\n", INT_MAX, XML_GetCurrentLineNumber(index.parser));
+            }
+            else
+            {
+                fprintf(stderr, "Błąd: %s at line %ld\n", XML_ErrorString(XML_GetErrorCode(index.parser)), XML_GetCurrentLineNumber(index.parser));
+            }
+            result = -1;
+        }
+    }
+    XML_ParserFree(index.parser);
+    munmap(map, size);
+
+    index.header.prologLen = index.header.nEntries > 0 ? index.entries[0].start : size;
+    index.header.namesLen = (uint32_t)index.names.len;
+    if (result == 0 && index.names.len > UINT32_MAX)
+    {
+        fprintf(stderr, "Zbyt długie nazwy emitorów dla indeksu.\n");
+        result = -1;
+    }
+    if (result == 0)
+    {
+        FILE *sidecar = fopen(indexFilename, "wb");
+        if (!sidecar || fwrite(&index.header, sizeof(index.header), 1, sidecar) != 1 ||
+            fwrite(index.entries, sizeof(IndexEntry), index.header.nEntries, sidecar) != index.header.nEntries ||
+            fwrite(index.names.buffer, 1, index.names.len, sidecar) != index.names.len)
+        {
+            result = -1;
+        }
+        if (sidecar && fclose(sidecar) != 0)
+        {
+            result = -1;
+        }
+        if (result < 0)
+        {
+            fprintf(stderr, "Błąd podczas zapisu indeksu %s.\n", indexFilename);
+        }
+    }
+    if (result == 0 && options->verbose)
+    {
+        fprintf(stderr, "Indeks %s: emitory: %u, rozmiar: %zu B\n", indexFilename, index.header.nEntries,
+                sizeof(IndexHeader) + index.header.nEntries * sizeof(IndexEntry) + index.names.len);
+    }
+    freeIndex(&index);
+    return result;
+}
+
+/**
+ * @brief   Reads the index sidecar of the given document.
+ *
+ * The index is rejected if it does not describe the document as it is now (its size and its
+ * modification time), or if its entries are not ordered ranges inside the document.
+ *
+ * @param filename  The name of the sidecar.
+ * @param st        A pointer to the status of the document (fstat()).
+ * @param index     A pointer to the EmitorIndex structure to be filled.
+ * @return  Returns 0 on success, or -1 if the index cannot be used.
+ */
+int loadIndex(const char *filename, const struct stat *st, EmitorIndex *index)
+{
+    memset(index, 0, sizeof(*index));
+    FILE *sidecar = fopen(filename, "rb");
+    if (!sidecar)
+    {
+        fprintf(stderr, "Nie można otworzyć indeksu %s.\n", filename);
+        return -1;
+    }
+
+    int result = 0;
+    IndexHeader *header = &index->header;
+    if (fread(header, sizeof(*header), 1, sidecar) != 1 || memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != INDEX_VERSION)
+    {
+        fprintf(stderr, "Niepoprawny plik indeksu %s.\n", filename);
+        result = -1;
+    }
+    else if (header->fileSize != (uint64_t)st->st_size || header->mtime != (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec)
+    {
+        fprintf(stderr, "Indeks %s jest nieaktualny (plik z danymi został zmieniony), utwórz go ponownie (--build-index).\n", filename);
+        result = -1;
+    }
+    else if (header->nEntries > INT_MAX)
+    {
+        fprintf(stderr, "Niepoprawny plik indeksu %s.\n", filename);
+        result = -1;
+    }
+    else
+    {
+        index->entries = alocateNewMemmory(NULL, (int)header->nEntries + 1, sizeof(IndexEntry));
+        char *names = reserveArena(&index->names, (size_t)header->namesLen + 1);
+        uint64_t end = header->prologLen;
+        uint64_t namesLen = 0;
+        if (fread(index->entries, sizeof(IndexEntry), header->nEntries, sidecar) != header->nEntries ||
+            fread(names, 1, header->namesLen, sidecar) != header->namesLen)
+        {
+            result = -1;
+        }
+        for (uint32_t i = 0; i < header->nEntries && result == 0; i++)
+        {
+            result = index->entries[i].start >= end && index->entries[i].length <= header->fileSize - index->entries[i].start ? 0 : -1;
+            end = index->entries[i].start + index->entries[i].length;
+            namesLen += index->entries[i].nameLen;
+        }
+        if (result < 0 || namesLen != header->namesLen || header->prologLen > header->fileSize || header->prologLen > INT_MAX)
+        {
+            fprintf(stderr, "Niepoprawny plik indeksu %s.\n", filename);
+            result = -1;
+        }
+        index->names.len = header->namesLen;
+    }
+    fclose(sidecar);
+    if (result < 0)
+    {
+        freeIndex(index);
+    }
+    return result;
+}
+
+/**
+ * @brief   Builds the ranges of the split mode from the index sidecar instead of scanning the document.
+ *
+ * Every range starts at an indexed emitor and reaches up to the next one (or the end of the document).
+ *
+ * @param filename  The name of the sidecar.
+ * @param fd        The descriptor of the document.
+ * @param ranges    A pointer to the array of ranges to be allocated.
+ * @param nRanges   A pointer to the number of ranges.
+ * @return  Returns 0 on success, or -1 if the index cannot be used.
+ */
+int indexEmitorRanges(const char *filename, int fd, EmitorRange **ranges, int *nRanges)
+{
+    struct stat st;
+    EmitorIndex index;
+    if (fstat(fd, &st) != 0 || loadIndex(filename, &st, &index) < 0)
+    {
+        return -1;
+    }
+
+    *nRanges = (int)index.header.nEntries;
+    *ranges = alocateNewMemmory(NULL, *nRanges + 1, sizeof(EmitorRange));
+    for (int i = 0; i < *nRanges; i++)
+    {
+        (*ranges)[i].start = index.entries[i].start;
+        (*ranges)[i].end = i + 1 < *nRanges ? index.entries[i + 1].start : index.header.fileSize;
+    }
+    freeIndex(&index);
+    return 0;
+}
+
+/**
+ * @brief   Checks whether a name is one of the names of a comma-separated list.
+ *
+ * @param list  The comma-separated list.
+ * @param name  A pointer to the name (not terminated).
+ * @param len   The length of the name.
+ * @return  Returns 1 if the name is on the list, otherwise 0.
+ */
+int listContains(const char *list, const char *name, size_t len)
+{
+    while (*list)
+    {
+        const char *comma = strchr(list, ',');
+        size_t itemLen = comma ? (size_t)(comma - list) : strlen(list);
+        if (itemLen == len && memcmp(list, name, len) == 0)
+        {
+            return 1;
+        }
+        list += itemLen + (comma != NULL);
+    }
+    return 0;
+}
+
+/**
+ * @brief   Returns the NUMA node of a CPU.
+ *
+ * Without libnuma the node is read from the sysfs entry of the CPU (the "nodeN" link).
+ *
+ * @param cpu  The number of the CPU.
+ * @return  The number of the node (0 if it is unknown).
+ */
+int cpuNode(int cpu)
+{
+    int node = 0;
+#ifdef EMITOR_WITH_NUMA
+    if (numa_available() >= 0)
+    {
+        node = numa_node_of_cpu(cpu);
+    }
+#else
+    char dirname[64];
+    snprintf(dirname, sizeof(dirname), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(dirname);
+    if (dir)
+    {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9')
+            {
+                node = atoi(entry->d_name + 4);
+                break;
+            }
+        }
+        closedir(dir);
+    }
+#endif
+    return node >= 0 ? node : 0;
+}
+
+/**
+ * @brief   Compares two 64-bit keys (for qsort()).
+ *
+ * @param a  A pointer to the first key.
+ * @param b  A pointer to the second key.
+ * @return  A negative, zero or positive number, as for qsort().
+ */
+int compareKeys(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief   Reads the CPUs the process may run on and their NUMA nodes, and orders them for the workers.
+ *
+ * The CPUs are ordered by their position within their node and then by the node, so the
+ * workers are spread over all nodes before any node gets a second one.
+ *
+ * @param placement  A pointer to the CpuPlacement structure to be filled.
+ */
+void initPlacement(CpuPlacement *placement)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+    {
+        CPU_ZERO(&allowed);
+        CPU_SET(0, &allowed);
+    }
+    int count = CPU_COUNT(&allowed);
+    uint64_t *keys = alocateNewMemmory(NULL, count, sizeof(uint64_t));
+    int *perNode = calloc(CPU_SETSIZE, sizeof(int));
+    if (!perNode)
+    {
+        perror("Błąd alokacji pamięci!");
+        exit(EXIT_FAILURE);
+    }
+
+    // Key: the position of the CPU within its node, the node and the CPU, 20 bits each at most
+    int n = 0;
+    placement->nNodes = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < count; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed))
+        {
+            int node = cpuNode(cpu) % CPU_SETSIZE;
+            placement->nNodes += perNode[node] == 0;
+            keys[n++] = (uint64_t)perNode[node]++ << 40 | (uint64_t)node << 20 | (uint64_t)cpu;
+        }
+    }
+    qsort(keys, n, sizeof(uint64_t), compareKeys);
+
+    placement->nCpus = n;
+    placement->cpus = alocateNewMemmory(NULL, n, sizeof(int));
+    placement->nodes = alocateNewMemmory(NULL, n, sizeof(int));
+    for (int i = 0; i < n; i++)
+    {
+        placement->cpus[i] = (int)(keys[i] & 0xFFFFF);
+        placement->nodes[i] = (int)(keys[i] >> 20 & 0xFFFFF);
+    }
+    free(perNode);
+    free(keys);
+}
+
+/**
+ * @brief   Frees the memory of the CpuPlacement structure.
+ *
+ * @param placement  A pointer to the CpuPlacement structure.
+ */
+void freePlacement(CpuPlacement *placement)
+{
+    free(placement->cpus);
+    free(placement->nodes);
+}
+
+/**
+ * @brief   Returns the NUMA node of a worker (0 without a placement).
+ *
+ * @param placement  A pointer to the CpuPlacement structure (may be NULL).
+ * @param worker     The number of the worker.
+ * @return  The number of the node.
+ */
+int workerNode(const CpuPlacement *placement, int worker)
+{
+    return placement ? placement->nodes[worker % placement->nCpus] : 0;
+}
+
+/**
+ * @brief   Pins the calling worker thread to its CPU.
+ *
+ * The worker allocates its parser and its buffers only after it has been pinned, so their
+ * pages are placed on its node by the first-touch policy of the kernel. With libnuma the
+ * local allocation policy is also set explicitly, overriding an interleaving policy of the process.
+ *
+ * @param placement  A pointer to the CpuPlacement structure.
+ * @param worker     The number of the worker (the workers are assigned to the CPUs in turn).
+ */
+void pinWorker(const CpuPlacement *placement, int worker)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(placement->cpus[worker % placement->nCpus], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#ifdef EMITOR_WITH_NUMA
+    if (numa_available() >= 0)
+    {
+        numa_set_localalloc();
+    }
+#endif
+}
+
+/**
+ * @brief   Finds the next occurrence of a string in a memory range.
+ *
+ * @param start   The beginning of the range.
+ * @param end     The end of the range.
+ * @param needle  The string to be found.
+ * @return  A pointer to the first occurrence, or end if the string was not found.
+ */
+const char *findNext(const char *start, const char *end, const char *needle)
+{
+    const char *found = memmem(start, end - start, needle, strlen(needle));
+    return found ? found : end;
+}
+
+/**
+ * @brief   Finds the beginnings of the top-level <emitor> blocks in a mapped document.
+ *
+ * The candidates are located with memmem() (vectorized in the C library). Comments,
+ * CDATA sections, processing instructions and the document type declaration are skipped,
+ * so an "<emitor" inside them does not start a range. Attribute values and text cannot
+ * contain a literal '<', so every other candidate is a real start tag.
+ *
+ * @param map      The mapped document.
+ * @param size     The size of the document.
+ * @param ranges   A pointer to the array of ranges to be allocated.
+ * @param nRanges  A pointer to the number of ranges found.
+ */
+void findEmitorRanges(const char *map, size_t size, EmitorRange **ranges, int *nRanges)
+{
+    const char *end = map + size;
+    const char *p = map;
+    const char *nextEmitor = findNext(p, end, "<emitor");
+    const char *nextMarkup = findNext(p, end, "<!");
+    const char *nextPi = findNext(p, end, "<?");
+    int allocatedRanges = 0;
+
+    *ranges = NULL;
+    *nRanges = 0;
+    while (nextEmitor < end)
+    {
+        const char *skip = nextMarkup < nextPi ? nextMarkup : nextPi;
+        if (skip < nextEmitor)
+        {
+            // Skip the whole construct, then look for the candidates after it again
+            if (skip == nextPi)
+            {
+                p = findNext(skip + 2, end, "?>");
+            }
+            else if (end - skip >= 4 && memcmp(skip, "<!--", 4) == 0)
+            {
+                p = findNext(skip + 4, end, "-->");
+            }
+            else if (end - skip >= 9 && memcmp(skip, "<![CDATA[", 9) == 0)
+            {
+                p = findNext(skip + 9, end, "]]>");
+            }
+            else
+            {
+                // <!DOCTYPE ...>, possibly with an internal subset in brackets
+                const char *bracket = memchr(skip, '[', end - skip);
+                const char *close = memchr(skip, '>', end - skip);
+                p = bracket && close && bracket < close ? findNext(bracket, end, "]") : skip + 2;
+                p = close ? (const char *)memchr(p, '>', end - p) : end;
+                p = p ? p : end;
+            }
+            nextEmitor = findNext(p, end, "<emitor");
+            nextMarkup = findNext(p, end, "<!");
+            nextPi = findNext(p, end, "<?");
+            continue;
+        }
+
+        char next = nextEmitor + 7 < end ? nextEmitor[7] : '\0';
+        if (next == ' ' || next == '\t' || next == '\n' || next == '\r' || next == '>' || next == '/')
+        {
+            *ranges = relocateMemmory(*ranges, *nRanges, &allocatedRanges, 256, sizeof(EmitorRange));
+            (*ranges)[*nRanges].start = nextEmitor - map;
+            if (*nRanges > 0)
+            {
+                (*ranges)[*nRanges - 1].end = nextEmitor - map;
+            }
+            (*nRanges)++;
+        }
+        nextEmitor = findNext(nextEmitor + 1, end, "<emitor");
+    }
+    if (*nRanges > 0)
+    {
+        (*ranges)[*nRanges - 1].end = size;
+    }
+}
+
+/**
+ * @brief   Parses one emitor range with the converter of a worker thread.
+ *
+ * The prolog is parsed first, so the parser has the same state (root element, declared
+ * entities, encoding) as when the serial parser reaches the range; the rows produced
+ * by the prolog are discarded. A range which is not the last one must leave the parser
+ * at the same depth and tag stack it started at, otherwise its boundaries were ambiguous.
+ *
+ * @param converter  A pointer to the Converter structure of the worker.
+ * @param document   A pointer to the SplitDocument structure.
+ * @param index      The index of the range.
+ * @return  Returns 0 if the range was parsed and verified, otherwise -1.
+ */
+int parseSplitRange(Converter *converter, SplitDocument *document, int index)
+{
+    ParserContext *context = &converter->context;
+    OutputArena *arena = &context->output;
+    const EmitorRange *range = &document->ranges[index];
+    int isLast = index == document->nRanges - 1;
+
+    resetConverter(converter);
+    initTimestamp(&converter->timestamp, document->options, -1);
+
+    if (XML_Parse(converter->parser, document->map, (int)document->prologLen, 0) == XML_STATUS_ERROR)
+    {
+        return -1;
+    }
+    size_t prologRows = arena->nRows;
+    resetArena(arena);
+    arena->totalRows -= prologRows;
+
+    if (range->end - range->start > INT_MAX)
+    {
+        return -1;
+    }
+    int depth = context->depth;
+    int nTags = converter->data.nTags;
+    if (XML_Parse(converter->parser, document->map + range->start, (int)(range->end - range->start), isLast) == XML_STATUS_ERROR)
+    {
+        return -1;
+    }
+    if (!isLast && (context->depth != depth || converter->data.nTags != nTags || context->unnamedEmitors > 0))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief   The worker thread of the split mode. Parses the ranges in the order of the document.
+ *
+ * A worker never runs more than the window of ranges ahead of the range being written,
+ * so the memory used by the parsed but not yet written rows stays bounded. That is why the
+ * ranges are taken from one shared counter, in the order of the document, instead of being
+ * dealt to the workers in advance. With --numa the worker is pinned before it allocates anything.
+ *
+ * @param arg  A pointer to the SplitDocument structure.
+ * @return  Always NULL.
+ */
+void *splitWorker(void *arg)
+{
+    SplitDocument *document = (SplitDocument *)arg;
+    Converter converter;
+    if (document->placement)
+    {
+        pinWorker(document->placement, __atomic_fetch_add(&document->nextWorker, 1, __ATOMIC_RELAXED));
+    }
+    int ready = initConverter(&converter) == 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&document->lock);
+        while (!document->cancel && document->nextFragment < document->nRanges &&
+               document->nextFragment >= document->written + document->window)
+        {
+            pthread_cond_wait(&document->cond, &document->lock);
+        }
+        int index = !document->cancel && document->nextFragment < document->nRanges ? document->nextFragment++ : -1;
+        if (index >= 0)
+        {
+            document->fragments[index].state = SPLIT_RUNNING;
+        }
+        pthread_mutex_unlock(&document->lock);
+        if (index < 0)
+        {
+            break;
+        }
+
+        SplitFragment *fragment = &document->fragments[index];
+        OutputArena *arena = &converter.context.output;
+        size_t rowsBefore = arena->totalRows;
+        int result = ready ? parseSplitRange(&converter, document, index) : -1;
+
+        // The buffer with the rows is handed over to the writing thread without copying
+        pthread_mutex_lock(&document->lock);
+        fragment->result = result;
+        if (result == 0)
+        {
+            fragment->buffer = arena->buffer;
+            fragment->len = arena->len;
+            fragment->allocated = arena->allocated;
+            fragment->rows = arena->totalRows - rowsBefore;
+            fragment->lastEmitor = strndup(converter.data.path, converter.data.emitorLen);
+            arena->buffer = NULL;
+            arena->allocated = 0;
+            arena->len = 0;
+        }
+        fragment->state = SPLIT_DONE;
+        pthread_cond_broadcast(&document->cond);
+        pthread_mutex_unlock(&document->lock);
+    }
+
+    if (ready)
+    {
+        freeConverter(&converter);
+    }
+    return NULL;
+}
+
+/**
+ * @brief   Parses the mapped file by splitting it on top-level <emitor> blocks parsed in parallel.
+ *
+ * The prolog is parsed by the converter of the calling thread, the ranges by the workers.
+ * The rows of the ranges are written in the order of the document. If a range cannot be
+ * verified (ambiguous boundaries, errors), the calling thread - whose parser is still in the
+ * state after the prolog - parses the rest of the document serially from that range on.
+ *
+ * @param converter  A pointer to the Converter structure of the calling thread.
+ * @param fd         The descriptor of the input file (must be a regular, non-empty file).
+ * @param fileSize   The size of the input file in bytes.
+ * @param options    A pointer to the command line options.
+ * @param writer     A pointer to the OutputWriter the entries are written with.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int parseSplit(Converter *converter, int fd, size_t fileSize, const Options *options, OutputWriter *writer)
+{
+    ParserContext *context = &converter->context;
+    SplitDocument document;
+
+    memset(&document, 0, sizeof(document));
+    char *map = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("Błąd mapowania pliku z danymi");
+        return -1;
+    }
+    madvise(map, fileSize, MADV_SEQUENTIAL);
+
+    // The index already holds the boundaries of the emitors, otherwise the document is pre-scanned
+    if (!options->indexFile || indexEmitorRanges(options->indexFile, fd, &document.ranges, &document.nRanges) < 0)
+    {
+        findEmitorRanges(map, fileSize, &document.ranges, &document.nRanges);
+    }
+    if (document.nRanges == 0 || document.ranges[0].start > INT_MAX)
+    {
+        // Nothing to split
+        int result = parseBuffer(converter->parser, context, map, fileSize, options, writer);
+        free(document.ranges);
+        munmap(map, fileSize);
+        return result;
+    }
+
+    int nThreads = options->threads ? options->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nThreads < 1)
+    {
+        nThreads = 1;
+    }
+    if (nThreads > document.nRanges)
+    {
+        nThreads = document.nRanges;
+    }
+
+    document.map = map;
+    document.size = fileSize;
+    document.prologLen = document.ranges[0].start;
+    document.window = SPLIT_WINDOW * nThreads;
+    document.options = options;
+    CpuPlacement placement;
+    if (options->numa)
+    {
+        initPlacement(&placement);
+        document.placement = &placement;
+    }
+    document.fragments = calloc(document.nRanges, sizeof(SplitFragment));
+    if (!document.fragments)
+    {
+        perror("Błąd alokacji pamięci!");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&document.lock, NULL);
+    pthread_cond_init(&document.cond, NULL);
+
+    // The prolog is parsed here, its rows go to the output before the rows of the ranges
+    int result = 0;
+    if (XML_Parse(converter->parser, map, (int)document.prologLen, 0) == XML_STATUS_ERROR)
+    {
+        printParseError(converter->parser, context);
+        result = -1;
+    }
+    else
+    {
+        result = flushOutput(writer, &context->output, 1);
+    }
+
+    pthread_t *threads = alocateNewMemmory(NULL, nThreads, sizeof(pthread_t));
+    int nStarted = 0;
+    while (result == 0 && nStarted < nThreads && pthread_create(&threads[nStarted], NULL, splitWorker, &document) == 0)
+    {
+        nStarted++;
+    }
+
+    // Write the ranges in the order of the document, stop at the first one which failed
+    int fallback = nStarted > 0 ? -1 : 0;
+    for (int i = 0; result == 0 && fallback < 0 && i < document.nRanges; i++)
+    {
+        SplitFragment *fragment = &document.fragments[i];
+
+        pthread_mutex_lock(&document.lock);
+        while (fragment->state != SPLIT_DONE)
+        {
+            pthread_cond_wait(&document.cond, &document.lock);
+        }
+        pthread_mutex_unlock(&document.lock);
+
+        if (fragment->result != 0)
+        {
+            fallback = i;
+            break;
+        }
+
+        OutputArena fragmentArena;
+        memset(&fragmentArena, 0, sizeof(fragmentArena));
+        fragmentArena.buffer = fragment->buffer;
+        fragmentArena.len = fragment->len;
+        fragmentArena.allocated = fragment->allocated;
+        fragment->buffer = NULL;
+        result = flushOutput(writer, &fragmentArena, 1);
+        free(fragmentArena.buffer);
+        context->output.totalRows += fragment->rows;
+
+        pthread_mutex_lock(&document.lock);
+        document.written = i + 1;
+        pthread_cond_broadcast(&document.cond);
+        pthread_mutex_unlock(&document.lock);
+    }
+
+    pthread_mutex_lock(&document.lock);
+    document.cancel = 1;
+    pthread_cond_broadcast(&document.cond);
+    pthread_mutex_unlock(&document.lock);
+    for (int i = 0; i < nStarted; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (options->verbose)
+    {
+        fprintf(stderr, "Podział: bloki <emitor>: %d, wątki: %d", document.nRanges, nStarted);
+        if (result == 0 && fallback >= 0)
+        {
+            fprintf(stderr, ", przetwarzanie sekwencyjne od bloku %d", fallback + 1);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    if (result == 0 && fallback >= 0)
+    {
+        // The parser of this thread is still in the state right after the prolog
+        const char *lastEmitor = fallback > 0 ? document.fragments[fallback - 1].lastEmitor : NULL;
+        if (lastEmitor && lastEmitor[0])
+        {
+            setEmitor(&converter->data, lastEmitor, strlen(lastEmitor));
+        }
+        size_t start = document.ranges[fallback].start;
+        result = parseBuffer(converter->parser, context, map + start, fileSize - start, options, writer);
+    }
+
+    for (int i = 0; i < document.nRanges; i++)
+    {
+        free(document.fragments[i].buffer);
+        free(document.fragments[i].lastEmitor);
+    }
+    free(threads);
+    free(document.fragments);
+    free(document.ranges);
+    if (document.placement)
+    {
+        freePlacement(&placement);
+    }
+    pthread_mutex_destroy(&document.lock);
+    pthread_cond_destroy(&document.cond);
+    munmap(map, fileSize);
+    return result;
+}
+
+/**
+ * @brief   Parses only the emitors of the --only list, located with the index sidecar.
+ *
+ * The prolog of the mapped document is parsed first (its rows are skipped), so that the parser
+ * is in the state the emitors are parsed in. Then the ranges of the selected emitors are handed
+ * to the parser one after another, in the order of the document, and everything between them
+ * is never read.
+ *
+ * @param converter  A pointer to the Converter structure.
+ * @param fd         The descriptor of the input file (must be a regular, non-empty file).
+ * @param st         A pointer to the status of the input file (fstat()).
+ * @param options    A pointer to the command line options.
+ * @param writer     A pointer to the OutputWriter the entries are written with.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int parseIndexed(Converter *converter, int fd, const struct stat *st, const Options *options, OutputWriter *writer)
+{
+    ParserContext *context = &converter->context;
+    EmitorIndex index;
+    if (loadIndex(options->indexFile, st, &index) < 0)
+    {
+        return -1;
+    }
+    size_t size = (size_t)st->st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("Błąd mapowania pliku z danymi");
+        freeIndex(&index);
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = 0;
+    // The rows of the prolog do not belong to any emitor
+    context->skipRows = SIZE_MAX;
+    if (XML_Parse(converter->parser, map, (int)index.header.prologLen, 0) == XML_STATUS_ERROR)
+    {
+        printParseError(converter->parser, context);
+        result = -1;
+    }
+    context->rowsSeen = 0;
+    context->skipRows = 0;
+    context->input.bytes += index.header.prologLen;
+
+    const char *name = index.names.buffer;
+    int selected = 0;
+    for (uint32_t i = 0; i < index.header.nEntries && result == 0; i++)
+    {
+        const IndexEntry *entry = &index.entries[i];
+        const char *entryName = name;
+        name += entry->nameLen;
+        if (!listContains(options->onlyNames, entryName, entry->nameLen))
+        {
+            continue;
+        }
+        selected++;
+        if (XML_Parse(converter->parser, map + entry->start, (int)entry->length, 0) == XML_STATUS_ERROR)
+        {
+            printParseError(converter->parser, context);
+            result = -1;
+            break;
+        }
+        context->input.blocks++;
+        context->input.bytes += entry->length;
+        result = flushOutput(writer, &context->output, options->stream);
+    }
+    context->input.parseSeconds += secondsSince(&start);
+
+    if (options->verbose)
+    {
+        fprintf(stderr, "Indeks: wybrane emitory: %d z %u\n", selected, index.header.nEntries);
+    }
+    munmap(map, size);
+    freeIndex(&index);
+    return result;
+}
+
+/**
+ * @brief   Hands one range of the mapped document to the parser, in blocks of the configured size.
+ *
+ * @param converter  A pointer to the Converter structure.
+ * @param bytes      The beginning of the range.
+ * @param len        The number of bytes of the range.
+ * @param isFinal    Non-zero if the range ends the document.
+ * @param options    A pointer to the command line options.
+ * @return  Returns 0 on success, or -1 on a parse error.
+ */
+int parseRange(Converter *converter, const char *bytes, size_t len, int isFinal, const Options *options)
+{
+    ParserContext *context = &converter->context;
+    size_t offset = 0;
+
+    do
+    {
+        size_t blockLen = len - offset < options->blockSize ? len - offset : options->blockSize;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        enum XML_Status status = XML_Parse(converter->parser, bytes + offset, (int)blockLen, isFinal && offset + blockLen == len);
+        context->input.parseSeconds += secondsSince(&start);
+        context->input.blocks++;
+        context->input.bytes += blockLen;
+        if (status == XML_STATUS_ERROR)
+        {
+            return -1;
+        }
+        offset += blockLen;
+    } while (offset < len);
+    return 0;
+}
+
+/**
+ * @brief   Parses the mapped document emitor by emitor, skipping the malformed emitor blocks (--recover).
+ *
+ * The <emitor> blocks are located as in the split mode and handed to the parser one after
+ * another. A range which leaves the parser deeper than it started continues in the next
+ * ranges (a nested <emitor>), up to RECOVER_MAX_RANGES ranges. A block is malformed if the
+ * parser reports an error in it or if it stays open. Its rows are withdrawn from the output
+ * arena, the byte range of its first range is reported, and the parser is reset and brought to
+ * the state after the prolog again (the rows of the prolog are skipped), so the conversion
+ * continues at the next range. The rows of the correct blocks are written after every block.
+ *
+ * @param converter  A pointer to the Converter structure.
+ * @param fd         The descriptor of the input file (must be a regular, non-empty file).
+ * @param fileSize   The size of the input file in bytes.
+ * @param options    A pointer to the command line options.
+ * @param writer     A pointer to the OutputWriter the entries are written with.
+ * @return  Returns 0 on success (also if blocks were skipped), or -1 on an error outside the emitor blocks.
+ */
+int parseRecover(Converter *converter, int fd, size_t fileSize, const Options *options, OutputWriter *writer)
+{
+    ParserContext *context = &converter->context;
+    OutputArena *arena = &context->output;
+    char *map = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("Błąd mapowania pliku z danymi");
+        return -1;
+    }
+    madvise(map, fileSize, MADV_SEQUENTIAL);
+
+    EmitorRange *ranges;
+    int nRanges;
+    findEmitorRanges(map, fileSize, &ranges, &nRanges);
+    size_t prologLen = nRanges > 0 ? ranges[0].start : fileSize;
+
+    int result = parseRange(converter, map, prologLen, nRanges == 0, options);
+    if (result < 0)
+    {
+        printParseError(converter->parser, context);
+    }
+    int depth = context->depth;
+    int nTags = converter->data.nTags;
+    int skipped = 0;
+    size_t skippedBytes = 0;
+
+    // The block being parsed starts with the range first and its rows with the checkpoint of the arena
+    int first = 0;
+    size_t len = 0;
+    size_t nRows = 0;
+    size_t totalRows = 0;
+    for (int i = 0; i < nRanges && result == 0; i++)
+    {
+        const EmitorRange *range = &ranges[i];
+        int isLast = i == nRanges - 1;
+        if (i == first)
+        {
+            len = arena->len;
+            nRows = arena->nRows;
+            totalRows = arena->totalRows;
+        }
+
+        int status = parseRange(converter, map + range->start, range->end - range->start, isLast, options);
+        if (status == 0 && (isLast || (context->depth == depth && converter->data.nTags == nTags)))
+        {
+            result = flushOutput(writer, arena, options->stream);
+            first = i + 1;
+            continue;
+        }
+        // A nested <emitor> also ends a range, the block then continues in the next one
+        if (status == 0 && i - first + 1 < RECOVER_MAX_RANGES)
+        {
+            continue;
+        }
+        // Errors of the output are not caused by the block
+        if (context->error == CONTEXT_SINK || context->error == CONTEXT_OUTPUT)
+        {
+            printParseError(converter->parser, context);
+            result = -1;
+            break;
+        }
+
+        // Only the first range of the block is skipped, the parser resynchronizes at the next one
+        const EmitorRange *bad = &ranges[first];
+        const char *reason = status == 0 ? "niezamknięty element"
+                             : context->error == CONTEXT_TAG_DEPTH ? "przekroczono maksymalną głębokość zagnieżdżenia znaczników"
+                                                                   : XML_ErrorString(XML_GetErrorCode(converter->parser));
+        fprintf(stderr, "Pominięto uszkodzony emitor, bajty %zu-%zu: %s\n", bad->start, bad->end, reason);
+        skipped++;
+        skippedBytes += bad->end - bad->start;
+        arena->len = len;
+        arena->nRows = nRows;
+        arena->totalRows = totalRows;
+        i = first++;
+        if (first == nRanges || flushOutput(writer, arena, TRUE_ARG) < 0)
+        {
+            result = first == nRanges ? 0 : -1;
+            break;
+        }
+
+        // The reset parser continues at the next range in the state after the prolog (its rows are skipped)
+        resetConverter(converter);
+        context->skipRows = SIZE_MAX;
+        if (parseRange(converter, map, prologLen, 0, options) < 0)
+        {
+            printParseError(converter->parser, context);
+            result = -1;
+        }
+        context->rowsSeen = 0;
+        context->skipRows = 0;
+    }
+
+    if (skipped > 0)
+    {
+        fprintf(stderr, "Pominięte uszkodzone emitory: %d z %d (%zu bajtów)\n", skipped, nRanges, skippedBytes);
+    }
+    free(ranges);
+    munmap(map, fileSize);
+    return result;
+}
+
+/**
+ * @brief   Parses one XML document, decompressing it first if needed.
+ *
+ * Regular files are mapped into memory, everything else (and every input in streaming mode)
+ * is read straight into the parser buffer. Compressed input (detected by its magic bytes) is
+ * decompressed by a separate thread into a pipe, which is parsed like any other stream, so
+ * decompression overlaps with parsing.
+ *
+ * @param converter  A pointer to the Converter structure (fresh or reset).
+ * @param inputFd    The descriptor of the input.
+ * @param options    A pointer to the command line options.
+ * @param writer     A pointer to the OutputWriter the rows are written with.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int parseInput(Converter *converter, int inputFd, const Options *options, OutputWriter *writer)
+{
+    ParserContext *context = &converter->context;
+    useConverter(converter);
+    CodecStage decompression;
+    memset(&decompression, 0, sizeof(decompression));
+    decompression.codec = detectCodec(inputFd, decompression.prefix, &decompression.prefixLen);
+    if (decompression.codec != CODEC_NONE && startCodecStage(&decompression, &inputFd) < 0)
+    {
+        return -1;
+    }
+
+    // The magic bytes consumed from a plain pipe are the beginning of the document
+    if (decompression.codec == CODEC_NONE && decompression.prefixLen > 0 &&
+        XML_Parse(converter->parser, (const char *)decompression.prefix, (int)decompression.prefixLen, 0) == XML_STATUS_ERROR)
+    {
+        printParseError(converter->parser, context);
+        return -1;
+    }
+
+    // Map regular files into memory, read everything else straight into the parser buffer
+    struct stat st;
+    int useMapping = !options->stream && decompression.codec == CODEC_NONE && options->inputMode != INPUT_MODE_READ &&
+                     fstat(inputFd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+    if ((options->inputMode == INPUT_MODE_MMAP || options->split) && !useMapping)
+    {
+        fprintf(stderr, "Nie można zmapować wejścia, używam odczytu strumieniowego.\n");
+    }
+
+    int result;
+    if (options->onlyNames)
+    {
+        if (!useMapping)
+        {
+            fprintf(stderr, "Opcja --only wymaga zwykłego pliku z danymi.\n");
+            result = -1;
+        }
+        else
+        {
+            result = parseIndexed(converter, inputFd, &st, options, writer);
+        }
+    }
+    else if (options->recover)
+    {
+        if (!useMapping)
+        {
+            fprintf(stderr, "Opcja --recover wymaga zwykłego, nieskompresowanego pliku z danymi.\n");
+            result = -1;
+        }
+        else
+        {
+            result = parseRecover(converter, inputFd, (size_t)st.st_size, options, writer);
+        }
+    }
+    else if (useMapping && options->split)
+    {
+        result = parseSplit(converter, inputFd, (size_t)st.st_size, options, writer);
+    }
+    else
+    {
+        if (useMapping)
+        {
+            result = parseMapped(converter->parser, context, inputFd, (size_t)st.st_size, options, writer);
+        }
+        else if (options->readAhead)
+        {
+            result = parseReadAhead(converter->parser, context, inputFd, options, writer);
+        }
+        else
+        {
+            result = parseRead(converter->parser, context, inputFd, options, writer);
+        }
+    }
+
+    if (decompression.codec != CODEC_NONE)
+    {
+        close(inputFd);
+        // After a parse error the stage only fails because its pipe was closed
+        if (finishCodecStage(&decompression) < 0 && result == 0)
+        {
+            fprintf(stderr, "Błąd dekompresji pliku z danymi.\n");
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief   Converts one XML document into CSV rows (or a columnar file) written with the given writer.
+ *
+ * The document is parsed by parseInput(). With --format=arrow|parquet the rows are collected
+ * by a ColumnarWriter, which encodes every full batch into the output arena, and the file is
+ * finished (the last batch and the footer) after the document. With --sort the rows are
+ * written ordered by the path after the document, and with --partition-by to the files
+ * of their emitors instead of the writer. All data is flushed before the function returns.
+ *
+ * @param converter    A pointer to the Converter structure (fresh or reset).
+ * @param inputFd      The descriptor of the input.
+ * @param options      A pointer to the command line options.
+ * @param writer       A pointer to the OutputWriter the rows are written with.
+ * @param writeHeader  Non-zero if the CSV header should be written before the rows.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int convertInput(Converter *converter, int inputFd, const Options *options, OutputWriter *writer, int writeHeader)
+{
+    ParserContext *context = &converter->context;
+    ColumnarWriter columnar;
+    ColumnarWriter arrow;
+    OutputArena arrowOutput;
+    Aggregation aggregation;
+    Sorter sorter;
+    PartitionSet partitions;
+    // The partial aggregation of a batch worker is written only after the whole batch
+    int ownAggregation = options->aggregate && !context->aggregation;
+
+    initTimestamp(&converter->timestamp, options, inputFd);
+    converter->data.paths = options->intern || options->pathIdsFile ? &converter->paths : NULL;
+    converter->data.pathIds = options->pathIdsFile != NULL;
+
+    if (options->format != FORMAT_CSV)
+    {
+        initColumnar(&columnar, options->format);
+        startColumnar(&columnar, &context->output);
+        context->columnar = &columnar;
+    }
+    // The CSV header goes through the same buffer as the rows, to both the console and the output file
+    else if (writeHeader && options->partitionBy == PARTITION_NONE)
+    {
+        const char *header = options->pathIdsFile ? CSV_PATH_ID_HEADER : options->aggregate ? CSV_AGGREGATE_HEADER : CSV_HEADER;
+        appendBytes(&context->output, header, strlen(header));
+    }
+    if (ownAggregation)
+    {
+        initAggregation(&aggregation);
+        context->aggregation = &aggregation;
+    }
+    if (options->sort)
+    {
+        initSorter(&sorter, options);
+        context->sorter = &sorter;
+    }
+    // The Arrow outputs of --tee share one encoding of the CSV rows
+    for (int i = 0; i < writer->nSinks && !context->arrow; i++)
+    {
+        if (writer->sinks[i].stream == STREAM_ARROW)
+        {
+            memset(&arrowOutput, 0, sizeof(arrowOutput));
+            initColumnar(&arrow, FORMAT_ARROW);
+            startColumnar(&arrow, &arrowOutput);
+            context->arrow = &arrow;
+            context->arrowOutput = &arrowOutput;
+            writer->arrow = &arrowOutput;
+        }
+    }
+    if (options->partitionBy != PARTITION_NONE)
+    {
+        initPartitions(&partitions, options);
+        context->partitions = &partitions;
+    }
+
+    int result = parseInput(converter, inputFd, options, writer);
+
+    if (ownAggregation)
+    {
+        if (result == 0)
+        {
+            writeAggregation(&aggregation, &context->output);
+        }
+        if (options->verbose && aggregation.nonNumeric > 0)
+        {
+            fprintf(stderr, "Wartości nieliczbowe pominięte w agregacji: %zu\n", aggregation.nonNumeric);
+        }
+        freeAggregation(&aggregation);
+        context->aggregation = NULL;
+    }
+    if (context->sorter)
+    {
+        if (result == 0)
+        {
+            result = finishSorter(&sorter, &context->output, writer, context->partitions);
+        }
+        if (options->verbose && sorter.spilledRows > 0)
+        {
+            fprintf(stderr, "Sortowanie: wiersze zapisane w plikach tymczasowych: %zu\n", sorter.spilledRows);
+        }
+        freeSorter(&sorter);
+        context->sorter = NULL;
+    }
+    if (context->partitions)
+    {
+        if (options->verbose)
+        {
+            fprintf(stderr, "Partycje: %d, ponowne otwarcia plików: %zu, nazwy plików z przyrostkiem: %zu\n", partitions.names.nEntries,
+                    partitions.reopened, partitions.renamed);
+        }
+        if (closePartitions(&partitions) < 0)
+        {
+            result = -1;
+        }
+        context->partitions = NULL;
+    }
+    if (context->columnar)
+    {
+        if (result == 0)
+        {
+            finishColumnar(&columnar, &context->output);
+        }
+        freeColumnar(&columnar);
+        context->columnar = NULL;
+    }
+    if (context->arrow)
+    {
+        if (result == 0)
+        {
+            finishColumnar(&arrow, &arrowOutput);
+        }
+        freeColumnar(&arrow);
+        context->arrow = NULL;
+    }
+    if (result == 0)
+    {
+        result = flushOutput(writer, &context->output, 1);
+    }
+    if (writer->arrow)
+    {
+        free(arrowOutput.buffer);
+        writer->arrow = NULL;
+    }
+    return result;
+}
+
+/**
+ * @brief   Reads the list of files converted in batch mode.
+ *
+ * Every non-empty line which does not start with '#' names one input file, optionally
+ * followed by a tab and the name of its own output file. Files without their own output
+ * are written to the merged output.
+ *
+ * @param listFilename  The name of the list file.
+ * @param batch         A pointer to the Batch structure the jobs are stored in.
+ * @return  Returns 0 on success, or -1 if the list could not be read.
+ */
+int readBatchList(const char *listFilename, Batch *batch)
+{
+    FILE *list = fopen(listFilename, "r");
+    if (!list)
+    {
+        fprintf(stderr, "Nie można otworzyć listy plików.\n");
+        return -1;
+    }
+
+    int allocatedJobs = 0;
+    char *line = NULL;
+    size_t lineSize = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &lineSize, list)) >= 0)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        {
+            line[--len] = '\0';
+        }
+        if (len == 0 || line[0] == '#')
+        {
+            continue;
+        }
+
+        batch->jobs = relocateMemmory(batch->jobs, batch->nJobs, &allocatedJobs, 64, sizeof(BatchJob));
+        BatchJob *job = &batch->jobs[batch->nJobs++];
+        memset(job, 0, sizeof(*job));
+
+        char *tab = strchr(line, '\t');
+        if (tab)
+        {
+            *tab = '\0';
+            job->output = strdup(tab + 1);
+        }
+        job->input = strdup(line);
+        if (!job->input || (tab && !job->output))
+        {
+            perror("Błąd alokacji pamięci!");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    free(line);
+    fclose(list);
+    return 0;
+}
+
+/**
+ * @brief   Converts one file of the batch with the converter owned by the worker.
+ *
+ * @param converter  A pointer to the Converter structure of the worker.
+ * @param job        A pointer to the BatchJob structure.
+ * @param options    A pointer to the command line options (console output disabled).
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int convertBatchJob(Converter *converter, BatchJob *job, const Options *options)
+{
+    int inputFd = open(job->input, O_RDONLY);
+    if (inputFd < 0)
+    {
+        fprintf(stderr, "%s: nie można otworzyć pliku z danymi.\n", job->input);
+        return -1;
+    }
+
+    int outputFd;
+    if (job->output)
+    {
+        outputFd = open(job->output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    else
+    {
+        job->temporary = tmpfile();
+        outputFd = job->temporary ? fileno(job->temporary) : -1;
+    }
+    if (outputFd < 0)
+    {
+        fprintf(stderr, "%s: nie można otworzyć pliku wynikowego.\n", job->input);
+        close(inputFd);
+        return -1;
+    }
+
+    // Only the own output files are compressed, the temporary ones are compressed when merged
+    OutputWriter writer;
+    CodecStage compression;
+    Options jobOptions = *options;
+    int writeFd = outputFd;
+    if (!job->output)
+    {
+        jobOptions.compressCodec = CODEC_NONE;
+    }
+    int result = startOutputCompression(&compression, &writeFd, &jobOptions);
+    if (result == 0)
+    {
+        result = initOutputWriter(&writer, writeFd, options);
+        if (result == 0)
+        {
+            size_t rowsBefore = converter->context.output.totalRows;
+
+            resetConverter(converter);
+            result = convertInput(converter, inputFd, options, &writer, job->output != NULL);
+            if (closeOutputWriter(&writer) < 0)
+            {
+                result = -1;
+            }
+            job->rows = converter->context.output.totalRows - rowsBefore;
+        }
+        if (finishOutputCompression(&compression, writeFd) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    if (job->output && close(outputFd) != 0 && result == 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
+        result = -1;
+    }
+    close(inputFd);
+    return result;
+}
+
+/**
+ * @brief   Takes the next job of a batch worker from its own deque, or steals one from another worker.
+ *
+ * The owner takes its jobs from the front of its deque, so they are finished roughly in the
+ * order the merged output needs them. A worker whose deque is empty steals from the back of
+ * the deques of the other workers, first of the workers on its own NUMA node.
+ *
+ * @param batch   A pointer to the Batch structure.
+ * @param worker  The number of the worker.
+ * @return  The index of the job, or -1 if no jobs are left.
+ */
+int takeBatchJob(Batch *batch, int worker)
+{
+    int own = worker % batch->nDeques;
+    int node = workerNode(batch->placement, worker);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < batch->nDeques; i++)
+        {
+            int victim = (own + i) % batch->nDeques;
+            if ((pass == 0) != (workerNode(batch->placement, victim) == node))
+            {
+                continue;
+            }
+            JobDeque *deque = &batch->deques[victim];
+            int index = -1;
+            pthread_mutex_lock(&deque->lock);
+            if (deque->head < deque->tail)
+            {
+                index = victim == own ? deque->jobs[deque->head++] : deque->jobs[--deque->tail];
+            }
+            pthread_mutex_unlock(&deque->lock);
+            if (index >= 0)
+            {
+                if (victim != own)
+                {
+                    __atomic_add_fetch(&batch->stolen, 1, __ATOMIC_RELAXED);
+                }
+                return index;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief   The worker thread of the batch mode. Takes jobs from the batch until none are left.
+ *
+ * Every worker owns one Converter, so the Expat parser and the buffers are created once
+ * and reused for all files converted by the worker.
+ *
+ * @param arg  A pointer to the Batch structure.
+ * @return  Always NULL.
+ */
+void *batchWorker(void *arg)
+{
+    Batch *batch = (Batch *)arg;
+    Options options = *batch->options;
+    Converter converter;
+    Aggregation partial;
+    int worker = __atomic_fetch_add(&batch->nextWorker, 1, __ATOMIC_RELAXED);
+    if (batch->placement)
+    {
+        pinWorker(batch->placement, worker);
+    }
+    int ready = initConverter(&converter) == 0;
+
+    // The rows of many files would be interleaved in the console
+    options.verbose = FALSE_ARG;
+    // Every worker aggregates its files on its own, the partial results are merged at the end
+    if (ready && options.aggregate)
+    {
+        initAggregation(&partial);
+    }
+
+    for (;;)
+    {
+        int index = takeBatchJob(batch, worker);
+        if (index < 0)
+        {
+            break;
+        }
+
+        BatchJob *job = &batch->jobs[index];
+        Aggregation file;
+        if (ready && options.aggregate)
+        {
+            initAggregation(&file);
+            converter.context.aggregation = &file;
+        }
+        int result = ready ? convertBatchJob(&converter, job, &options) : -1;
+        // Like the rows of a skipped file, its statistics are not a part of the result
+        if (ready && options.aggregate)
+        {
+            if (result == 0)
+            {
+                mergeAggregation(&partial, &file);
+            }
+            freeAggregation(&file);
+            converter.context.aggregation = NULL;
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        job->result = result;
+        job->done = 1;
+        pthread_cond_broadcast(&batch->cond);
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    if (ready && options.aggregate)
+    {
+        pthread_mutex_lock(&batch->lock);
+        mergeAggregation(&batch->aggregation, &partial);
+        pthread_mutex_unlock(&batch->lock);
+        freeAggregation(&partial);
+    }
+    if (ready)
+    {
+        freeConverter(&converter);
+    }
+    return NULL;
+}
+
+/**
+ * @brief   Appends the content of a temporary file to the output file.
+ *
+ * @param temporary  The temporary file.
+ * @param outputFd   The descriptor of the output file.
+ * @param buffer     A pointer to the copy buffer of COPY_BUFFER_SIZE bytes.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int appendTemporary(FILE *temporary, int outputFd, char *buffer)
+{
+    int fd = fileno(temporary);
+    ssize_t len;
+
+    if (lseek(fd, 0, SEEK_SET) < 0)
+    {
+        return -1;
+    }
+    while ((len = read(fd, buffer, COPY_BUFFER_SIZE)) != 0)
+    {
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (writeAll(outputFd, buffer, len) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief   Converts all files of the batch list with a pool of worker threads.
+ *
+ * Files with their own output are written directly by the workers. The rows of the other
+ * files are collected in temporary files and appended to the merged output in the order
+ * of the list, as soon as all previous files are finished. The jobs are dealt to the deques of
+ * the workers in turn and a worker which runs out of jobs steals from the others (see takeBatchJob()).
+ * With --numa every worker is pinned to a CPU and the workers are spread over the NUMA nodes.
+ *
+ * @param listFilename    The name of the list file.
+ * @param mergedFilename  The name of the merged output file (may be NULL if every file has its own output).
+ * @param options         A pointer to the command line options.
+ * @return  Returns 0 if all files were converted, otherwise -1.
+ */
+int runBatch(const char *listFilename, const char *mergedFilename, const Options *options)
+{
+    Batch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.options = options;
+
+    if (readBatchList(listFilename, &batch) < 0)
+    {
+        return -1;
+    }
+
+    int needsMerged = 0;
+    int ownOutputs = 0;
+    for (int i = 0; i < batch.nJobs; i++)
+    {
+        needsMerged |= batch.jobs[i].output == NULL;
+        ownOutputs |= batch.jobs[i].output != NULL;
+    }
+    // The statistics cover the whole batch, so there is only the merged output
+    if (options->aggregate && ownOutputs)
+    {
+        fprintf(stderr, "W trybie --aggregate pliki listy nie mogą mieć własnych plików wynikowych.\n");
+        free(batch.jobs);
+        return -1;
+    }
+    const char *header = options->aggregate ? CSV_AGGREGATE_HEADER : CSV_HEADER;
+
+    int mergedFd = -1;
+    int mergedWriteFd = -1;
+    CodecStage compression;
+    if (needsMerged)
+    {
+        if (!mergedFilename)
+        {
+            fprintf(stderr, "Brak pliku wynikowego dla plików bez własnego pliku wynikowego.\n");
+            return -1;
+        }
+        mergedFd = open(mergedFilename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        mergedWriteFd = mergedFd;
+        if (mergedFd < 0 || startOutputCompression(&compression, &mergedWriteFd, options) < 0 ||
+            writeAll(mergedWriteFd, header, strlen(header)) < 0)
+        {
+            fprintf(stderr, "Nie można otworzyć pliku wynikowego.\n\n");
+            return -1;
+        }
+    }
+
+    int nThreads = options->threads ? options->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nThreads < 1)
+    {
+        nThreads = 1;
+    }
+    if (nThreads > batch.nJobs)
+    {
+        nThreads = batch.nJobs > 0 ? batch.nJobs : 1;
+    }
+
+    // Deal the jobs to the workers, job i to worker i % nThreads
+    batch.nDeques = nThreads;
+    batch.deques = alocateNewMemmory(NULL, nThreads, sizeof(JobDeque));
+    for (int i = 0; i < nThreads; i++)
+    {
+        JobDeque *deque = &batch.deques[i];
+        deque->jobs = alocateNewMemmory(NULL, batch.nJobs / nThreads + 1, sizeof(int));
+        deque->head = 0;
+        deque->tail = 0;
+        pthread_mutex_init(&deque->lock, NULL);
+    }
+    for (int i = 0; i < batch.nJobs; i++)
+    {
+        JobDeque *deque = &batch.deques[i % nThreads];
+        deque->jobs[deque->tail++] = i;
+    }
+    CpuPlacement placement;
+    if (options->numa)
+    {
+        initPlacement(&placement);
+        batch.placement = &placement;
+    }
+
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.cond, NULL);
+    initAggregation(&batch.aggregation);
+    pthread_t *threads = alocateNewMemmory(NULL, nThreads, sizeof(pthread_t));
+    int nStarted = 0;
+    while (nStarted < nThreads && pthread_create(&threads[nStarted], NULL, batchWorker, &batch) == 0)
+    {
+        nStarted++;
+    }
+    if (nStarted == 0)
+    {
+        // Without any worker the files are converted by this thread
+        batchWorker(&batch);
+    }
+
+    // Merge the results in the order of the list
+    char *copyBuffer = needsMerged ? alocateNewMemmory(NULL, COPY_BUFFER_SIZE, sizeof(char)) : NULL;
+    int result = 0;
+    size_t totalRows = 0;
+    for (int i = 0; i < batch.nJobs; i++)
+    {
+        BatchJob *job = &batch.jobs[i];
+
+        pthread_mutex_lock(&batch.lock);
+        while (!job->done)
+        {
+            pthread_cond_wait(&batch.cond, &batch.lock);
+        }
+        pthread_mutex_unlock(&batch.lock);
+
+        if (job->result == 0 && job->temporary && appendTemporary(job->temporary, mergedWriteFd, copyBuffer) < 0)
+        {
+            fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
+            job->result = -1;
+        }
+        if (job->temporary)
+        {
+            fclose(job->temporary);
+        }
+
+        if (job->result == 0)
+        {
+            totalRows += job->rows;
+            if (options->verbose)
+            {
+                fprintf(stderr, "%s: %zu wierszy\n", job->input, job->rows);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "%s: błąd konwersji, plik pominięty.\n", job->input);
+            result = -1;
+        }
+        free(job->input);
+        free(job->output);
+    }
+
+    for (int i = 0; i < nStarted; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    // The partial statistics of all workers are merged only when every worker has finished
+    if (options->aggregate)
+    {
+        OutputArena rows;
+        memset(&rows, 0, sizeof(rows));
+        writeAggregation(&batch.aggregation, &rows);
+        if (writeAll(mergedWriteFd, rows.buffer, rows.len) < 0)
+        {
+            fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
+            result = -1;
+        }
+        totalRows = rows.totalRows;
+        free(rows.buffer);
+        if (options->verbose && batch.aggregation.nonNumeric > 0)
+        {
+            fprintf(stderr, "Wartości nieliczbowe pominięte w agregacji: %zu\n", batch.aggregation.nonNumeric);
+        }
+    }
+    freeAggregation(&batch.aggregation);
+    if (mergedFd >= 0 && (finishOutputCompression(&compression, mergedWriteFd) < 0 || close(mergedFd) != 0))
+    {
+        fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
+        result = -1;
+    }
+    if (options->verbose)
+    {
+        fprintf(stderr, "Pliki: %d, wątki: %d, zapisane wiersze: %zu\n", batch.nJobs, nStarted ? nStarted : 1, totalRows);
+        fprintf(stderr, "Zadania przejęte od innych wątków: %d\n", batch.stolen);
+        if (batch.placement)
+        {
+            fprintf(stderr, "NUMA: węzły: %d, procesory: %d\n", placement.nNodes, placement.nCpus);
+        }
+    }
+
+    free(copyBuffer);
+    free(threads);
+    free(batch.jobs);
+    for (int i = 0; i < batch.nDeques; i++)
+    {
+        free(batch.deques[i].jobs);
+        pthread_mutex_destroy(&batch.deques[i].lock);
+    }
+    free(batch.deques);
+    if (batch.placement)
+    {
+        freePlacement(&placement);
+    }
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.cond);
+    return result;
+}
+
+// Set by the signal handler of the watch mode
+volatile sig_atomic_t watchStopped = 0;
+
+/**
+ * @brief   Handles SIGINT and SIGTERM in the watch mode, stopping it after the current file.
+ *
+ * @param signal  The number of the signal.
+ */
+void stopWatch(int signal)
+{
+    (void)signal;
+    watchStopped = 1;
+}
+
+/**
+ * @brief   Compares two latencies (for qsort()).
+ *
+ * @param a  A pointer to the first latency.
+ * @param b  A pointer to the second latency.
+ * @return  A negative, zero or positive number, as for qsort().
+ */
+int compareLatencies(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief   Converts one file picked up by the watch mode and publishes the output by rename().
+ *
+ * The rows are written to a hidden temporary file in the output directory, which replaces
+ * the output file only after a complete conversion, so readers never see a partial file.
+ *
+ * @param converter  A pointer to the warm Converter structure of the watch mode.
+ * @param dir        The watched directory.
+ * @param name       The name of the file in the directory.
+ * @param outputDir  The directory the output is written to.
+ * @param options    A pointer to the command line options (console output disabled).
+ * @param rows       A pointer to the variable where the number of rows will be stored.
+ * @return  Returns 0 on success, or -1 on error.
+ */
+int convertWatchedFile(Converter *converter, const char *dir, const char *name, const char *outputDir,
+                       const Options *options, size_t *rows)
+{
+    size_t stemLen = strstr(name, ".xml") - name;
+    const char *extension = outputExtensions[options->format];
+    BatchJob job;
+    memset(&job, 0, sizeof(job));
+
+    char *final = NULL;
+    if (asprintf(&job.input, "%s/%s", dir, name) < 0 ||
+        asprintf(&job.output, "%s/.%.*s%s.tmp", outputDir, (int)stemLen, name, extension) < 0 ||
+        asprintf(&final, "%s/%.*s%s", outputDir, (int)stemLen, name, extension) < 0)
+    {
+        perror("Błąd alokacji pamięci!");
+        exit(EXIT_FAILURE);
+    }
+
+    int result = convertBatchJob(converter, &job, options);
+    if (result == 0 && rename(job.output, final) != 0)
+    {
+        fprintf(stderr, "%s: nie można opublikować pliku wynikowego.\n", final);
+        result = -1;
+    }
+    if (result != 0)
+    {
+        unlink(job.output);
+    }
+    *rows = job.rows;
+    free(job.input);
+    free(job.output);
+    free(final);
+    return result;
+}
+
+/**
+ * @brief   Runs the watch mode: converts every XML file written or moved into the directory.
+ *
+ * The files are picked up with inotify (IN_CLOSE_WRITE and IN_MOVED_TO), so a file is converted
+ * only after its writer has closed it; hidden files are ignored. One Converter is kept for the
+ * whole run and reset before each file (its parser is created again in the kept chunks of its
+ * pool), so the buffers stay warm. The mode ends on SIGINT or SIGTERM, printing the number of files and the p50 and p99
+ * latency (from the event to the published output).
+ *
+ * @param dir        The watched directory.
+ * @param outputDir  The directory the output files are written to.
+ * @param options    A pointer to the command line options.
+ * @return  Returns 0 on success, or -1 if the directory could not be watched.
+ */
+int runWatch(const char *dir, const char *outputDir, const Options *options)
+{
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        fprintf(stderr, "Nie można obserwować katalogu %s.\n", dir);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    Converter converter;
+    if (initConverter(&converter) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Without SA_RESTART the signal interrupts the read() waiting for the next event
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopWatch;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // The rows would be echoed to the console
+    Options fileOptions = *options;
+    fileOptions.verbose = FALSE_ARG;
+
+    char events[WATCH_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+    double *latencies = NULL;
+    int nFiles = 0;
+    int allocatedFiles = 0;
+    int failed = 0;
+    if (options->verbose)
+    {
+        fprintf(stderr, "Obserwowanie katalogu %s, pliki wynikowe w %s\n", dir, outputDir);
+    }
+    while (!watchStopped)
+    {
+        ssize_t len = read(fd, events, sizeof(events));
+        if (len <= 0)
+        {
+            if (len < 0 && errno != EINTR)
+            {
+                perror("Błąd odczytu zdarzeń inotify");
+                break;
+            }
+            continue;
+        }
+
+        for (char *p = events; p < events + len && !watchStopped;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->len == 0 || event->name[0] == '.' || !strstr(event->name, ".xml"))
+            {
+                continue;
+            }
+
+            struct timespec start;
+            size_t rows = 0;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            int result = convertWatchedFile(&converter, dir, event->name, outputDir, &fileOptions, &rows);
+            double seconds = secondsSince(&start);
+            if (result != 0)
+            {
+                fprintf(stderr, "%s: błąd konwersji, plik pominięty.\n", event->name);
+                failed++;
+                continue;
+            }
+            latencies = relocateMemmory(latencies, nFiles, &allocatedFiles, WATCH_INITIAL_FILES, sizeof(double));
+            latencies[nFiles++] = seconds;
+            if (options->verbose)
+            {
+                fprintf(stderr, "%s: %zu wierszy, %.3f ms\n", event->name, rows, seconds * 1e3);
+            }
+        }
+    }
+
+    if (nFiles > 0)
+    {
+        qsort(latencies, nFiles, sizeof(double), compareLatencies);
+        fprintf(stderr, "Pliki: %d, błędy: %d, opóźnienie p50: %.3f ms, p99: %.3f ms\n", nFiles, failed,
+                latencies[(nFiles - 1) / 2] * 1e3, latencies[(nFiles * 99 + 99) / 100 - 1] * 1e3);
+    }
+    else
+    {
+        fprintf(stderr, "Pliki: 0, błędy: %d\n", failed);
+    }
+    free(latencies);
+    freeConverter(&converter);
+    close(fd);
+    return 0;
+}
+
+/**
+ * @brief   Measures one row formatter over the typical "K3.parametr.VSS.wartosc" row.
+ *
+ * The arena is reset every 16384 rows, just like it is reset after every flush.
+ *
+ * @param formatter  The function formatting one row.
+ * @param timestamp  A pointer to the Timestamp structure used for the rows.
+ * @param data       A pointer to the Data structure describing the row.
+ * @param rows       The number of rows to be formatted.
+ * @return  The number of rows formatted per second.
+ */
+double benchFormatter(void (*formatter)(const Timestamp *, Data *, OutputArena *),
+                      const Timestamp *timestamp, Data *data, size_t rows)
+{
+    OutputArena arena;
+    struct timespec start;
+
+    memset(&arena, 0, sizeof(arena));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < rows; i++)
+    {
+        formatter(timestamp, data, &arena);
+        if (arena.nRows == 16384)
+        {
+            resetArena(&arena);
+        }
+    }
+    double rate = rows / secondsSince(&start);
+    free(arena.buffer);
+    return rate;
+}
+
+/**
+ * @brief   Prepares the typical "K3.parametr.VSS.wartosc" row measured by the formatter benchmarks.
+ *
+ * @param timestamp  A pointer to the Timestamp structure to be initialized.
+ * @param data       A pointer to the Data structure to be initialized.
+ */
+void initBenchRow(Timestamp *timestamp, Data *data)
+{
+    Options options;
+
+    initOptions(&options);
+    parseTimestamp("fixed:2024-10-01T13", &options);
+    initTimestamp(timestamp, &options, -1);
+    initData(data);
+    setEmitor(data, "K3", 2);
+    addTag(data, ELEMENT_PARAMETR, "parametr");
+    addTag(data, ELEMENT_OTHER, "VSS");
+    addTag(data, ELEMENT_WARTOSC, "wartosc");
+    data->value = "1167";
+    data->valueLen = 4;
+}
+
+/**
+ * @brief   Runs the --bench-format microbenchmark comparing saveData() with the sprintf() path.
+ *
+ * saveData() is measured three times: quoting the path, copying the interned path cell
+ * and writing the numeric path identifier.
+ *
+ * @param rows  The number of rows formatted by each implementation.
+ * @return  Returns EXIT_SUCCESS.
+ */
+int runFormatBenchmark(size_t rows)
+{
+    Timestamp timestamp;
+    Data data;
+    PathDictionary interned;
+    PathDictionary identifiers;
+
+    initBenchRow(&timestamp, &data);
+    initPathDictionary(&interned);
+    initPathDictionary(&identifiers);
+
+    printf("Formatowanie %zu wierszy:\n", rows);
+    double reference = benchFormatter(saveDataSprintf, &timestamp, &data, rows);
+    printf("%-10s %12.0f wierszy/s\n", "sprintf", reference);
+    double formatter = benchFormatter(saveData, &timestamp, &data, rows);
+    printf("%-10s %12.0f wierszy/s\n", "saveData", formatter);
+    printf("Przyspieszenie: %.2fx\n", formatter / reference);
+
+    data.paths = &interned;
+    double internedRate = benchFormatter(saveData, &timestamp, &data, rows);
+    printf("%-10s %12.0f wierszy/s\n", "intern", internedRate);
+    data.paths = &identifiers;
+    data.pathIds = TRUE_ARG;
+    double identifiersRate = benchFormatter(saveData, &timestamp, &data, rows);
+    printf("%-10s %12.0f wierszy/s\n", "path-ids", identifiersRate);
+
+    freePathDictionary(&interned);
+    freePathDictionary(&identifiers);
+    free(data.path);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief   Writes one emitor block of the synthetic document.
+ *
+ * The block has the same schema as example.xml: status, parametr and stezenie elements
+ * with pkt attributes. The values of the parameters are nested in the given number of
+ * additional grupa elements.
+ *
+ * @param out        The file the document is written to.
+ * @param index      The index of the emitor (used in its name).
+ * @param generator  A pointer to the parameters of the generator.
+ * @param pkt        A pointer to the counter of the pkt values.
+ * @return  The number of bytes written.
+ */
+size_t generateEmitor(FILE *out, size_t index, const GeneratorOptions *generator, size_t *pkt)
+{
+    int written = 0;
+    static const char *types[] = {"VSS", "VSW", "VSR", "MOC", "O2", "H2O", "T", "P", "VSU"};
+    const size_t nTypes = sizeof(types) / sizeof(types[0]);
+
+    written += fprintf(out, "\t<emitor nr=\"%zu\" typ=\"pomiarowy\" nazwa=\"K%zu\">\n", index, index);
+    written += fprintf(out, "\t\t<status>\n\t\t\t<auto pkt=\"%zu\" />\n\t\t\t<reka pkt=\"%zu\" />\n\t\t</status>\n", *pkt, *pkt + 1);
+    *pkt += 2;
+
+    for (size_t i = 0; i < generator->params; i++)
+    {
+        if (i < nTypes)
+        {
+            written += fprintf(out, "\t\t<parametr id=\"%zu\" typ=\"%s\">\n", i + 1, types[i]);
+        }
+        else
+        {
+            written += fprintf(out, "\t\t<parametr id=\"%zu\" typ=\"P%zu\">\n", i + 1, i + 1);
+        }
+        for (size_t d = 0; d < generator->depth; d++)
+        {
+            written += fprintf(out, "\t\t\t<grupa poziom=\"%zu\">\n", d + 1);
+        }
+        written += fprintf(out, "\t\t\t<wartosc pkt=\"%zu\" mnoznik=\"1.0\" />\n", (*pkt)++);
+        for (size_t d = 0; d < generator->depth; d++)
+        {
+            written += fprintf(out, "\t\t\t</grupa>\n");
+        }
+        written += fprintf(out, "\t\t\t<status pkt=\"%zu\" />\n\t\t\t<precyzja srednia=\"1\" suma=\"1\" />\n\t\t</parametr>\n", (*pkt)++);
+    }
+
+    written += fprintf(out, "\t\t<stezenie id=\"1\" typ=\"PYL\">\n\t\t\t<wartosc pkt=\"%zu\" mnoznik=\"1.0\" />\n"
+                 "\t\t\t<status pkt=\"%zu\" />\n\t\t\t<niepewnosc pkt=\"%zu\" />\n\t\t</stezenie>\n\t</emitor>\n",
+            *pkt, *pkt + 1, *pkt + 2);
+    *pkt += 3;
+    return written > 0 ? (size_t)written : 0;
+}
+
+/**
+ * @brief   Writes a synthetic energetyka document with the schema of example.xml.
+ *
+ * The number of bytes written so far is published after every emitor, so the progress
+ * of a document written into a pipe can be followed by another thread.
+ *
+ * @param out           The file (or pipe) the document is written to.
+ * @param generator     A pointer to the parameters of the generator.
+ * @param bytesWritten  A pointer to the counter of the written bytes, or NULL.
+ * @return  The number of generated emitors, or 0 if writing failed.
+ */
+size_t generateDocument(FILE *out, const GeneratorOptions *generator, size_t *bytesWritten)
+{
+    size_t pkt = 1000;
+    size_t emitors = 0;
+    size_t bytes = (size_t)fprintf(out, "<energetyka>\n");
+
+    while (!ferror(out) && (generator->size ? bytes < generator->size : emitors < generator->emitors))
+    {
+        bytes += generateEmitor(out, emitors++, generator, &pkt);
+        if (bytesWritten)
+        {
+            __atomic_store_n(bytesWritten, bytes, __ATOMIC_RELAXED);
+        }
+    }
+    fputs("</energetyka>\n", out);
+    return ferror(out) ? 0 : emitors;
+}
+
+/**
+ * @brief   Writes the synthetic document to a file or to the standard output (--generate).
+ *
+ * @param filename  The name of the file to be written, or "-" for the standard output.
+ * @param options   A pointer to the command line options with the generator parameters.
+ * @return  Returns EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int runGenerator(const char *filename, const Options *options)
+{
+    FILE *out = strcmp(filename, STDIO_NAME) == 0 ? stdout : fopen(filename, "w");
+    if (!out)
+    {
+        fprintf(stderr, "Nie można otworzyć pliku wynikowego.\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t emitors = generateDocument(out, &options->generator, NULL);
+    if (fclose(out) != 0 || emitors == 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
+        return EXIT_FAILURE;
+    }
+    if (options->verbose)
+    {
+        fprintf(stderr, "Wygenerowane emitory: %zu\n", emitors);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief   Generates the synthetic document into a new temporary file.
+ *
+ * @param filename   The buffer where the name of the temporary file will be stored.
+ * @param size       The size of the buffer.
+ * @param generator  A pointer to the parameters of the generator.
+ * @return  The number of generated emitors, or 0 on error (the file is then removed).
+ */
+size_t generateTemporary(char *filename, size_t size, const GeneratorOptions *generator)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    snprintf(filename, size, "%s/emitor_bench_XXXXXX", tmpdir ? tmpdir : "/tmp");
+
+    int fd = mkstemp(filename);
+    FILE *generated = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!generated)
+    {
+        fprintf(stderr, "Nie można utworzyć pliku tymczasowego.\n");
+        return 0;
+    }
+    size_t emitors = generateDocument(generated, generator, NULL);
+    if (fclose(generated) != 0 || emitors == 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu pliku tymczasowego.\n");
+        unlink(filename);
+        return 0;
+    }
+    return emitors;
+}
+
+/**
+ * @brief   Runs the benchmark suite and writes its results as JSON (--bench).
+ *
+ * A synthetic document is generated into a temporary file and converted by the full
+ * pipeline (with the selected input, split and writer options) into /dev/null. Then
+ * saveData() and the sprintf() reference are measured in isolation.
+ *
+ * @param jsonFilename  The name of the JSON file, or NULL to write the results to stdout.
+ * @param options       A pointer to the command line options.
+ * @return  Returns EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int runBenchmark(const char *jsonFilename, const Options *options)
+{
+    char inputFilename[4096];
+    size_t emitors = generateTemporary(inputFilename, sizeof(inputFilename), &options->generator);
+    if (emitors == 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    int inputFd = open(inputFilename, O_RDONLY);
+    unlink(inputFilename);
+    int outputFd = open("/dev/null", O_WRONLY);
+    struct stat st;
+    if (inputFd < 0 || outputFd < 0 || fstat(inputFd, &st) < 0)
+    {
+        fprintf(stderr, "Nie można otworzyć pliku tymczasowego.\n");
+        return EXIT_FAILURE;
+    }
+
+    Options pipelineOptions = *options;
+    pipelineOptions.verbose = FALSE_ARG;
+
+    // Full pipeline
+    AllocationStats before = allocationStats;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Converter converter;
+    OutputWriter writer;
+    int result = -1;
+    size_t rows = 0;
+    if (initConverter(&converter) == 0)
+    {
+        if (initOutputWriter(&writer, outputFd, &pipelineOptions) == 0)
+        {
+            result = convertInput(&converter, inputFd, &pipelineOptions, &writer, TRUE_ARG);
+            if (closeOutputWriter(&writer) < 0)
+            {
+                result = -1;
+            }
+        }
+        rows = converter.context.output.totalRows;
+        freeConverter(&converter);
+    }
+    double pipelineSeconds = secondsSince(&start);
+    AllocationStats pipelineAllocations = {allocationStats.calls - before.calls, allocationStats.bytes - before.bytes};
+    close(inputFd);
+    close(outputFd);
+    if (result < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // saveData() in isolation
+    Timestamp timestamp;
+    Data data;
+    initBenchRow(&timestamp, &data);
+    before = allocationStats;
+    double saveDataRate = benchFormatter(saveData, &timestamp, &data, BENCH_SAVE_DATA_ROWS);
+    AllocationStats saveDataAllocations = {allocationStats.calls - before.calls, allocationStats.bytes - before.bytes};
+    double sprintfRate = benchFormatter(saveDataSprintf, &timestamp, &data, BENCH_SAVE_DATA_ROWS);
+    free(data.path);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    FILE *json = jsonFilename ? fopen(jsonFilename, "w") : stdout;
+    if (!json)
+    {
+        fprintf(stderr, "Nie można otworzyć pliku wynikowego.\n");
+        return EXIT_FAILURE;
+    }
+    fprintf(json, "{\n");
+    fprintf(json, "  \"input\": {\"bytes\": %lld, \"emitors\": %zu, \"params\": %zu, \"depth\": %zu},\n",
+            (long long)st.st_size, emitors, options->generator.params, options->generator.depth);
+    fprintf(json, "  \"pipeline\": {\"seconds\": %.6f, \"mb_per_s\": %.2f, \"rows\": %zu, \"rows_per_s\": %.0f, "
+                  "\"allocations\": %zu, \"allocated_bytes\": %zu},\n",
+            pipelineSeconds, st.st_size / pipelineSeconds / (1024.0 * 1024.0), rows, rows / pipelineSeconds,
+            pipelineAllocations.calls, pipelineAllocations.bytes);
+    fprintf(json, "  \"save_data\": {\"rows\": %d, \"rows_per_s\": %.0f, \"sprintf_rows_per_s\": %.0f, "
+                  "\"allocations\": %zu, \"allocated_bytes\": %zu},\n",
+            BENCH_SAVE_DATA_ROWS, saveDataRate, sprintfRate, saveDataAllocations.calls, saveDataAllocations.bytes);
+    fprintf(json, "  \"peak_rss_kb\": %ld\n", usage.ru_maxrss);
+    fprintf(json, "}\n");
+    if (json != stdout && fclose(json) != 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief   Reads the resident memory of the process.
+ *
+ * @return  The resident set size in kB, or 0 if it is unknown.
+ */
+long readResidentMemory(void)
+{
+    long pages = 0;
+    long resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm)
+    {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ * @brief   The generating thread of the streaming benchmark, writing the document into the pipe.
+ *
+ * @param arg  A pointer to the StreamBench structure.
+ * @return  Always NULL.
+ */
+void *streamGenerator(void *arg)
+{
+    StreamBench *bench = (StreamBench *)arg;
+
+    bench->emitors = generateDocument(bench->out, &bench->generator, &bench->bytesWritten);
+    fclose(bench->out);
+    return NULL;
+}
+
+/**
+ * @brief   The sampling thread of the streaming benchmark, recording the peak resident memory
+ *          in every tenth of the generated stream.
+ *
+ * @param arg  A pointer to the StreamBench structure.
+ * @return  Always NULL.
+ */
+void *streamSampler(void *arg)
+{
+    StreamBench *bench = (StreamBench *)arg;
+    const struct timespec interval = {0, 50 * 1000 * 1000};
+
+    while (!__atomic_load_n(&bench->stop, __ATOMIC_ACQUIRE))
+    {
+        size_t bytes = __atomic_load_n(&bench->bytesWritten, __ATOMIC_RELAXED);
+        size_t sample = bytes / (bench->generator.size / BENCH_STREAM_SAMPLES + 1);
+        long rss = readResidentMemory();
+
+        if (sample >= BENCH_STREAM_SAMPLES)
+        {
+            sample = BENCH_STREAM_SAMPLES - 1;
+        }
+        if (rss > bench->rss[sample])
+        {
+            bench->rss[sample] = rss;
+        }
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+/**
+ * @brief   Measures the streaming mode on a generated document (--bench-stream).
+ *
+ * The document (50 GB unless --size is given) is generated by one thread into a pipe and
+ * converted in streaming mode from the other end of the pipe into /dev/null; nothing is
+ * staged on disk. The peak resident memory is sampled in every tenth of the stream, so it
+ * can be seen that it does not grow with the size of the input. The results are written as JSON.
+ *
+ * @param jsonFilename  The name of the JSON file, or NULL to write the results to stdout.
+ * @param options       A pointer to the command line options.
+ * @return  Returns EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int runStreamBenchmark(const char *jsonFilename, const Options *options)
+{
+    StreamBench bench;
+    int pipeFds[2];
+
+    memset(&bench, 0, sizeof(bench));
+    bench.generator = options->generator;
+    if (bench.generator.size == 0)
+    {
+        bench.generator.size = BENCH_STREAM_DEFAULT_SIZE;
+    }
+
+    int outputFd = open("/dev/null", O_WRONLY);
+    if (outputFd < 0 || pipe(pipeFds) < 0 || !(bench.out = fdopen(pipeFds[1], "w")))
+    {
+        perror("Nie można utworzyć potoku");
+        return EXIT_FAILURE;
+    }
+    // The generator gets EPIPE instead of a signal if the conversion stops early
+    signal(SIGPIPE, SIG_IGN);
+
+    Options streamOptions = *options;
+    streamOptions.verbose = FALSE_ARG;
+    streamOptions.stream = TRUE_ARG;
+
+    Converter converter;
+    OutputWriter writer;
+    if (initConverter(&converter) < 0 || initOutputWriter(&writer, outputFd, &streamOptions) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    pthread_t generatorThread, samplerThread;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (pthread_create(&generatorThread, NULL, streamGenerator, &bench) != 0 ||
+        pthread_create(&samplerThread, NULL, streamSampler, &bench) != 0)
+    {
+        fprintf(stderr, "Nie można uruchomić wątku.\n");
+        return EXIT_FAILURE;
+    }
+
+    int result = convertInput(&converter, pipeFds[0], &streamOptions, &writer, TRUE_ARG);
+    if (closeOutputWriter(&writer) < 0)
+    {
+        result = -1;
+    }
+    close(pipeFds[0]);
+    pthread_join(generatorThread, NULL);
+    double seconds = secondsSince(&start);
+    __atomic_store_n(&bench.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(samplerThread, NULL);
+
+    size_t rows = converter.context.output.totalRows;
+    size_t peakArena = converter.context.output.peak;
+    freeConverter(&converter);
+    close(outputFd);
+    if (result < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    FILE *json = jsonFilename ? fopen(jsonFilename, "w") : stdout;
+    if (!json)
+    {
+        fprintf(stderr, "Nie można otworzyć pliku wynikowego.\n");
+        return EXIT_FAILURE;
+    }
+    fprintf(json, "{\n");
+    fprintf(json, "  \"input\": {\"bytes\": %zu, \"emitors\": %zu, \"block_size\": %zu},\n",
+            bench.bytesWritten, bench.emitors, options->blockSize);
+    fprintf(json, "  \"pipeline\": {\"seconds\": %.6f, \"mb_per_s\": %.2f, \"rows\": %zu, \"rows_per_s\": %.0f, "
+                  "\"peak_output_buffer\": %zu},\n",
+            seconds, bench.bytesWritten / seconds / (1024.0 * 1024.0), rows, rows / seconds, peakArena);
+    fprintf(json, "  \"rss_kb\": [");
+    for (int i = 0; i < BENCH_STREAM_SAMPLES; i++)
+    {
+        fprintf(json, "%s%ld", i ? ", " : "", bench.rss[i]);
+    }
+    fprintf(json, "]\n}\n");
+    if (json != stdout && fclose(json) != 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief   Converts the generated document once in the split mode into /dev/null.
+ *
+ * @param inputFilename  The name of the generated document.
+ * @param options        A pointer to the options of the run.
+ * @param rows           A pointer to the variable where the number of rows will be stored.
+ * @return  The time of the conversion in seconds, or -1 on error.
+ */
+double timeSplitConversion(const char *inputFilename, const Options *options, size_t *rows)
+{
+    int inputFd = open(inputFilename, O_RDONLY);
+    int outputFd = open("/dev/null", O_WRONLY);
+    if (inputFd < 0 || outputFd < 0)
+    {
+        fprintf(stderr, "Nie można otworzyć pliku tymczasowego.\n");
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Converter converter;
+    OutputWriter writer;
+    int result = -1;
+    *rows = 0;
+    if (initConverter(&converter) == 0)
+    {
+        if (initOutputWriter(&writer, outputFd, options) == 0)
+        {
+            result = convertInput(&converter, inputFd, options, &writer, TRUE_ARG);
+            if (closeOutputWriter(&writer) < 0)
+            {
+                result = -1;
+            }
+        }
+        *rows = converter.context.output.totalRows;
+        freeConverter(&converter);
+    }
+    double seconds = secondsSince(&start);
+    close(inputFd);
+    close(outputFd);
+    return result < 0 ? -1 : seconds;
+}
+
+/**
+ * @brief   Measures how the batch and split modes scale with the number of threads (--bench-scaling).
+ *
+ * A synthetic document is generated into a temporary file. For 1, 2, 4, ... 64 threads it is
+ * converted BENCH_SCALING_JOBS times by the batch mode and once by the split mode, both into
+ * /dev/null, with --numa if it was given. The rows per second of every run are written as JSON.
+ *
+ * @param jsonFilename  The name of the JSON file, or NULL to write the results to stdout.
+ * @param options       A pointer to the command line options.
+ * @return  Returns EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int runScalingBenchmark(const char *jsonFilename, const Options *options)
+{
+    char inputFilename[4096];
+    char listFilename[4096];
+    size_t emitors = generateTemporary(inputFilename, sizeof(inputFilename), &options->generator);
+    if (emitors == 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // The batch list names the generated document BENCH_SCALING_JOBS times
+    const char *tmpdir = getenv("TMPDIR");
+    snprintf(listFilename, sizeof(listFilename), "%s/emitor_list_XXXXXX", tmpdir ? tmpdir : "/tmp");
+    int listFd = mkstemp(listFilename);
+    FILE *list = listFd >= 0 ? fdopen(listFd, "w") : NULL;
+    int ready = list != NULL;
+    for (int i = 0; ready && i < BENCH_SCALING_JOBS; i++)
+    {
+        ready = fprintf(list, "%s\n", inputFilename) > 0;
+    }
+    if (!list || fclose(list) != 0 || !ready)
+    {
+        fprintf(stderr, "Błąd podczas zapisu pliku tymczasowego.\n");
+        unlink(inputFilename);
+        if (listFd >= 0)
+        {
+            unlink(listFilename);
+        }
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    stat(inputFilename, &st);
+    Options runOptions = *options;
+    runOptions.verbose = FALSE_ARG;
+
+    FILE *json = jsonFilename ? fopen(jsonFilename, "w") : stdout;
+    if (!json)
+    {
+        fprintf(stderr, "Nie można otworzyć pliku wynikowego.\n");
+        unlink(inputFilename);
+        unlink(listFilename);
+        return EXIT_FAILURE;
+    }
+    CpuPlacement placement;
+    initPlacement(&placement);
+    fprintf(json, "{\n");
+    fprintf(json, "  \"input\": {\"bytes\": %lld, \"emitors\": %zu, \"jobs\": %d},\n",
+            (long long)st.st_size, emitors, BENCH_SCALING_JOBS);
+    fprintf(json, "  \"machine\": {\"cpus\": %d, \"nodes\": %d, \"numa\": %s},\n",
+            placement.nCpus, placement.nNodes, options->numa ? "true" : "false");
+    fprintf(json, "  \"runs\": [\n");
+    freePlacement(&placement);
+
+    int result = EXIT_SUCCESS;
+    for (int threads = 1; threads <= BENCH_SCALING_MAX_THREADS && result == EXIT_SUCCESS; threads *= 2)
+    {
+        runOptions.threads = threads;
+
+        runOptions.split = TRUE_ARG;
+        size_t rows;
+        double splitSeconds = timeSplitConversion(inputFilename, &runOptions, &rows);
+
+        runOptions.split = FALSE_ARG;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int batchResult = runBatch(listFilename, "/dev/null", &runOptions);
+        double batchSeconds = secondsSince(&start);
+
+        if (splitSeconds < 0 || batchResult < 0)
+        {
+            result = EXIT_FAILURE;
+            break;
+        }
+        fprintf(json, "%s    {\"threads\": %d, \"batch\": {\"seconds\": %.6f, \"rows_per_s\": %.0f}, "
+                      "\"split\": {\"seconds\": %.6f, \"rows_per_s\": %.0f}}",
+                threads > 1 ? ",\n" : "", threads, batchSeconds, (double)rows * BENCH_SCALING_JOBS / batchSeconds,
+                splitSeconds, rows / splitSeconds);
+    }
+    fprintf(json, "\n  ]\n}\n");
+    unlink(inputFilename);
+    unlink(listFilename);
+    if (json != stdout && fclose(json) != 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
+        return EXIT_FAILURE;
+    }
+    return result;
+}
+
+#ifndef EMITOR_NO_MAIN
+int main(int argc, char *argv[])
+{
+    Options options;
+    const char *positional[MIN_ARGC];
+    int nPositional = 0;
+    const char *batchFilename = NULL;
+    const char *watchDir = NULL;
+    const char *generateFilename = NULL;
+    const char *benchFilename = NULL;
+    int bench = FALSE_ARG;
+    int benchStream = FALSE_ARG;
+    int benchScaling = FALSE_ARG;
+    int buildIndex = FALSE_ARG;
+    char indexFilename[PATH_MAX];
+
+    initOptions(&options);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], HELP_FLAG) == 0)
+        {
+            print_help();
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], COMMUNICATS_FLAG) == 0)
+        {
+            options.verbose = TRUE_ARG;
+        }
+        else if (strncmp(argv[i], BLOCK_SIZE_FLAG, strlen(BLOCK_SIZE_FLAG)) == 0)
+        {
+            if (!parseSize(argv[i] + strlen(BLOCK_SIZE_FLAG), &options.blockSize))
+            {
+                fprintf(stderr, "Niepoprawny rozmiar bloku: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], STATS_FLAG, strlen(STATS_FLAG)) == 0)
         {
-            print_help();
-            return EXIT_SUCCESS;
+            const char *form = argv[i] + strlen(STATS_FLAG);
+            if (*form == '\0' || strcmp(form, "=text") == 0)
+            {
+                options.stats = STATS_TEXT;
+            }
+            else if (strcmp(form, "=json") == 0)
+            {
+                options.stats = STATS_JSON;
+            }
+            else
+            {
+                fprintf(stderr, "Nieznana postać raportu: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
         }
-        if (strcmp(argv[i], COMMUNICATS_FLAG) == 0)
+        else if (strncmp(argv[i], MAX_FIELD_FLAG, strlen(MAX_FIELD_FLAG)) == 0)
+        {
+            if (!parseSize(argv[i] + strlen(MAX_FIELD_FLAG), &fieldLimits.maxLength))
+            {
+                fprintf(stderr, "Niepoprawna maksymalna długość pola: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], ENGINE_FLAG, strlen(ENGINE_FLAG)) == 0)
+        {
+            const char *engine = argv[i] + strlen(ENGINE_FLAG);
+            if (strcmp(engine, "expat") == 0)
+            {
+                options.engine = ENGINE_EXPAT;
+            }
+            else if (strcmp(engine, "fast") == 0)
+            {
+                options.engine = ENGINE_FAST;
+            }
+            else
+            {
+                fprintf(stderr, "Nieznany silnik parsowania: %s\n", engine);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], INPUT_MODE_FLAG, strlen(INPUT_MODE_FLAG)) == 0)
+        {
+            const char *mode = argv[i] + strlen(INPUT_MODE_FLAG);
+            if (strcmp(mode, "auto") == 0)
+            {
+                options.inputMode = INPUT_MODE_AUTO;
+            }
+            else if (strcmp(mode, "mmap") == 0)
+            {
+                options.inputMode = INPUT_MODE_MMAP;
+            }
+            else if (strcmp(mode, "read") == 0)
+            {
+                options.inputMode = INPUT_MODE_READ;
+            }
+            else
+            {
+                fprintf(stderr, "Nieznany sposób odczytu wejścia: %s\n", mode);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], BENCH_FORMAT_FLAG, strlen(BENCH_FORMAT_FLAG)) == 0)
+        {
+            size_t rows = BENCH_DEFAULT_ROWS;
+            const char *value = argv[i] + strlen(BENCH_FORMAT_FLAG);
+            if (*value != '\0' && (*value != '=' || !parseSize(value + 1, &rows)))
+            {
+                fprintf(stderr, "Niepoprawna liczba wierszy: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            return runFormatBenchmark(rows);
+        }
+        else if (strncmp(argv[i], OUT_BUFFER_FLAG, strlen(OUT_BUFFER_FLAG)) == 0)
+        {
+            if (!parseSize(argv[i] + strlen(OUT_BUFFER_FLAG), &options.outBufferSize))
+            {
+                fprintf(stderr, "Niepoprawny rozmiar bufora wyjściowego: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], WRITER_FLAG, strlen(WRITER_FLAG)) == 0)
+        {
+            const char *mode = argv[i] + strlen(WRITER_FLAG);
+            if (strcmp(mode, "sync") == 0)
+            {
+                options.writerMode = WRITER_SYNC;
+            }
+            else if (strcmp(mode, "async") == 0)
+            {
+                options.writerMode = WRITER_ASYNC;
+            }
+            else
+            {
+                fprintf(stderr, "Nieznany sposób zapisu wyników: %s\n", mode);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], AGGREGATE_FLAG) == 0)
+        {
+            options.aggregate = TRUE_ARG;
+        }
+        else if (strcmp(argv[i], BUILD_INDEX_FLAG) == 0)
+        {
+            buildIndex = TRUE_ARG;
+        }
+        else if (strncmp(argv[i], INDEX_FLAG, strlen(INDEX_FLAG)) == 0 && argv[i][strlen(INDEX_FLAG)] != '\0')
+        {
+            options.indexFile = argv[i] + strlen(INDEX_FLAG);
+        }
+        else if (strncmp(argv[i], ONLY_FLAG, strlen(ONLY_FLAG)) == 0 && argv[i][strlen(ONLY_FLAG)] != '\0')
+        {
+            options.onlyNames = argv[i] + strlen(ONLY_FLAG);
+        }
+        else if (strcmp(argv[i], SORT_FLAG) == 0)
+        {
+            options.sort = TRUE_ARG;
+        }
+        else if (strncmp(argv[i], PARTITION_FLAG, strlen(PARTITION_FLAG)) == 0)
+        {
+            if (strcmp(argv[i] + strlen(PARTITION_FLAG), "emitor") != 0)
+            {
+                fprintf(stderr, "Nieznany podział wyników: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            options.partitionBy = PARTITION_EMITOR;
+        }
+        else if (strncmp(argv[i], MEMORY_FLAG, strlen(MEMORY_FLAG)) == 0)
+        {
+            if (!parseSize(argv[i] + strlen(MEMORY_FLAG), &options.memoryLimit))
+            {
+                fprintf(stderr, "Niepoprawny limit pamięci: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], OPEN_FILES_FLAG, strlen(OPEN_FILES_FLAG)) == 0)
+        {
+            char *end;
+            long openFiles = strtol(argv[i] + strlen(OPEN_FILES_FLAG), &end, 10);
+            if (*end != '\0' || openFiles < 1 || openFiles > MAX_OPEN_FILES)
+            {
+                fprintf(stderr, "Niepoprawna liczba otwartych plików: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            options.openFiles = (int)openFiles;
+        }
+        else if (strncmp(argv[i], TMP_DIR_FLAG, strlen(TMP_DIR_FLAG)) == 0 && argv[i][strlen(TMP_DIR_FLAG)] != '\0')
+        {
+            options.tmpDir = argv[i] + strlen(TMP_DIR_FLAG);
+        }
+        else if (strncmp(argv[i], WATCH_FLAG, strlen(WATCH_FLAG)) == 0)
+        {
+            watchDir = argv[i] + strlen(WATCH_FLAG);
+        }
+        else if (strncmp(argv[i], BATCH_FLAG, strlen(BATCH_FLAG)) == 0)
+        {
+            batchFilename = argv[i] + strlen(BATCH_FLAG);
+        }
+        else if (strncmp(argv[i], GENERATE_FLAG, strlen(GENERATE_FLAG)) == 0)
+        {
+            generateFilename = argv[i] + strlen(GENERATE_FLAG);
+        }
+        else if (strcmp(argv[i], BENCH_FLAG) == 0 || strncmp(argv[i], BENCH_FLAG "=", strlen(BENCH_FLAG "=")) == 0)
+        {
+            bench = TRUE_ARG;
+            benchFilename = argv[i][strlen(BENCH_FLAG)] == '=' ? argv[i] + strlen(BENCH_FLAG "=") : NULL;
+        }
+        else if (strncmp(argv[i], GEN_EMITORS_FLAG, strlen(GEN_EMITORS_FLAG)) == 0 ||
+                 strncmp(argv[i], GEN_PARAMS_FLAG, strlen(GEN_PARAMS_FLAG)) == 0 ||
+                 strncmp(argv[i], GEN_DEPTH_FLAG, strlen(GEN_DEPTH_FLAG)) == 0 ||
+                 strncmp(argv[i], GEN_SIZE_FLAG, strlen(GEN_SIZE_FLAG)) == 0)
+        {
+            if (!parseGeneratorOption(argv[i], &options.generator))
+            {
+                fprintf(stderr, "Niepoprawny parametr generatora: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], BENCH_STREAM_FLAG) == 0 || strncmp(argv[i], BENCH_STREAM_FLAG "=", strlen(BENCH_STREAM_FLAG "=")) == 0)
+        {
+            benchStream = TRUE_ARG;
+            benchFilename = argv[i][strlen(BENCH_STREAM_FLAG)] == '=' ? argv[i] + strlen(BENCH_STREAM_FLAG "=") : NULL;
+        }
+        else if (strcmp(argv[i], BENCH_SCALING_FLAG) == 0 || strncmp(argv[i], BENCH_SCALING_FLAG "=", strlen(BENCH_SCALING_FLAG "=")) == 0)
+        {
+            benchScaling = TRUE_ARG;
+            benchFilename = argv[i][strlen(BENCH_SCALING_FLAG)] == '=' ? argv[i] + strlen(BENCH_SCALING_FLAG "=") : NULL;
+        }
+        else if (strcmp(argv[i], NUMA_FLAG) == 0)
+        {
+            options.numa = TRUE_ARG;
+        }
+        else if (strcmp(argv[i], RECOVER_FLAG) == 0)
+        {
+            options.recover = TRUE_ARG;
+        }
+        else if (strncmp(argv[i], TEE_FLAG, strlen(TEE_FLAG)) == 0)
+        {
+            if (argv[i][strlen(TEE_FLAG)] == '\0' || options.nTees == MAX_TEES)
+            {
+                fprintf(stderr, "Niepoprawne wyjście --tee (najwyżej %d): %s\n", MAX_TEES, argv[i]);
+                return EXIT_FAILURE;
+            }
+            options.tees[options.nTees++] = argv[i] + strlen(TEE_FLAG);
+        }
+        else if (strcmp(argv[i], STREAM_FLAG) == 0)
+        {
+            options.stream = TRUE_ARG;
+        }
+        else if (strncmp(argv[i], READ_AHEAD_FLAG, strlen(READ_AHEAD_FLAG)) == 0)
+        {
+            char *end;
+            long blocks = strtol(argv[i] + strlen(READ_AHEAD_FLAG), &end, 10);
+            if (*end != '\0' || end == argv[i] + strlen(READ_AHEAD_FLAG) || blocks < 0 || blocks > MAX_READ_AHEAD)
+            {
+                fprintf(stderr, "Niepoprawna liczba bloków odczytywanych z wyprzedzeniem: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            options.readAhead = (int)blocks;
+        }
+        else if (strncmp(argv[i], COMPRESS_FLAG, strlen(COMPRESS_FLAG)) == 0)
+        {
+            if (!parseCompression(argv[i] + strlen(COMPRESS_FLAG), &options))
+            {
+                fprintf(stderr, "Niepoprawny sposób kompresji: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], FORMAT_FLAG, strlen(FORMAT_FLAG)) == 0)
+        {
+            const char *format = argv[i] + strlen(FORMAT_FLAG);
+            if (strcmp(format, "csv") == 0)
+            {
+                options.format = FORMAT_CSV;
+            }
+            else if (strcmp(format, "arrow") == 0)
+            {
+                options.format = FORMAT_ARROW;
+            }
+            else if (strcmp(format, "parquet") == 0)
+            {
+                options.format = FORMAT_PARQUET;
+            }
+            else
+            {
+                fprintf(stderr, "Nieznany format pliku wynikowego: %s\n", format);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], RULES_FLAG, strlen(RULES_FLAG)) == 0)
+        {
+            options.rulesFile = argv[i] + strlen(RULES_FLAG);
+        }
+        else if (strncmp(argv[i], DELTA_FLAG, strlen(DELTA_FLAG)) == 0)
+        {
+            options.deltaFile = argv[i] + strlen(DELTA_FLAG);
+            if (*options.deltaFile == '\0')
+            {
+                fprintf(stderr, "Brak nazwy pliku stanu: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], INTERN_FLAG) == 0)
+        {
+            options.intern = TRUE_ARG;
+        }
+        else if (strncmp(argv[i], PATH_IDS_FLAG, strlen(PATH_IDS_FLAG)) == 0)
+        {
+            options.pathIdsFile = argv[i] + strlen(PATH_IDS_FLAG);
+            if (*options.pathIdsFile == '\0')
+            {
+                fprintf(stderr, "Brak nazwy pliku słownika ścieżek: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], SPLIT_FLAG) == 0)
+        {
+            options.split = TRUE_ARG;
+        }
+        else if (strncmp(argv[i], THREADS_FLAG, strlen(THREADS_FLAG)) == 0)
+        {
+            char *end;
+            long threads = strtol(argv[i] + strlen(THREADS_FLAG), &end, 10);
+            if (*end != '\0' || threads < 1 || threads > MAX_THREADS)
+            {
+                fprintf(stderr, "Niepoprawna liczba wątków: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            options.threads = (int)threads;
+        }
+        else if (strncmp(argv[i], TIMESTAMP_FLAG, strlen(TIMESTAMP_FLAG)) == 0)
+        {
+            if (!parseTimestamp(argv[i] + strlen(TIMESTAMP_FLAG), &options))
+            {
+                fprintf(stderr, "Niepoprawne źródło znacznika czasu: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (nPositional < MIN_ARGC)
+        {
+            positional[nPositional++] = argv[i];
+        }
+    }
+
+    if (initMatcher(&extractionRules, options.rulesFile) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    if (generateFilename)
+    {
+        return runGenerator(generateFilename, &options);
+    }
+    if (bench)
+    {
+        return runBenchmark(benchFilename, &options);
+    }
+    if (benchStream)
+    {
+        return runStreamBenchmark(benchFilename, &options);
+    }
+    if (benchScaling)
+    {
+        return runScalingBenchmark(benchFilename, &options);
+    }
+    // The default sidecar of the index is the name of the input with INDEX_EXTENSION appended
+    if ((buildIndex || options.onlyNames) && !options.indexFile && nPositional > 0)
+    {
+        if (snprintf(indexFilename, sizeof(indexFilename), "%s%s", positional[0], INDEX_EXTENSION) >= (int)sizeof(indexFilename))
+        {
+            fprintf(stderr, "Zbyt długa nazwa pliku indeksu.\n");
+            return EXIT_FAILURE;
+        }
+        options.indexFile = indexFilename;
+    }
+    if (buildIndex)
+    {
+        if (nPositional < 1 || strcmp(positional[0], STDIO_NAME) == 0)
         {
-            verboseFlag = TRUE_ARG;
+            fprintf(stderr, "Opcja --build-index wymaga pliku z danymi.\n");
+            return EXIT_FAILURE;
         }
+        return runBuildIndex(positional[0], options.indexFile, &options) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    // The selected emitors are parsed one after another by one parser, from one indexed file
+    if (options.onlyNames && (batchFilename || watchDir || options.split || options.deltaFile))
+    {
+        fprintf(stderr, "Opcja --only nie jest obsługiwana w trybach --batch, --watch i --split ani z --delta.\n");
+        return EXIT_FAILURE;
+    }
+    // The outputs belong to the writer of one conversion
+    int arrowTee = 0;
+    for (int i = 0; i < options.nTees; i++)
+    {
+        arrowTee |= strncmp(options.tees[i], TEE_ARROW_PREFIX, strlen(TEE_ARROW_PREFIX)) == 0;
+    }
+    if (options.nTees > 0 && (batchFilename || watchDir || options.partitionBy != PARTITION_NONE))
+    {
+        fprintf(stderr, "Opcja --tee nie jest obsługiwana w trybach --batch i --watch ani z --partition-by.\n");
+        return EXIT_FAILURE;
+    }
+    // The Arrow copy is made from the rows saved by saveOneElement(), as they are written
+    if (arrowTee && options.format == FORMAT_CSV &&
+        (options.split || options.deltaFile || options.aggregate || options.sort || options.recover))
+    {
+        fprintf(stderr, "Wyjście --tee=arrow: nie jest obsługiwane w trybie --split ani z --delta, --aggregate, --sort i --recover.\n");
+        return EXIT_FAILURE;
+    }
+    if (arrowTee && options.format == FORMAT_PARQUET)
+    {
+        fprintf(stderr, "Wyjście --tee=arrow: wymaga formatu csv lub arrow.\n");
+        return EXIT_FAILURE;
+    }
+    if (options.nTees > 0)
+    {
+        // A closed socket fails the write of its output instead of stopping the program
+        signal(SIGPIPE, SIG_IGN);
+    }
+    // The rows of a malformed emitor are withdrawn from the output arena, the other stages keep them
+    if (options.recover && (options.split || options.onlyNames || options.format != FORMAT_CSV || options.deltaFile ||
+                            options.aggregate || options.sort || options.partitionBy != PARTITION_NONE))
+    {
+        fprintf(stderr, "Opcja --recover nie jest obsługiwana w trybie --split ani z --only, --format, --delta, --aggregate, --sort i --partition-by.\n");
+        return EXIT_FAILURE;
+    }
+    // The columnar file has one footer, so it cannot be merged from independently converted parts
+    if (options.format != FORMAT_CSV && (batchFilename || options.split))
+    {
+        fprintf(stderr, "Formaty arrow i parquet nie są obsługiwane w trybie --batch ani --split.\n");
+        return EXIT_FAILURE;
+    }
+    // The identifiers are numbered in the order of the rows of one output
+    if (options.pathIdsFile && (batchFilename || options.split || options.format != FORMAT_CSV))
+    {
+        fprintf(stderr, "Opcja --path-ids nie jest obsługiwana w trybie --batch, --split ani z --format.\n");
+        return EXIT_FAILURE;
+    }
+    // One state file describes the emitors of one document
+    if (options.deltaFile && (batchFilename || options.split || options.format != FORMAT_CSV))
+    {
+        fprintf(stderr, "Opcja --delta nie jest obsługiwana w trybie --batch, --split ani z --format.\n");
+        return EXIT_FAILURE;
+    }
+    // The held back rows of the delta mode cannot be replayed after a fallback to Expat
+    if (options.engine == ENGINE_FAST && options.deltaFile)
+    {
+        fprintf(stderr, "Opcja --engine=fast nie jest obsługiwana z --delta.\n");
+        return EXIT_FAILURE;
+    }
+    // Every thread of the batch and split modes has its own counters
+    if (options.stats != STATS_NONE && (batchFilename || options.split))
+    {
+        fprintf(stderr, "Opcja --stats nie jest obsługiwana w trybie --batch ani --split.\n");
+        return EXIT_FAILURE;
+    }
+    // The statistics are one table written at the end, and the split workers have their own converters
+    if (options.aggregate && (options.split || options.format != FORMAT_CSV || options.pathIdsFile || options.deltaFile))
+    {
+        fprintf(stderr, "Opcja --aggregate nie jest obsługiwana w trybie --split ani z --format, --path-ids i --delta.\n");
+        return EXIT_FAILURE;
+    }
+    // The rows are ordered and partitioned within one document, by one converter
+    if ((options.sort || options.partitionBy != PARTITION_NONE) &&
+        (batchFilename || watchDir || options.split || options.format != FORMAT_CSV || options.pathIdsFile || options.deltaFile || options.aggregate))
+    {
+        fprintf(stderr, "Opcje --sort i --partition-by nie są obsługiwane w trybach --batch, --watch i --split ani z --format, --path-ids, --delta i --aggregate.\n");
+        return EXIT_FAILURE;
+    }
+    if (options.partitionBy != PARTITION_NONE && options.compressCodec != CODEC_NONE)
+    {
+        fprintf(stderr, "Opcja --compress nie jest obsługiwana z --partition-by.\n");
+        return EXIT_FAILURE;
+    }
+    if (!options.tmpDir)
+    {
+        options.tmpDir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    }
+    // Every file of the watch mode is converted on its own, into its own output
+    if (watchDir && (options.pathIdsFile || options.deltaFile || options.stats != STATS_NONE || batchFilename))
+    {
+        fprintf(stderr, "Opcje --path-ids, --delta, --stats i --batch nie są obsługiwane w trybie --watch.\n");
+        return EXIT_FAILURE;
+    }
+    if (watchDir)
+    {
+        int result = runWatch(watchDir, nPositional > 0 ? positional[0] : watchDir, &options);
+        printSkippedRows();
+        return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (batchFilename)
+    {
+        int result = runBatch(batchFilename, nPositional > 0 ? positional[0] : NULL, &options);
+        printSkippedRows();
+        return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    if (argc < MIN_ARGC + 1)
+    if (nPositional < MIN_ARGC)
     {
         fprintf(stderr, "Zbyt mała ilość argumentów.\n");
         return EXIT_FAILURE;
     }
 
-    const char *inputFilename = argv[I_INPUT_FILE];
-    const char *outputFilename = argv[I_OUTPUT_FILE];
+    const char *inputFilename = positional[I_INPUT_FILE - 1];
+    const char *outputFilename = positional[I_OUTPUT_FILE - 1];
+    int useStdin = strcmp(inputFilename, STDIO_NAME) == 0;
+    int useStdout = strcmp(outputFilename, STDIO_NAME) == 0;
+
+    // Pipelines are converted in streaming mode, with memory independent of the input size
+    if (useStdin || useStdout)
+    {
+        options.stream = TRUE_ARG;
+    }
 
-    if (strstr(argv[I_INPUT_FILE], ".xml") == NULL)
+    if (!useStdin && strstr(inputFilename, ".xml") == NULL)
     {
         fprintf(stderr, "Niepoprawny format pliku wejściowego.\n");
         return EXIT_FAILURE;
     }
-    if (strstr(argv[I_OUTPUT_FILE], ".csv") == NULL)
+    // With --partition-by the output is the directory of the files of the emitors
+    if (options.partitionBy != PARTITION_NONE)
+    {
+        struct stat st;
+        if (useStdout || ((mkdir(outputFilename, 0755) != 0 && errno != EEXIST) || stat(outputFilename, &st) != 0 || !S_ISDIR(st.st_mode)))
+        {
+            fprintf(stderr, "Nie można utworzyć katalogu wynikowego %s.\n", outputFilename);
+            return EXIT_FAILURE;
+        }
+        options.partitionDir = outputFilename;
+    }
+    else if (!useStdout && strstr(outputFilename, outputExtensions[options.format]) == NULL)
     {
         fprintf(stderr, "Niepoprawny format pliku wyjściowego.\n");
         return EXIT_FAILURE;
     }
 
-    Data data;
-    initData(&data);
-
-    ParserContext context;
-    initParserContext(&context, &data);
-
     /*
      * Support for external XML and CSV files.
      */
-    FILE *inputFile = fopen(inputFilename, "r");
-    if (!inputFile)
+    int inputFd = useStdin ? STDIN_FILENO : open(inputFilename, O_RDONLY);
+    if (inputFd < 0)
     {
         fprintf(stderr, "Nie można otworzyć pliku z danymi.\n");
         return EXIT_FAILURE;
     }
 
-    FILE *outputFile = fopen(outputFilename, "w");
-    if (outputFile == NULL)
+    // The rows of the partitions are written to their own files, nothing goes through the writer
+    int outputFd = useStdout ? STDOUT_FILENO : options.partitionDir ? -1 : open(outputFilename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outputFd < 0 && !options.partitionDir)
     {
         fprintf(stderr, "Nie można otworzyć pliku wynikowego.\n\n");
-        fclose(inputFile);
+        close(inputFd);
         return EXIT_FAILURE;
     }
 
-    // Initialize the XML parser
-    XML_Parser parser = XML_ParserCreate(NULL);
-    XML_SetElementHandler(parser, startElement, endElement);
-    XML_SetCharacterDataHandler(parser, characterData);
-    XML_SetUserData(parser, &context);
-
-    // Write the CSV header to both the console and the output file
-    printf(verboseFlag ? "\"YYYY-MM-DD\",\"Hour\",\"Emitor.Tags\",\"Pkt_Value\"\n" : "");
-    if (fprintf(outputFile, "\"YYYY-MM-DD\",\"Hour\",\"Emitor.Tags\",\"Pkt_Value\"\n") < 0)
+    Converter converter;
+    OutputWriter writer;
+    CodecStage compression;
+    DeltaState delta;
+    int writeFd = outputFd;
+    if (initConverter(&converter) < 0 || (options.deltaFile && initDelta(&delta, options.deltaFile) < 0) ||
+        startOutputCompression(&compression, &writeFd, &options) < 0 || initOutputWriter(&writer, writeFd, &options) < 0)
     {
-        fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
-        fclose(inputFile);
-        fclose(outputFile);
-        XML_ParserFree(parser);
+        close(inputFd);
+        close(outputFd);
         return EXIT_FAILURE;
     }
+    converter.context.delta = options.deltaFile ? &delta : NULL;
+    StageStats stages;
+    memset(&stages, 0, sizeof(stages));
+    if (options.stats != STATS_NONE)
+    {
+        converter.context.stages = &stages;
+        writer.stages = &stages;
+    }
 
-    // Read the XML file and parse its contents
-    char buffer[1024];
-    int bytesRead;
-    while ((bytesRead = fread(buffer, 1, sizeof(buffer), inputFile)) > 0)
+    int result = convertInput(&converter, inputFd, &options, &writer, TRUE_ARG);
+    if (result == 0 && options.pathIdsFile)
     {
-        if (XML_Parse(parser, buffer, bytesRead, bytesRead < sizeof(buffer)) == XML_STATUS_ERROR)
-        {
-            fprintf(stderr, "Błąd: %s at line %ld\n", XML_ErrorString(XML_GetErrorCode(parser)), XML_GetCurrentLineNumber(parser));
-            fclose(inputFile);
-            fclose(outputFile);
-            XML_ParserFree(parser);
-            return EXIT_FAILURE;
-        }
-        else
-        {
-            for (int i = 0; i < context.nBuff; i++)
-            {
-                printf(verboseFlag ? "%s" : "", context.dataBuffers[i]);
-                if (fprintf(outputFile, "%s", context.dataBuffers[i]) < 0)
-                {
-                    fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
-                    fclose(inputFile);
-                    fclose(outputFile);
-                    XML_ParserFree(parser);
-                    return EXIT_FAILURE;
-                }
-            }
-            context.nBuff = 0;
-        }
+        result = writePathDictionary(&converter.paths, options.pathIdsFile);
+    }
+
+    if (closeOutputWriter(&writer) < 0)
+    {
+        result = -1;
+    }
+    if (finishOutputCompression(&compression, writeFd) < 0)
+    {
+        result = -1;
+    }
+    if (outputFd >= 0 && close(outputFd) != 0 && result == 0)
+    {
+        fprintf(stderr, "Błąd podczas zapisu do pliku wynikowego.\n");
+        result = -1;
     }
 
-    freeMemmory(context.dataBuffers, context.nBuff);
-    freeMemmory(data.tags, data.nTags);
+    // The state is only replaced after a complete conversion, so failed runs are repeated in full
+    if (options.deltaFile && result == 0)
+    {
+        result = saveDelta(&delta, options.deltaFile);
+    }
 
-    fclose(inputFile);
-    fclose(outputFile);
+    if (options.verbose && result == 0)
+    {
+        printStatistics(&converter.context, &writer);
+    }
+    if (options.stats != STATS_NONE && result == 0)
+    {
+        printStatsReport(&converter.context, &writer, &options);
+    }
+    printSkippedRows();
 
-    XML_ParserFree(parser);
-    return EXIT_SUCCESS;
+    close(inputFd);
+    if (options.deltaFile)
+    {
+        freeDelta(&delta);
+    }
+    freeConverter(&converter);
+    freeMatcher(&extractionRules);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
+#endif